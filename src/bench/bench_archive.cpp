@@ -0,0 +1,81 @@
+/**
+ * speed of task archives (see archive.hpp).
+ *
+ * Writes n records, then computes the mean turnaround from the
+ * mapped time stamp columns and, for comparison, from fully parsed
+ * records.
+ *
+ * usage: bench_archive [records] [path]
+ */
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <boost/format.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <gpf/controller/archive.hpp>
+
+using boost::posix_time::microsec_clock;
+using boost::posix_time::ptime;
+
+static double rate(long n, const ptime& t0){
+	return n / ((microsec_clock::universal_time() - t0).total_microseconds() / 1E6);
+}
+
+int main(int argc, char** argv){
+	long n = argc > 1 ? std::atol(argv[1]) : 1000000;
+	std::string path = argc > 2 ? argv[2] : (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+
+	ptime t0 = microsec_clock::universal_time();
+	{
+		gpf::archive_writer w(path);
+		gpf::task_db::record_t r;
+		r.set_msg_id("");
+		r.set_client_uuid("");
+		r.mutable_headers();
+		r.set_submitted("");
+		for(long i=0;i<n;i++){
+			char buf[64];
+			std::snprintf(buf, sizeof(buf), "task %ld", i);
+			r.set_content(buf);
+			r.set_eid(i % 64);
+			r.set_submitted_us(1000000*i);
+			r.set_started_us(1000000*i + 10);
+			r.set_completed_us(1000000*i + 10 + i % 1000);
+			w.add(gpf::msg_id_t(i, i), r);
+		}
+	}
+	double write_rate = rate(n, t0);
+	std::cout<<boost::format("%-8s %12.0f records/s, %ld bytes/record\n")
+		% "write" % write_rate % (boost::filesystem::file_size(path) / n);
+
+	gpf::archive_reader a(path);
+	if(!a.ok())
+		return 1;
+
+	t0 = microsec_clock::universal_time();
+	long long total = 0;
+	for(std::size_t b=0;b<a.blocks();b++){
+		gpf::archive_reader::block_view v = a.block(b);
+		for(std::size_t i=0;i<v.size;i++)
+			total += v.completed_us[i] - v.submitted_us[i];
+	}
+	std::cout<<boost::format("%-8s %12.0f records/s, mean %lld us\n")
+		% "columns" % rate(n, t0) % (total / n);
+
+	t0 = microsec_clock::universal_time();
+	total = 0;
+	gpf::task_db::record_t r;
+	for(std::size_t b=0;b<a.blocks();b++){
+		for(std::size_t i=0;i<a.block(b).size;i++){
+			a.record(b, i, r);
+			total += r.completed_us() - r.submitted_us();
+		}
+	}
+	std::cout<<boost::format("%-8s %12.0f records/s, mean %lld us\n")
+		% "records" % rate(n, t0) % (total / n);
+
+	if(argc <= 2)
+		boost::filesystem::remove(path);
+	return 0;
+}
@@ -0,0 +1,90 @@
+/**
+ * counts heap allocations per received monitor message, once with
+ * shared_ptr<Incoming> (as the hub did before) and once with
+ * incoming_pool.
+ *
+ * Messages are kept alive in rounds (like tasks in the hub) and then
+ * dropped all at once (like a purge), so the second round shows reuse.
+ *
+ * usage: bench_incoming_pool [messages_per_round]
+ */
+#include <iostream>
+#include <new>
+#include <cstdlib>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <gpf/util/incoming_pool.hpp>
+
+using boost::posix_time::microsec_clock;
+using boost::posix_time::ptime;
+
+static unsigned long g_allocations = 0;
+
+void* operator new(std::size_t n){
+	g_allocations ++;
+	if(void* p = std::malloc(n))
+		return p;
+	throw std::bad_alloc();
+}
+void operator delete(void* p) throw(){
+	std::free(p);
+}
+
+typedef boost::shared_ptr<ZmqMessage::Incoming<ZmqMessage::XRouting> > shared_msg_t;
+
+static void send_message(zmq::socket_t& out){
+	ZmqMessage::Outgoing<ZmqMessage::SimpleRouting> msg(out, 0);
+	msg << "client-id" << "" << "intask" << "header" << ZmqMessage::Flush;
+}
+
+template<class Msg, class Make>
+static void run_round(const char* name, int r, zmq::socket_t& in, zmq::socket_t& out, long n, Make make){
+	std::vector<Msg> keep;
+	keep.reserve(n);
+
+	// only the receiving side is counted
+	unsigned long allocs = 0;
+	boost::posix_time::time_duration dt;
+	for(long i=0;i<n;i++){
+		send_message(out);
+		unsigned long a0 = g_allocations;
+		ptime t0 = microsec_clock::universal_time();
+		Msg m = make(in);
+		m->receive_all();
+		keep.push_back(m);
+		dt     += microsec_clock::universal_time() - t0;
+		allocs += g_allocations - a0;
+	}
+
+	std::cout << boost::format("%-12s round %d: %6.2f allocations/msg %8.2f us/msg\n")
+		% name % r % ((double)allocs/n) % ((double)dt.total_microseconds()/n);
+	keep.clear(); // "purge"
+}
+
+static shared_msg_t make_shared_msg(zmq::socket_t& s){
+	return shared_msg_t(new ZmqMessage::Incoming<ZmqMessage::XRouting>(s));
+}
+
+int main(int argc, char* argv[]){
+	long n = argc>1 ? atol(argv[1]) : 100000;
+
+	zmq::context_t ctx(1);
+	zmq::socket_t in (ctx, ZMQ_PAIR);
+	zmq::socket_t out(ctx, ZMQ_PAIR);
+	in.bind("inproc://bench");
+	out.connect("inproc://bench");
+
+	gpf::incoming_pool pool;
+	for(int r=0;r<2;r++)
+		run_round<shared_msg_t>("shared_ptr", r, in, out, n, make_shared_msg);
+	for(int r=0;r<2;r++)
+		run_round<gpf::incoming_msg_t>("pool", r, in, out, n,
+				boost::bind(&gpf::incoming_pool::make, &pool, _1));
+
+	gpf::incoming_pool::stats_t st = pool.stats();
+	std::cout << boost::format("pool: %lu acquired, %lu allocated, %lu free\n")
+		% st.acquired % st.allocated % st.free;
+	return 0;
+}
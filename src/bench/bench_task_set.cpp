@@ -0,0 +1,127 @@
+/**
+ * memory and speed of the two task_set variants (see task_set.hpp).
+ *
+ * Inserts n tasks with uuid ids spread over 64 engines, moves each of
+ * them to another engine (as work stealing does), completes them by id
+ * and finally walks all tasks engine by engine. Moving is done the way
+ * task_tracker does it for the variant; its rate should not drop as n
+ * grows.
+ * Memory is what the container took from the heap, divided by n; it
+ * includes the task records themselves.
+ *
+ * usage: bench_task_set [tasks]
+ */
+#include <iostream>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <boost/format.hpp>
+#include <boost/foreach.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <gpf/controller/task_set.hpp>
+
+using boost::posix_time::microsec_clock;
+using boost::posix_time::ptime;
+
+static unsigned long g_bytes = 0;
+
+void* operator new(std::size_t n){
+	if(void* p = std::malloc(n)){
+		g_bytes += malloc_usable_size(p);
+		return p;
+	}
+	throw std::bad_alloc();
+}
+void operator delete(void* p) throw(){
+	if(p)
+		g_bytes -= malloc_usable_size(p);
+	std::free(p);
+}
+
+static gpf::msg_id_t make_id(long i){
+	char buf[40];
+	std::snprintf(buf, sizeof(buf), "%08lx-0000-4000-8000-%012lx", (i*2654435761UL) & 0xffffffffUL, i & 0xffffffffffffUL);
+	gpf::msg_id_t id;
+	gpf::parse_msg_id(buf, 36, id);
+	return id;
+}
+
+static double rate(long n, const ptime& t0){
+	return n / ((microsec_clock::universal_time() - t0).total_microseconds() / 1E6);
+}
+
+// as task_tracker::_set_engine
+struct set_engine_uuid{
+	int eid;
+	explicit set_engine_uuid(int e):eid(e){}
+	void operator()(gpf::task& t)const{ t.engine_uuid = eid; }
+};
+template<class Iterator>
+static void set_engine(gpf::ordered_task_set& tasks, Iterator it, int eid){
+	tasks.get<gpf::task_id_t>().modify(it, set_engine_uuid(eid));
+}
+template<class Iterator>
+static void set_engine(gpf::hashed_task_set& tasks, Iterator it, int eid){
+	gpf::task t = *it;
+	t.engine_uuid = eid;
+	tasks.get<gpf::task_id_t>().replace(it, t);
+}
+
+template<class Set>
+static void run(const char* name, long n){
+	const int n_engines = 64;
+	unsigned long b0 = g_bytes;
+	{
+		Set tasks;
+
+		ptime t0 = microsec_clock::universal_time();
+		for(long i=0;i<n;i++){
+			gpf::task t;
+			t.id          = make_id(i);
+			t.state       = gpf::TASK_PENDING;
+			t.client_uuid = 0;
+			t.engine_uuid = i % n_engines;
+			t.queue       = "task";
+			t.submitted   = t0 + boost::posix_time::microseconds(i);
+			tasks.insert(t);
+		}
+		double insert_rate = rate(n, t0);
+		unsigned long per_task = (g_bytes - b0) / n;
+
+		t0 = microsec_clock::universal_time();
+		auto& id_index = tasks.template get<gpf::task_id_t>();
+		for(long i=0;i<n;i++){
+			auto it = id_index.find(make_id(i));
+			set_engine(tasks, it, (it->engine_uuid + 1) % n_engines);
+		}
+		double reassign_rate = rate(n, t0);
+
+		t0 = microsec_clock::universal_time();
+		for(long i=0;i<n;i++){
+			auto it = id_index.find(make_id(i));
+			it->state     = gpf::TASK_COMPLETED;
+			it->completed = t0;
+		}
+		double complete_rate = rate(n, t0);
+
+		t0 = microsec_clock::universal_time();
+		long seen = 0;
+		auto& engine_index = tasks.template get<gpf::engine_id_t>();
+		for(int e=0;e<n_engines;e++)
+			BOOST_FOREACH(const gpf::task& t, engine_index.equal_range(e))
+				seen += t.state == gpf::TASK_COMPLETED;
+		double scan_rate = rate(seen, t0);
+
+		std::cout << boost::format("%-8s %lu bytes/task  insert %.0f/s  reassign %.0f/s  complete %.0f/s  by engine %.0f/s\n")
+			% name % per_task % insert_rate % reassign_rate % complete_rate % scan_rate;
+	}
+}
+
+int main(int argc, char* argv[]){
+	long n = argc>1 ? atol(argv[1]) : 10000000;
+	std::cout << "tasks: " << n << ", sizeof(task): " << sizeof(gpf::task) << std::endl;
+	run<gpf::ordered_task_set>("ordered", n);
+	run<gpf::hashed_task_set>("hashed", n);
+	return 0;
+}
@@ -0,0 +1,80 @@
+/**
+ * compares topic dispatch through std::map<std::string,...> (as the hub
+ * did before) with the length-switch in gpf/controller/topics.hpp.
+ *
+ * usage: bench_topic_dispatch [iterations]
+ */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+#include <boost/shared_ptr.hpp>
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <gpf/controller/topics.hpp>
+
+using namespace gpf;
+using boost::posix_time::microsec_clock;
+using boost::posix_time::ptime;
+
+typedef boost::shared_ptr<zmq::message_t> frame_ptr;
+
+static frame_ptr make_frame(const std::string& s){
+	frame_ptr f(new zmq::message_t(s.size()));
+	memcpy(f->data(), s.data(), s.size());
+	return f;
+}
+
+int main(int argc, char* argv[]){
+	long iterations = argc>1 ? atol(argv[1]) : 10000000;
+
+	// roughly what a busy task queue publishes on the monitor socket
+	const char* mix[] = { "intask", "tracktask", "outtask", "in", "out",
+		"intask", "outtask", "incontrol", "outcontrol", "bogus" };
+	const int n_mix = sizeof(mix)/sizeof(*mix);
+
+	std::vector<frame_ptr> frames;
+	for(int i=0;i<n_mix;i++)
+		frames.push_back(make_frame(mix[i]));
+
+	std::map<std::string,int> handlers;
+	handlers["in"]         = MONITOR_IN;
+	handlers["out"]        = MONITOR_OUT;
+	handlers["intask"]     = MONITOR_INTASK;
+	handlers["outtask"]    = MONITOR_OUTTASK;
+	handlers["tracktask"]  = MONITOR_TRACKTASK;
+	handlers["incontrol"]  = MONITOR_INCONTROL;
+	handlers["outcontrol"] = MONITOR_OUTCONTROL;
+
+	long checksum_map = 0, checksum_switch = 0;
+
+	ptime t0 = microsec_clock::universal_time();
+	for(long i=0;i<iterations;i++){
+		zmq::message_t& f = *frames[i%n_mix];
+		std::string type(static_cast<const char*>(f.data()), f.size());
+		std::map<std::string,int>::iterator it = handlers.find(type);
+		checksum_map += it==handlers.end() ? MONITOR_UNKNOWN : it->second;
+	}
+	ptime t1 = microsec_clock::universal_time();
+	for(long i=0;i<iterations;i++){
+		zmq::message_t& f = *frames[i%n_mix];
+		checksum_switch += monitor_topic_id(f);
+	}
+	ptime t2 = microsec_clock::universal_time();
+
+	double us_map    = (t1-t0).total_microseconds();
+	double us_switch = (t2-t1).total_microseconds();
+
+	std::cout << boost::format("%-12s %10.2f ns/msg %12.0f msg/s\n")
+		% "std::map" % (1000.*us_map/iterations) % (iterations/us_map*1e6);
+	std::cout << boost::format("%-12s %10.2f ns/msg %12.0f msg/s\n")
+		% "switch" % (1000.*us_switch/iterations) % (iterations/us_switch*1e6);
+	std::cout << boost::format("speedup: %.1fx\n") % (us_map/us_switch);
+
+	if(checksum_map != checksum_switch){
+		std::cerr << "checksum mismatch: dispatch methods disagree!"<<std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,281 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <boost/bind.hpp>
+#include <glog/logging.h>
+#include <gpf/controller/archive.hpp>
+
+using namespace gpf;
+
+static const char file_magic[8]  = {'G','P','F','A','R','C','H','1'};
+static const char end_magic[8]   = {'G','P','F','A','E','N','D','1'};
+static const boost::uint32_t block_magic = 0x4b4c4247; // "GBLK"
+
+struct block_header{
+	boost::uint32_t magic;
+	boost::uint32_t n;
+	boost::uint64_t payload_offset;     ///< relative to the block
+	boost::uint64_t payload_compressed;
+	boost::uint64_t payload_size;
+};
+
+struct trailer{
+	boost::uint64_t n_blocks;
+	boost::uint64_t n_records;
+	boost::uint64_t index_offset;
+	char            magic[8];
+};
+
+static inline std::size_t align8(std::size_t n){ return (n + 7) & ~(std::size_t)7; }
+
+/// byte offsets of the columns within a block of n records
+struct block_layout{
+	std::size_t id_hi, id_lo, submitted, started, completed, eid, payload;
+	explicit block_layout(std::size_t n){
+		id_hi     = sizeof(block_header);
+		id_lo     = id_hi     + 8*n;
+		submitted = id_lo     + 8*n;
+		started   = submitted + 8*n;
+		completed = started   + 8*n;
+		eid       = completed + 8*n;
+		payload   = align8(eid + 4*n);
+	}
+};
+
+/**********************************
+ *         archive_writer
+ **********************************/
+
+archive_writer::archive_writer(const std::string& path, std::size_t block_records)
+: m_os(path.c_str(), std::ios::binary | std::ios::trunc)
+, m_block_records(std::max((std::size_t)1, block_records))
+, m_closed(false)
+, m_records(0)
+{
+	if(!m_os){
+		LOG(ERROR)<<"archive_writer: could not open `"<<path<<"'";
+		return;
+	}
+	m_os.write(file_magic, sizeof(file_magic));
+}
+
+archive_writer::~archive_writer(){
+	close();
+}
+
+static boost::int64_t column_time(bool has, boost::int64_t us){
+	return has ? us : archive_no_time;
+}
+
+void archive_writer::add(const msg_id_t& id, const task_db::record_t& r){
+	if(m_closed)
+		return;
+	m_id_hi.push_back(id.hi);
+	m_id_lo.push_back(id.lo);
+	m_submitted.push_back(column_time(r.has_submitted_us(), r.submitted_us()));
+	m_started  .push_back(column_time(r.has_started_us(),   r.started_us()));
+	m_completed.push_back(column_time(r.has_completed_us(), r.completed_us()));
+	m_eid.push_back(r.has_eid() ? r.eid() : -1);
+
+	std::size_t before = m_payload.size();
+	r.AppendToString(&m_payload);
+	m_sizes.push_back(m_payload.size() - before);
+
+	m_records ++;
+	if(m_id_hi.size() >= m_block_records)
+		_write_block();
+}
+
+template<class T>
+static void write_column(std::ostream& os, const std::vector<T>& v){
+	os.write(reinterpret_cast<const char*>(&v[0]), v.size()*sizeof(T));
+}
+
+void archive_writer::_write_block(){
+	std::size_t n = m_id_hi.size();
+	if(n == 0 || !m_os)
+		return;
+
+	// sizes first, so a reader can find the records without parsing
+	std::string raw(reinterpret_cast<const char*>(&m_sizes[0]), n*sizeof(boost::uint32_t));
+	raw += m_payload;
+	uLongf compressed_size = compressBound(raw.size());
+	std::string compressed(compressed_size, '\0');
+	if(compress2(reinterpret_cast<Bytef*>(&compressed[0]), &compressed_size,
+				reinterpret_cast<const Bytef*>(raw.data()), raw.size(), Z_DEFAULT_COMPRESSION) != Z_OK){
+		LOG(ERROR)<<"archive_writer: compression failed";
+		m_os.setstate(std::ios::badbit);
+		return;
+	}
+
+	block_layout l(n);
+	block_header h;
+	h.magic              = block_magic;
+	h.n                  = n;
+	h.payload_offset     = l.payload;
+	h.payload_compressed = compressed_size;
+	h.payload_size       = raw.size();
+
+	boost::uint64_t offset = m_os.tellp();
+	m_os.write(reinterpret_cast<const char*>(&h), sizeof(h));
+	write_column(m_os, m_id_hi);
+	write_column(m_os, m_id_lo);
+	write_column(m_os, m_submitted);
+	write_column(m_os, m_started);
+	write_column(m_os, m_completed);
+	write_column(m_os, m_eid);
+	static const char zeros[8] = {0};
+	m_os.write(zeros, l.payload - (l.eid + 4*n));
+	m_os.write(compressed.data(), compressed_size);
+	m_os.write(zeros, align8(compressed_size) - compressed_size); // keep the next block aligned
+	m_index.push_back(std::make_pair(offset, (boost::uint64_t)n));
+
+	m_id_hi.clear(); m_id_lo.clear();
+	m_submitted.clear(); m_started.clear(); m_completed.clear();
+	m_eid.clear(); m_sizes.clear(); m_payload.clear();
+}
+
+void archive_writer::close(){
+	if(m_closed)
+		return;
+	m_closed = true;
+	_write_block();
+	if(!m_os)
+		return;
+	trailer t;
+	t.n_blocks     = m_index.size();
+	t.n_records    = m_records;
+	t.index_offset = m_os.tellp();
+	memcpy(t.magic, end_magic, sizeof(end_magic));
+	if(!m_index.empty())
+		m_os.write(reinterpret_cast<const char*>(&m_index[0]), m_index.size()*sizeof(m_index[0]));
+	m_os.write(reinterpret_cast<const char*>(&t), sizeof(t));
+	m_os.close();
+}
+
+/**********************************
+ *         archive_reader
+ **********************************/
+
+archive_reader::archive_reader(const std::string& path)
+: m_path(path)
+, m_map(NULL)
+, m_mapped(0)
+, m_records(0)
+, m_cached_block(-1)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0){
+		LOG(ERROR)<<"archive_reader: could not open `"<<path<<"': "<<strerror(errno);
+		return;
+	}
+	struct stat st;
+	if(::fstat(fd, &st) == 0 && st.st_size > 0){
+		void* p = ::mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if(p != MAP_FAILED){
+			m_map    = static_cast<const char*>(p);
+			m_mapped = st.st_size;
+		}
+	}
+	::close(fd);
+	if(m_map && !_open()){
+		LOG(ERROR)<<"archive_reader: `"<<path<<"' is not a complete archive";
+		::munmap(const_cast<char*>(m_map), m_mapped);
+		m_map = NULL;
+	}
+}
+
+archive_reader::~archive_reader(){
+	if(m_map)
+		::munmap(const_cast<char*>(m_map), m_mapped);
+}
+
+bool archive_reader::_open(){
+	if(m_mapped < sizeof(file_magic) + sizeof(trailer) || memcmp(m_map, file_magic, sizeof(file_magic)) != 0)
+		return false;
+	trailer t;
+	memcpy(&t, m_map + m_mapped - sizeof(t), sizeof(t));
+	if(memcmp(t.magic, end_magic, sizeof(end_magic)) != 0
+	|| t.index_offset + t.n_blocks*16 + sizeof(t) != m_mapped)
+		return false;
+
+	m_records = t.n_records;
+	for(boost::uint64_t b=0;b<t.n_blocks;b++){
+		boost::uint64_t entry[2];
+		memcpy(entry, m_map + t.index_offset + b*sizeof(entry), sizeof(entry));
+		std::size_t n = entry[1];
+		block_layout l(n);
+		if(entry[0] + l.payload > t.index_offset)
+			return false;
+		const char* start = m_map + entry[0];
+		const block_header* h = reinterpret_cast<const block_header*>(start);
+		if(h->magic != block_magic || h->n != n
+		|| entry[0] + h->payload_offset + h->payload_compressed > t.index_offset)
+			return false;
+		block_view v;
+		v.size         = n;
+		v.id_hi        = reinterpret_cast<const boost::uint64_t*>(start + l.id_hi);
+		v.id_lo        = reinterpret_cast<const boost::uint64_t*>(start + l.id_lo);
+		v.submitted_us = reinterpret_cast<const boost::int64_t*> (start + l.submitted);
+		v.started_us   = reinterpret_cast<const boost::int64_t*> (start + l.started);
+		v.completed_us = reinterpret_cast<const boost::int64_t*> (start + l.completed);
+		v.eid          = reinterpret_cast<const boost::int32_t*> (start + l.eid);
+		m_blocks.push_back(v);
+		m_block_starts.push_back(start);
+	}
+	return true;
+}
+
+bool archive_reader::record(std::size_t b, std::size_t i, task_db::record_t& r){
+	if(b >= m_blocks.size() || i >= m_blocks[b].size)
+		return false;
+	if(m_cached_block != b){
+		const block_header* h = reinterpret_cast<const block_header*>(m_block_starts[b]);
+		m_cached_payload.resize(h->payload_size);
+		uLongf size = h->payload_size;
+		if(uncompress(reinterpret_cast<Bytef*>(&m_cached_payload[0]), &size,
+					reinterpret_cast<const Bytef*>(m_block_starts[b] + h->payload_offset), h->payload_compressed) != Z_OK
+		|| size != h->payload_size){
+			LOG(ERROR)<<"archive_reader: corrupt block "<<b<<" in `"<<m_path<<"'";
+			m_cached_block = -1;
+			return false;
+		}
+		std::size_t n = h->n;
+		m_cached_offsets.resize(n+1);
+		m_cached_offsets[0] = n*sizeof(boost::uint32_t);
+		for(std::size_t k=0;k<n;k++){
+			boost::uint32_t s;
+			memcpy(&s, m_cached_payload.data() + k*sizeof(s), sizeof(s));
+			m_cached_offsets[k+1] = m_cached_offsets[k] + s;
+		}
+		m_cached_block = b;
+	}
+	return r.ParseFromArray(m_cached_payload.data() + m_cached_offsets[i], m_cached_offsets[i+1] - m_cached_offsets[i]);
+}
+
+/**********************************
+ *         export_archive
+ **********************************/
+
+static bool add_to_archive(archive_writer& w, const msg_id_t& id, const task_db::record_t& r){
+	w.add(id, r);
+	return true;
+}
+
+std::size_t gpf::export_archive(task_db& db, const std::string& path){
+	archive_writer w(path);
+	if(!w.ok())
+		return 0;
+	const msg_id_t last(std::numeric_limits<boost::uint64_t>::max(), std::numeric_limits<boost::uint64_t>::max());
+	db.scan(msg_id_t(), last, boost::bind(add_to_archive, boost::ref(w), _1, _2));
+	// scan() excludes its upper bound
+	task_db::record_t r;
+	if(db.lookup(last, r))
+		w.add(last, r);
+	w.close();
+	return w.size();
+}
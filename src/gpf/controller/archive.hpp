@@ -0,0 +1,126 @@
+#ifndef __GPF_ARCHIVE_HPP__
+#     define __GPF_ARCHIVE_HPP__
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <limits>
+#include <boost/utility.hpp>
+#include <boost/cstdint.hpp>
+#include <gpf/controller/db.hpp>
+
+namespace gpf
+{
+	/**
+	 * Task archives: task_records for offline analysis.
+	 *
+	 * Records are stored in blocks of up to block_records records.
+	 * Each block holds fixed-width columns (msg_id, time stamps in us
+	 * since the epoch, eid), 8 byte aligned, so that readers can use
+	 * them straight from a memory map. The full records follow as one
+	 * zlib-compressed blob per block, which is only inflated if a
+	 * record is asked for.
+	 *
+	 *   file:    "GPFARCH1" block* index trailer
+	 *   block:   block_header id_hi[n] id_lo[n] submitted[n] started[n]
+	 *            completed[n] eid[n] (padding) payload
+	 *   payload: zlib( size[n] record* )
+	 *   index:   (offset, n) per block
+	 *   trailer: n_blocks n_records index_offset "GPFAEND1"
+	 *
+	 * All numbers are in host byte order.
+	 */
+
+	/// value of time stamp columns for records without that time
+	static const boost::int64_t archive_no_time = std::numeric_limits<boost::int64_t>::min();
+
+	/// writes an archive. Not thread safe.
+	class archive_writer
+	: boost::noncopyable
+	{
+		public:
+			explicit archive_writer(const std::string& path, std::size_t block_records=65536);
+			/// calls close()
+			~archive_writer();
+
+			inline bool ok()const{ return m_os.good(); }
+
+			void add(const msg_id_t& id, const task_db::record_t& r);
+			/// write the last block and the index. Further adds are ignored.
+			void close();
+
+			inline boost::uint64_t size()const{ return m_records; }
+
+		private:
+			void _write_block();
+
+			std::ofstream m_os;
+			std::size_t   m_block_records;
+			bool          m_closed;
+			boost::uint64_t m_records;
+			std::vector<std::pair<boost::uint64_t, boost::uint64_t> > m_index; ///< offset and size of each block
+
+			// the current block
+			std::vector<boost::uint64_t> m_id_hi, m_id_lo;
+			std::vector<boost::int64_t>  m_submitted, m_started, m_completed;
+			std::vector<boost::int32_t>  m_eid;
+			std::vector<boost::uint32_t> m_sizes;
+			std::string                  m_payload;
+	};
+
+	/// reads an archive through a memory map
+	class archive_reader
+	: boost::noncopyable
+	{
+		public:
+			/// columns of one block, pointing into the map
+			struct block_view{
+				std::size_t size;
+				const boost::uint64_t* id_hi;
+				const boost::uint64_t* id_lo;
+				const boost::int64_t*  submitted_us;
+				const boost::int64_t*  started_us;
+				const boost::int64_t*  completed_us;
+				const boost::int32_t*  eid;
+
+				inline msg_id_t id(std::size_t i)const{ return msg_id_t(id_hi[i], id_lo[i]); }
+			};
+
+			explicit archive_reader(const std::string& path);
+			~archive_reader();
+
+			/// false if the file could not be mapped or is no (complete) archive
+			inline bool ok()const{ return m_map != NULL; }
+
+			inline std::size_t     blocks()const{ return m_blocks.size(); }
+			inline boost::uint64_t   size()const{ return m_records; }
+
+			block_view block(std::size_t b)const{ return m_blocks[b]; }
+
+			/// the full record of row i in block b (inflates the block's payload)
+			bool record(std::size_t b, std::size_t i, task_db::record_t& r);
+
+		private:
+			bool _open();
+
+			std::string  m_path;
+			const char*  m_map;
+			std::size_t  m_mapped;
+			boost::uint64_t         m_records;
+			std::vector<block_view> m_blocks;
+			std::vector<const char*> m_block_starts;
+
+			// the last inflated payload
+			std::size_t  m_cached_block;
+			std::string  m_cached_payload;
+			std::vector<std::size_t> m_cached_offsets;
+	};
+
+	/**
+	 * write all records of db to an archive at path.
+	 * @return the number of records written
+	 */
+	std::size_t export_archive(task_db& db, const std::string& path);
+}
+
+#endif /* __GPF_ARCHIVE_HPP__ */
@@ -0,0 +1,73 @@
+#include <boost/foreach.hpp>
+#include <glog/logging.h>
+#include <gpf/controller/dag.hpp>
+
+using namespace gpf;
+
+dependency_graph::dependency_graph(std::size_t done_limit)
+: m_done_limit(done_limit)
+, m_blocked(0)
+{
+}
+
+bool dependency_graph::add(const msg_id_t& id, const std::vector<msg_id_t>& deps){
+	auto ins = m_nodes.insert(std::make_pair(id, node()));
+	if(!ins.second){
+		LOG(ERROR)<<"dependency_graph: task "<<id<<" submitted twice";
+		return ins.first->second.missing == 0;
+	}
+	unsigned int missing = 0;
+	BOOST_FOREACH(const msg_id_t& d, deps){
+		if(d == id)
+			continue;
+		auto it = m_nodes.find(d);
+		if(it == m_nodes.end() || it->second.done)
+			continue;
+		it->second.dependents.push_back(id);
+		missing ++;
+	}
+	// only known tasks are waited for, so there are no cycles
+	if(missing){
+		ins.first->second.missing = missing;
+		m_blocked ++;
+	}
+	return missing == 0;
+}
+
+void dependency_graph::completed(const msg_id_t& id, int eid, std::vector<msg_id_t>& ready){
+	auto it = m_nodes.find(id);
+	if(it == m_nodes.end() || it->second.done)
+		return;
+	it->second.done = true;
+	it->second.eid  = eid;
+	if(it->second.missing){
+		// failed while waiting, e.g. missed its deadline
+		it->second.missing = 0;
+		m_blocked --;
+	}
+	std::vector<msg_id_t> dependents;
+	dependents.swap(it->second.dependents);
+	BOOST_FOREACH(const msg_id_t& d, dependents){
+		auto n = m_nodes.find(d);
+		if(n == m_nodes.end() || n->second.missing == 0)
+			continue;
+		if(--n->second.missing == 0){
+			m_blocked --;
+			ready.push_back(d);
+		}
+	}
+	m_done.push_back(id);
+	_forget();
+}
+
+int dependency_graph::engine(const msg_id_t& id)const{
+	auto it = m_nodes.find(id);
+	return it == m_nodes.end() || !it->second.done ? -1 : it->second.eid;
+}
+
+void dependency_graph::_forget(){
+	while(m_done.size() > m_done_limit){
+		m_nodes.erase(m_done.front());
+		m_done.pop_front();
+	}
+}
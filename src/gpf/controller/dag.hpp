@@ -0,0 +1,67 @@
+#ifndef __GPF_DAG_HPP__
+#     define __GPF_DAG_HPP__
+
+#include <vector>
+#include <deque>
+#include <boost/unordered_map.hpp>
+#include <gpf/util/msg_id.hpp>
+
+namespace gpf
+{
+	/**
+	 * which submitted tasks wait for which others to complete.
+	 *
+	 * Every task is added once, with the tasks it depends on. A task
+	 * counts the dependencies that are not completed yet and keeps the
+	 * tasks that wait for it, so a completion touches only its own
+	 * edges: O(edges) over the whole graph.
+	 *
+	 * Completed tasks are remembered (with the engine that ran them,
+	 * for `follow' dependencies) up to done_limit, the oldest are
+	 * forgotten first. A dependency on a task the graph does not know
+	 * counts as met: it completed before it was forgotten, or it was
+	 * never submitted here. A task that never completes keeps its
+	 * dependents waiting; tasks lost with their engine are reported
+	 * like failed ones (see task_scheduler::fail()).
+	 */
+	class dependency_graph
+	{
+		public:
+			explicit dependency_graph(std::size_t done_limit=1000000);
+
+			/**
+			 * id was submitted and waits for deps.
+			 *
+			 * @return true if id is ready, i.e. all deps are completed
+			 */
+			bool add(const msg_id_t& id, const std::vector<msg_id_t>& deps);
+
+			/// id completed (or failed) on eid, appends the tasks now ready to ready
+			void completed(const msg_id_t& id, int eid, std::vector<msg_id_t>& ready);
+
+			/// the engine that ran id, -1 if it did not complete (or is forgotten)
+			int engine(const msg_id_t& id)const;
+
+			/// tasks added and not completed
+			inline std::size_t pending()const{ return m_nodes.size() - m_done.size(); }
+			/// tasks that are not ready
+			inline std::size_t blocked()const{ return m_blocked; }
+
+		private:
+			struct node{
+				unsigned int          missing;    ///< dependencies not completed yet
+				bool                  done;
+				int                   eid;        ///< completed on
+				std::vector<msg_id_t> dependents; ///< tasks that wait for this one
+				node():missing(0),done(false),eid(-1){}
+			};
+			void _forget();
+
+			boost::unordered_map<msg_id_t, node> m_nodes;
+			std::deque<msg_id_t>                 m_done;    ///< completed, oldest first
+			std::size_t                          m_done_limit;
+			std::size_t                          m_blocked;
+	};
+}
+
+#endif /* __GPF_DAG_HPP__ */
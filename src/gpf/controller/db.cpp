@@ -0,0 +1,414 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/filesystem.hpp>
+#include <glog/logging.h>
+#include <gpf/controller/db.hpp>
+
+using namespace gpf;
+
+/**********************************
+ *         memory_task_db
+ **********************************/
+
+void memory_task_db::insert(const msg_id_t& id, const record_t& r){
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_db[id] = r;
+}
+
+bool memory_task_db::update(const msg_id_t& id, const record_t& r){
+	boost::mutex::scoped_lock lock(m_mutex);
+	auto it = m_db.find(id);
+	if(it == m_db.end())
+		return false;
+	it->second.MergeFrom(r);
+	return true;
+}
+
+bool memory_task_db::lookup(const msg_id_t& id, record_t& r){
+	boost::mutex::scoped_lock lock(m_mutex);
+	auto it = m_db.find(id);
+	if(it == m_db.end())
+		return false;
+	r = it->second;
+	return true;
+}
+
+bool memory_task_db::erase(const msg_id_t& id){
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_db.erase(id);
+}
+
+void memory_task_db::clear(){
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_db.clear();
+}
+
+std::size_t memory_task_db::scan(const msg_id_t& from, const msg_id_t& to, const visitor_t& v){
+	boost::mutex::scoped_lock lock(m_mutex);
+	std::size_t n = 0;
+	for(auto it = m_db.lower_bound(from); it != m_db.end() && it->first < to; ++it){
+		n++;
+		if(!v(it->first, it->second))
+			break;
+	}
+	return n;
+}
+
+std::size_t memory_task_db::size(){
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_db.size();
+}
+
+/**********************************
+ *         mmap_task_db
+ **********************************/
+
+// every record starts with this, followed by `size' bytes of task_record
+struct record_header{
+	boost::uint32_t size;  ///< tombstone_size for erased ids
+	boost::uint64_t hi;
+	boost::uint64_t lo;
+} __attribute__((packed));
+
+static const boost::uint32_t tombstone_size = 0xffffffffu;
+
+static bool write_all(int fd, const char* p, std::size_t n){
+	while(n > 0){
+		ssize_t w = ::write(fd, p, n);
+		if(w < 0){
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		p += w;
+		n -= w;
+	}
+	return true;
+}
+
+mmap_task_db::mmap_task_db(const std::string& path, std::size_t write_buffer, boost::uint64_t compact_min)
+: m_path(path)
+, m_buffer_max(write_buffer)
+, m_written(0)
+, m_dead(0)
+, m_compact_min(compact_min)
+, m_compact_at(compact_min)
+, m_map(NULL)
+, m_mapped(0)
+{
+	m_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if(m_fd < 0){
+		LOG(ERROR)<<"mmap_task_db: could not open `"<<path<<"': "<<strerror(errno);
+		return;
+	}
+	_load();
+}
+
+mmap_task_db::~mmap_task_db(){
+	if(m_fd < 0)
+		return;
+	_flush();
+	if(m_map)
+		::munmap(const_cast<char*>(m_map), m_mapped);
+	::close(m_fd);
+}
+
+void mmap_task_db::_load(){
+	struct stat st;
+	if(::fstat(m_fd, &st) != 0 || st.st_size == 0)
+		return;
+	m_written = st.st_size;
+	m_mapped  = st.st_size;
+	void* p = ::mmap(NULL, m_mapped, PROT_READ, MAP_SHARED, m_fd, 0);
+	if(p == MAP_FAILED){
+		LOG(ERROR)<<"mmap_task_db: could not map `"<<m_path<<"': "<<strerror(errno);
+		::close(m_fd);
+		m_fd = -1;
+		return;
+	}
+	m_map = static_cast<const char*>(p);
+
+	boost::uint64_t pos = 0;
+	while(pos + sizeof(record_header) <= m_written){
+		record_header h;
+		memcpy(&h, m_map+pos, sizeof(h));
+		msg_id_t id(h.hi, h.lo);
+		auto it = m_index.find(id);
+		if(it != m_index.end())
+			m_dead += it->second.size;
+		if(h.size == tombstone_size){
+			if(it != m_index.end())
+				m_index.erase(it);
+			m_dead += sizeof(h);
+			pos    += sizeof(h);
+			continue;
+		}
+		if(pos + sizeof(h) + h.size > m_written){
+			if(it != m_index.end())
+				m_dead -= it->second.size;
+			break;
+		}
+		slot_t& slot = m_index[id];
+		slot.offset = pos;
+		slot.size   = sizeof(h) + h.size;
+		pos += slot.size;
+	}
+	if(pos != m_written){
+		LOG(WARNING)<<"mmap_task_db: cutting off "<<(m_written-pos)<<" bytes of a torn record in `"<<m_path<<"'";
+		if(::ftruncate(m_fd, pos) != 0)
+			LOG(ERROR)<<"mmap_task_db: could not truncate `"<<m_path<<"': "<<strerror(errno);
+		m_written = pos;
+	}
+	LOG(INFO)<<"mmap_task_db: loaded "<<m_index.size()<<" records from `"<<m_path<<"', "
+		<<m_dead<<" of "<<m_written<<" bytes are dead";
+}
+
+void mmap_task_db::_append(const msg_id_t& id, const std::string* data){
+	record_header h;
+	h.size = data ? data->size() : tombstone_size;
+	h.hi   = id.hi;
+	h.lo   = id.lo;
+	auto it = m_index.find(id);
+	if(it != m_index.end())
+		m_dead += it->second.size;
+	if(data){
+		slot_t& slot = m_index[id];
+		slot.offset = m_written + m_buffer.size();
+		slot.size   = sizeof(h) + data->size();
+	}else{
+		if(it != m_index.end())
+			m_index.erase(it);
+		m_dead += sizeof(h);
+	}
+	m_buffer.append(reinterpret_cast<const char*>(&h), sizeof(h));
+	if(data)
+		m_buffer.append(*data);
+	if(m_buffer.size() >= m_buffer_max)
+		_flush();
+	if(m_dead >= m_compact_at && m_dead*2 > m_written + m_buffer.size())
+		_compact();
+}
+
+void mmap_task_db::_flush(){
+	const char* p = m_buffer.data();
+	std::size_t n = m_buffer.size();
+	while(n > 0){
+		ssize_t w = ::pwrite(m_fd, p, n, m_written);
+		if(w < 0){
+			if(errno == EINTR)
+				continue;
+			LOG(ERROR)<<"mmap_task_db: could not write `"<<m_path<<"': "<<strerror(errno);
+			break;
+		}
+		p         += w;
+		n         -= w;
+		m_written += w;
+	}
+	m_buffer.erase(0, m_buffer.size() - n);
+}
+
+bool mmap_task_db::_map(){
+	if(m_mapped == m_written)
+		return true;
+	if(m_map)
+		::munmap(const_cast<char*>(m_map), m_mapped);
+	m_map    = NULL;
+	m_mapped = 0;
+	if(m_written == 0)
+		return true;
+	void* p = ::mmap(NULL, m_written, PROT_READ, MAP_SHARED, m_fd, 0);
+	if(p == MAP_FAILED){
+		LOG(ERROR)<<"mmap_task_db: could not map `"<<m_path<<"': "<<strerror(errno);
+		return false;
+	}
+	m_map    = static_cast<const char*>(p);
+	m_mapped = m_written;
+	return true;
+}
+
+bool mmap_task_db::_read(boost::uint64_t offset, record_t& r){
+	if(offset >= m_written)
+		_flush();
+	// the file grew, map all of it
+	if(offset >= m_mapped && !_map())
+		return false;
+	record_header h;
+	memcpy(&h, m_map+offset, sizeof(h));
+	if(h.size == tombstone_size || offset + sizeof(h) + h.size > m_mapped){
+		LOG(ERROR)<<"mmap_task_db: bad record at offset "<<offset<<" in `"<<m_path<<"'";
+		return false;
+	}
+	return r.ParseFromArray(m_map + offset + sizeof(h), h.size);
+}
+
+void mmap_task_db::insert(const msg_id_t& id, const record_t& r){
+	std::string data;
+	r.SerializeToString(&data);
+	boost::mutex::scoped_lock lock(m_mutex);
+	_append(id, &data);
+}
+
+bool mmap_task_db::update(const msg_id_t& id, const record_t& r){
+	boost::mutex::scoped_lock lock(m_mutex);
+	auto it = m_index.find(id);
+	if(it == m_index.end())
+		return false;
+	record_t old;
+	if(!_read(it->second.offset, old))
+		return false;
+	old.MergeFrom(r);
+	std::string data;
+	old.SerializeToString(&data);
+	_append(id, &data);
+	return true;
+}
+
+bool mmap_task_db::lookup(const msg_id_t& id, record_t& r){
+	boost::mutex::scoped_lock lock(m_mutex);
+	auto it = m_index.find(id);
+	if(it == m_index.end())
+		return false;
+	return _read(it->second.offset, r);
+}
+
+bool mmap_task_db::erase(const msg_id_t& id){
+	boost::mutex::scoped_lock lock(m_mutex);
+	if(m_index.find(id) == m_index.end())
+		return false;
+	_append(id, NULL);
+	return true;
+}
+
+void mmap_task_db::clear(){
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_index.clear();
+	m_buffer.clear();
+	if(m_map)
+		::munmap(const_cast<char*>(m_map), m_mapped);
+	m_map     = NULL;
+	m_mapped  = 0;
+	m_written = 0;
+	m_dead    = 0;
+	if(::ftruncate(m_fd, 0) != 0)
+		LOG(ERROR)<<"mmap_task_db: could not truncate `"<<m_path<<"': "<<strerror(errno);
+}
+
+std::size_t mmap_task_db::scan(const msg_id_t& from, const msg_id_t& to, const visitor_t& v){
+	boost::mutex::scoped_lock lock(m_mutex);
+	std::size_t n = 0;
+	record_t r;
+	for(auto it = m_index.lower_bound(from); it != m_index.end() && it->first < to; ++it){
+		if(!_read(it->second.offset, r))
+			continue;
+		n++;
+		if(!v(it->first, r))
+			break;
+	}
+	return n;
+}
+
+std::size_t mmap_task_db::size(){
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_index.size();
+}
+
+void mmap_task_db::flush(){
+	boost::mutex::scoped_lock lock(m_mutex);
+	_flush();
+}
+
+bool mmap_task_db::compact(){
+	boost::mutex::scoped_lock lock(m_mutex);
+	return _compact();
+}
+
+boost::uint64_t mmap_task_db::dead_bytes(){
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_dead;
+}
+
+boost::uint64_t mmap_task_db::file_bytes(){
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_written + m_buffer.size();
+}
+
+bool mmap_task_db::_compact(){
+	_flush();
+	if(!m_buffer.empty() || !_map())
+		return false;
+	std::string tmp = m_path + ".tmp";
+	int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0){
+		LOG(ERROR)<<"mmap_task_db: could not open `"<<tmp<<"': "<<strerror(errno);
+		m_compact_at = m_dead + m_compact_min; // retry after more garbage
+		return false;
+	}
+	// copy the live records in order of id, in pieces of about the
+	// write buffer
+	index_t index;
+	boost::uint64_t written = 0;
+	std::string buf;
+	bool ok = true;
+	for(auto it = m_index.begin(); ok && it != m_index.end(); ++it){
+		slot_t& slot = index[it->first];
+		slot.offset = written + buf.size();
+		slot.size   = it->second.size;
+		buf.append(m_map + it->second.offset, it->second.size);
+		if(buf.size() >= m_buffer_max){
+			ok = write_all(fd, buf.data(), buf.size());
+			written += buf.size();
+			buf.clear();
+		}
+	}
+	if(ok && !buf.empty()){
+		ok = write_all(fd, buf.data(), buf.size());
+		written += buf.size();
+	}
+	if(!ok || ::fsync(fd) != 0 || ::rename(tmp.c_str(), m_path.c_str()) != 0){
+		LOG(ERROR)<<"mmap_task_db: could not compact `"<<m_path<<"': "<<strerror(errno);
+		::close(fd);
+		::unlink(tmp.c_str());
+		m_compact_at = m_dead + m_compact_min;
+		return false;
+	}
+	boost::filesystem::path dir = boost::filesystem::path(m_path).parent_path();
+	int dfd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+	if(dfd >= 0){
+		::fsync(dfd);
+		::close(dfd);
+	}
+	LOG(INFO)<<"mmap_task_db: compacted `"<<m_path<<"' from "<<m_written<<" to "<<written<<" bytes";
+
+	if(m_map)
+		::munmap(const_cast<char*>(m_map), m_mapped);
+	::close(m_fd);
+	m_fd      = fd;
+	m_map     = NULL;
+	m_mapped  = 0;
+	m_written = written;
+	m_dead    = 0;
+	m_compact_at = m_compact_min;
+	m_index.swap(index);
+	return true;
+}
+
+/**********************************
+ *         make_task_db
+ **********************************/
+
+boost::shared_ptr<task_db> gpf::make_task_db(const std::string& spec){
+	if(spec == "memory://")
+		return boost::shared_ptr<task_db>(new memory_task_db());
+	if(spec.compare(0, 7, "file://") == 0 && spec.size() > 7){
+		boost::shared_ptr<mmap_task_db> db(new mmap_task_db(spec.substr(7)));
+		if(db->ok())
+			return db;
+		return boost::shared_ptr<task_db>();
+	}
+	LOG(ERROR)<<"make_task_db: unknown task database `"<<spec<<"'";
+	return boost::shared_ptr<task_db>();
+}
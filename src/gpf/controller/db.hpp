@@ -3,10 +3,20 @@
 
 #include <google/protobuf/message.h>
 #include <map>
+#include <string>
+#include <stdexcept>
+#include <boost/utility.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+#include <gpf/util/msg_id.hpp>
+#include <gpf/messages/hub.pb.h>
 
 namespace gpf
 {
 
+	/// an ordered map of protobuf messages
 	template<class K, class V>
 	class dict_db{
 		private:
@@ -21,21 +31,164 @@ namespace gpf
 			      iterator find(const K&k)       { return m_db.find(k); }
 			const_iterator find(const K&k) const { return m_db.find(k); }
 
+			/// first element not less than k
+			      iterator lower_bound(const K&k)       { return m_db.lower_bound(k); }
+			const_iterator lower_bound(const K&k) const { return m_db.lower_bound(k); }
+
 			      iterator begin()     { return m_db.begin(); }
 			const_iterator begin()const{ return m_db.begin(); }
 			      iterator   end()     { return m_db.end(); }
 			const_iterator   end()const{ return m_db.end(); }
 
+			inline std::size_t size()const{ return m_db.size(); }
+			inline bool       erase(const K&k){ return m_db.erase(k) > 0; }
+			inline void       clear(){ m_db.clear(); }
+
+			/// overwrite the fields which are set in v, see Message::MergeFrom
 			void update(const K&k, const V& v){
 				iterator it = find(k);
 				if(it==end()) throw std::runtime_error("No such key");
-				throw std::runtime_error("Not implemented");
-				//const google::protobuf::Message::Reflection* r = v.GetReflection();
-				//std::vector<google::protobuf::FieldDescriptor*> fds;
-				//r->ListFields(&v,&fds);
+				it->second.MergeFrom(v);
 			}
 	};
-	
+
+	/**
+	 * storage for completed tasks, keyed by msg_id.
+	 *
+	 * Implementations must be thread safe, task_trackers of all shards
+	 * write into the same task_db.
+	 */
+	class task_db
+	: boost::noncopyable
+	{
+		public:
+			typedef gpf_hub::task_record record_t;
+			/// called for each record of a scan, return false to stop
+			typedef boost::function<bool (const msg_id_t&, const record_t&)> visitor_t;
+
+			virtual ~task_db(){}
+
+			/// store r, replacing an existing record with the same id
+			virtual void insert(const msg_id_t& id, const record_t& r) = 0;
+			/// merge the fields set in r into an existing record. false if there is none.
+			virtual bool update(const msg_id_t& id, const record_t& r) = 0;
+			/// false if there is no record for id
+			virtual bool lookup(const msg_id_t& id, record_t& r) = 0;
+			/// false if there is no record for id
+			virtual bool erase (const msg_id_t& id) = 0;
+			virtual void clear() = 0;
+			/**
+			 * visit the records with from <= id < to in order of id.
+			 * @return the number of records visited
+			 */
+			virtual std::size_t scan(const msg_id_t& from, const msg_id_t& to, const visitor_t& v) = 0;
+			virtual std::size_t size() = 0;
+			/// make sure everything inserted so far is on disk (if there is one)
+			virtual void flush(){}
+	};
+
+	/// a task_db in memory
+	class memory_task_db
+	: public task_db
+	{
+		public:
+			void insert(const msg_id_t& id, const record_t& r);
+			bool update(const msg_id_t& id, const record_t& r);
+			bool lookup(const msg_id_t& id, record_t& r);
+			bool erase (const msg_id_t& id);
+			void clear();
+			std::size_t scan(const msg_id_t& from, const msg_id_t& to, const visitor_t& v);
+			std::size_t size();
+
+		private:
+			boost::mutex                m_mutex;
+			dict_db<msg_id_t, record_t> m_db;
+	};
+
+	/**
+	 * a task_db in an append-only file, read through a memory map.
+	 *
+	 * Each insert or update appends the full record; erase appends a
+	 * tombstone. Only the index (id -> file offset) is kept in memory.
+	 * Writes are buffered and go to the file on flush(), when the
+	 * buffer is full, or when a buffered record is read.
+	 *
+	 * The file is replayed on open. A torn record at its end (e.g.
+	 * after a crash) is cut off.
+	 *
+	 * Superseded records and tombstones are dead bytes, the file only
+	 * grows until they are reclaimed by compact(). That happens on its
+	 * own when a write leaves more than compact_min dead bytes which
+	 * are over half of the file: the live records are written to
+	 * <path>.tmp, synced and renamed over the file.
+	 */
+	class mmap_task_db
+	: public task_db
+	{
+		public:
+			explicit mmap_task_db(const std::string& path, std::size_t write_buffer=1<<20,
+				boost::uint64_t compact_min=64<<20);
+			~mmap_task_db();
+
+			/// false if the file could not be opened
+			inline bool ok()const{ return m_fd >= 0; }
+
+			void insert(const msg_id_t& id, const record_t& r);
+			bool update(const msg_id_t& id, const record_t& r);
+			bool lookup(const msg_id_t& id, record_t& r);
+			bool erase (const msg_id_t& id);
+			void clear();
+			std::size_t scan(const msg_id_t& from, const msg_id_t& to, const visitor_t& v);
+			std::size_t size();
+			void flush();
+
+			/// rewrite the file with only the live records. false if that failed.
+			bool compact();
+			/// bytes of superseded records and tombstones in the file
+			boost::uint64_t dead_bytes();
+			/// bytes in the file, including the write buffer
+			boost::uint64_t file_bytes();
+
+		private:
+			/// a record in the file
+			struct slot_t{
+				boost::uint64_t offset;
+				boost::uint64_t size;   ///< with the header
+			};
+			typedef std::map<msg_id_t, slot_t> index_t;
+
+			void _load();
+			void _append(const msg_id_t& id, const std::string* data);
+			void _flush();
+			/// map all of the file that was written
+			bool _map();
+			bool _read(boost::uint64_t offset, record_t& r);
+			bool _compact();
+
+			std::string      m_path;
+			int              m_fd;
+			boost::mutex     m_mutex;
+			index_t          m_index;       ///< the latest record per id
+			std::string      m_buffer;      ///< appended, not written yet
+			std::size_t      m_buffer_max;
+			boost::uint64_t  m_written;     ///< bytes in the file
+			boost::uint64_t  m_dead;        ///< see dead_bytes()
+			boost::uint64_t  m_compact_min;
+			boost::uint64_t  m_compact_at;  ///< dead bytes for the next compaction
+			const char*      m_map;
+			std::size_t      m_mapped;
+	};
+
+	/**
+	 * create a task_db from a description:
+	 *
+	 *   memory://              memory_task_db
+	 *   file:///path/to/file   mmap_task_db
+	 *
+	 * @return null (and logs) if spec is invalid or the file cannot be opened
+	 */
+	boost::shared_ptr<task_db> make_task_db(const std::string& spec);
+
 }
 
 #endif /* __GPF_CONTROLLER_DB_HPP__ */
@@ -1,10 +1,29 @@
+#include <algorithm>
+#include <climits>
+#include <boost/foreach.hpp>
 #include <zmq-poll-wrapper/reactor.hpp>
 #include <gpf/controller/engine_set.hpp>
 
 namespace gpf
 {
 	int engine_tracker::next_id(){
-			static int id = 0;
-			return id++;
+			return m_next_id++;
+	}
+	void engine_tracker::reserve_id(int id){
+			m_next_id = std::max(m_next_id, id+1);
+	}
+	void engine_tracker::add_services(const engine_connector& ec){
+		BOOST_FOREACH(const std::string& s, ec.services)
+			services.insert(std::make_pair(s, ec.id));
+	}
+	void engine_tracker::remove_services(const engine_connector& ec){
+		BOOST_FOREACH(const std::string& s, ec.services)
+			services.erase(std::make_pair(s, ec.id));
+	}
+	std::pair<service_index::const_iterator, service_index::const_iterator>
+	engine_tracker::offering(const std::string& service)const{
+		return std::make_pair(
+				services.lower_bound(std::make_pair(service, INT_MIN)),
+				services.upper_bound(std::make_pair(service, INT_MAX)));
 	}
 }
@@ -4,12 +4,15 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <utility>
 #include <boost/shared_ptr.hpp>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/identity.hpp>
 #include <boost/multi_index/member.hpp>
 #include <gpf/util/zmqmessage.hpp>
+#include <gpf/util/incoming_pool.hpp>
+#include <gpf/util/msg_id.hpp>
 
 namespace gpf
 {
@@ -22,12 +25,9 @@ namespace gpf
 		mutable std::string heartbeat; ///< heart's name
 		mutable std::vector<std::string> services; ///< services this engine offers
 
-		// stuff littering the hub class in ipython
-		mutable std::vector<std::string> queues; ///< ???
-		mutable std::vector<std::string> tasks; ///< ???
-		mutable std::vector<std::string> completed; ///< ???
+		// the tasks of an engine are counted by the task_trackers, see engine_task_counts
 
-		mutable boost::shared_ptr<ZmqMessage::Incoming<ZmqMessage::XRouting> > incoming_msg; ///< which we should reply to when done
+		mutable incoming_msg_t incoming_msg; ///< which we should reply to when done
 		mutable boost::shared_ptr<deadline_timer> deletion_callback; ///< should be canceled when registration succeeded with a heartbeat
 	};
 
@@ -46,11 +46,30 @@ namespace gpf
 	typedef boost::multi_index::index<engine_connector_set,queue_name_t>::type engine_connector_set_by_queue;
 	typedef boost::multi_index::index<engine_connector_set,heart_name_t>::type engine_connector_set_by_heart;
 
+	/// (service, eid), ordered by service
+	typedef std::set<std::pair<std::string, int> > service_index;
+
 	struct engine_tracker{
 		engine_connector_set          engines;
 		engine_connector_set          incoming_registrations;
 		std::set<std::string>         dead_engines;
+		service_index                 services;    ///< of the live engines in `engines'
+
+		engine_tracker():m_next_id(0){}
 		int next_id();
+		/// make sure next_id() does not hand out id again (e.g. after recovery)
+		void reserve_id(int id);
+		inline int peek_next_id()const{ return m_next_id; }
+
+		/// index/unindex the services of ec, O(log n) per service
+		void add_services(const engine_connector& ec);
+		void remove_services(const engine_connector& ec);
+		/// the live engines offering service, as [first, second) of `services'
+		std::pair<service_index::const_iterator, service_index::const_iterator>
+			offering(const std::string& service)const;
+
+		private:
+		int m_next_id;
 	};
 
 }
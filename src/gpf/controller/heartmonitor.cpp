@@ -8,6 +8,7 @@
 #include <glog/logging.h>
 #include <gpf/util/zmqmessage.hpp>
 #include <gpf/util/url_handling.hpp>
+#include <gpf/util/time.hpp>
 #include "heartmonitor.hpp"
 
 using namespace gpf;
@@ -91,6 +92,10 @@ heartmonitor::heartmonitor(heartmonitor::loop_type& loop, boost::shared_ptr<zmq:
 ,m_lifetime (microsec_clock::universal_time())
 ,m_tic      (microsec_clock::universal_time())
 ,m_last_ping(microsec_clock::universal_time())
+,m_lifetime_us(to_us(m_lifetime))
+,m_last_ping_us(to_us(m_last_ping))
+,m_lifetime_iso(to_iso_string(m_lifetime))
+,m_last_ping_iso(to_iso_string(m_last_ping))
 {
 	loop.add(m_router,ZMQ_POLLIN, boost::bind(&heartmonitor::handle_pong,this, _1)); // register w/ loop
 
@@ -105,19 +110,28 @@ void heartmonitor::handle_pong (zmq::socket_t& s){
 	msg.receive_all();
 	
 	std::string   heart = ZmqMessage::get_string(msg[0]);
-	std::string current = to_iso_string(m_lifetime);
-	std::string    last = to_iso_string(m_last_ping);
-	std::string received= ZmqMessage::get<std::string>(msg[1]);
-	if(received == current){
+	bool current, last;
+	if(msg.size() > 2 && msg[2].size() == sizeof(boost::int64_t)){
+		boost::int64_t received;
+		memcpy(&received, msg[2].data(), sizeof(received));
+		current = received == m_lifetime_us;
+		last    = received == m_last_ping_us;
+	}else{
+		// heart only echoed the ISO string
+		std::string received= ZmqMessage::get<std::string>(msg[1]);
+		current = received == m_lifetime_iso;
+		last    = received == m_last_ping_iso;
+	}
+	if(current){
 		time_duration delta = microsec_clock::universal_time() - m_lifetime;
 		m_responses.insert(heart);
 		VLOG(2) << "Heartbeat::Heart `"<<heart<<"' responded in time, took "<<delta<<" to respond.";
-	}else if(received == last){
+	}else if(last){
 		time_duration delta = microsec_clock::universal_time() - m_last_ping;
 		VLOG(2) << "Heartbeat::Heart `"<<heart<<"' missed a beat, and took "<<delta<<" to respond.";
 		m_responses.insert(heart);
 	}else{
-		VLOG(2) << "Heartbeat::Got bad heartbeat (possibly old): "<<last<<" current: "<<current;
+		VLOG(2) << "Heartbeat::Got bad heartbeat (possibly old): "<<m_last_ping_iso<<" current: "<<m_lifetime_iso;
 	}
 }
 
@@ -131,6 +145,11 @@ void heartmonitor::beat(heartmonitor::loop_type* r){
 	m_lifetime += toc - m_tic;
 	m_tic       = toc;
 
+	m_last_ping_us  = m_lifetime_us;
+	m_last_ping_iso.swap(m_lifetime_iso);
+	m_lifetime_us   = to_us(m_lifetime);
+	m_lifetime_iso  = to_iso_string(m_lifetime);
+
 	std::set<std::string> goodhearts, missed_beats, heartfailures, newhearts;
        	std::set_intersection(m_hearts.begin(),m_hearts.end(),
 			m_responses.begin(),m_responses.end(),
@@ -158,7 +177,9 @@ void heartmonitor::beat(heartmonitor::loop_type* r){
 
 	ZmqMessage::Outgoing<ZmqMessage::SimpleRouting> msg(*m_pub,
 			ZmqMessage::OutOptions::NONBLOCK | ZmqMessage::OutOptions::DROP_ON_BLOCK);
-	msg << to_iso_string(m_lifetime)<<ZmqMessage::Flush;
+	zmq::message_t lifetime_us(sizeof(m_lifetime_us));
+	memcpy(lifetime_us.data(), &m_lifetime_us, sizeof(m_lifetime_us));
+	msg << m_lifetime_iso << lifetime_us << ZmqMessage::Flush;
 }
 
 void heartmonitor::handle_new_heart(const std::string& heart){
@@ -5,6 +5,7 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
 #include <boost/function.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <zmq.hpp>
 #include <zmq-poll-wrapper/reactor.hpp>
@@ -77,6 +78,11 @@ namespace gpf
 		boost::posix_time::ptime m_tic;
 		boost::posix_time::ptime m_last_ping;
 
+		// m_lifetime and m_last_ping as they are sent out. Pongs
+		// echo the int64 frame, old hearts only the ISO string.
+		boost::int64_t m_lifetime_us,  m_last_ping_us;
+		std::string    m_lifetime_iso, m_last_ping_iso;
+
 		std::set<std::string> m_hearts;
 		std::set<std::string> m_responses;
 		std::set<std::string> m_on_probation;
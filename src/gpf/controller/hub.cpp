@@ -1,10 +1,14 @@
+#include <cstring>
+#include <algorithm>
 #include <boost/bind.hpp>
 #include <boost/format.hpp>
+#include <boost/make_shared.hpp>
 
 #include <glog/logging.h>
 
 #include <gpf/controller/hub.hpp>
 #include <gpf/util/url_handling.hpp>
+#include <gpf/util/time.hpp>
 
 #include <gpf/serialization/protobuf.hpp>
 #include <gpf/messages/hub.pb.h>
@@ -33,30 +37,42 @@ m_loop(loop)
 ,m_heartmonitor(hm)
 ,m_engine_info(ei)
 ,m_client_info(ci)
+,m_incoming_pool(incoming_pool::instance())
+// counts on from the clock, so tasks kept across a restart are older
+,m_arrivals(to_us(boost::posix_time::microsec_clock::universal_time()))
+,m_monitor_batch(1)
+,m_retention_timer(false)
+,m_db_timer(false)
+,m_next_stream(0)
+,m_stream_timeout(boost::posix_time::minutes(1))
+,m_streams_timer(false)
 {
+	set_task_shards(0);
 	m_registration_timeout =  std::max(5000, 2*hm->interval());
 
 	m_loop.add(m_query,    ZMQ_POLLIN, boost::bind(&hub::dispatch_query,this, _1));
 	m_loop.add(m_monitor,  ZMQ_POLLIN, boost::bind(&hub::dispatch_monitor_traffic,this, _1));
 	m_loop.add(m_resubmit, ZMQ_POLLIN, [=](zmq::socket_t&){});
 
-	m_monitor_handlers["in"]         = &hub::save_queue_request;
-	m_monitor_handlers["out"]        = &hub::save_queue_result;
-	m_monitor_handlers["intask"]     = &hub::save_task_request;
-	m_monitor_handlers["outtask"]    = &hub::save_task_result;
-	m_monitor_handlers["tracktask"]  = &hub::save_task_destination;
-	m_monitor_handlers["incontrol"]  = &hub::nop;
-	m_monitor_handlers["outcontrol"] = &hub::nop;
-
-	m_query_handlers["queue_request"]          = &hub::queue_status;
-	m_query_handlers["result_request"]         = &hub::get_results;
-	m_query_handlers["purge_request"]          = &hub::purge_results;
-	m_query_handlers["load_request"]           = &hub::check_load;
-	m_query_handlers["resubmit_request"]       = &hub::resubmit_task;
-	m_query_handlers["shutdown_request"]       = &hub::shutdown_request;
-	m_query_handlers["registration_request"]   = &hub::register_engine;
-	m_query_handlers["unregistration_request"] = &hub::unregister_engine;
-	m_query_handlers["connection_request"]     = &hub::connection_request;
+	m_monitor_handlers[MONITOR_IN]         = &hub::save_queue_request;
+	m_monitor_handlers[MONITOR_OUT]        = &hub::save_queue_result;
+	m_monitor_handlers[MONITOR_INTASK]     = &hub::save_task_request;
+	m_monitor_handlers[MONITOR_OUTTASK]    = &hub::save_task_result;
+	m_monitor_handlers[MONITOR_TRACKTASK]  = &hub::save_task_destination;
+	m_monitor_handlers[MONITOR_INCONTROL]  = &hub::nop;
+	m_monitor_handlers[MONITOR_OUTCONTROL] = &hub::nop;
+
+	m_query_handlers[QUERY_QUEUE]          = &hub::queue_status;
+	m_query_handlers[QUERY_RESULT]         = &hub::get_results;
+	m_query_handlers[QUERY_PURGE]          = &hub::purge_results;
+	m_query_handlers[QUERY_LOAD]           = &hub::check_load;
+	m_query_handlers[QUERY_RESUBMIT]       = &hub::resubmit_task;
+	m_query_handlers[QUERY_SHUTDOWN]       = &hub::shutdown_request;
+	m_query_handlers[QUERY_REGISTRATION]   = &hub::register_engine;
+	m_query_handlers[QUERY_UNREGISTRATION] = &hub::unregister_engine;
+	m_query_handlers[QUERY_CONNECTION]     = &hub::connection_request;
+	m_query_handlers[QUERY_CLIENT]         = &hub::client_status;
+	m_query_handlers[QUERY_TIME_RANGE]     = &hub::time_range;
 
 	
 	hm->register_new_heart_handler(   boost::bind(&hub::handle_new_heart    ,this,_1));
@@ -103,6 +119,9 @@ void hub::finish_registration(const std::string& heart){
 		ec.deletion_callback->set_inactive();
 
 	m_tracker.engines.insert(ec);
+	m_tracker.add_services(ec);
+	if(m_scheduler)
+		m_scheduler->add_engine(ec.id, ec.queue);
 
 	gpf_hub::registration msg;
 	msg.set_heartbeat(ec.heartbeat);
@@ -111,6 +130,11 @@ void hub::finish_registration(const std::string& heart){
 	msg.set_eid      (ec.id);
 	BOOST_FOREACH(const std::string& s, ec.services)
 		msg.add_services(s);
+	if(m_journal){
+		std::string data;
+		msg.SerializeToString(&data);
+		m_journal->append(gpf_hub::journal_entry::REGISTRATION, data.data(), data.size());
+	}
 	{
 		// notify others that new engine is registered
 		ZmqMessage::Outgoing<ZmqMessage::XRouting> out(*m_notifier,0);
@@ -155,7 +179,7 @@ void hub::register_engine(incoming_msg_t incoming){
 	// TODO: wrap errors in a message and send them back to client
 	gpf_hub::registration msg;
 
-	if(0!=m_header_marshal.deserialize(msg,*incoming->iter_at<std::string>(1)))
+	if(0!=m_header_marshal.deserialize(msg,(*incoming)[1]))
 	        return;
 
 	std::string queue = msg.queue();
@@ -224,6 +248,15 @@ void hub::_unregister_engine( int eid ){
 		return;
 	}
 	m_tracker.dead_engines.insert(it->queue);
+	m_tracker.remove_services(*it);
+	if(m_scheduler)
+		m_scheduler->remove_engine(eid);
+	if(m_journal){
+		journal::entry_t e;
+		e.set_type(gpf_hub::journal_entry::UNREGISTRATION);
+		e.set_eid(eid);
+		m_journal->append(e);
+	}
 	m_loop.add(deadline_timer(boost::posix_time::milliseconds(m_registration_timeout),
 				boost::bind(&hub::_handle_stranded_msgs, this, eid, it->queue)));
 
@@ -245,52 +278,268 @@ void hub::_handle_stranded_msgs(int eid, const std::string& uuid){
 		return;
 	}
 	
-	const engine_connector& ec = *it;
-	std::vector<std::string>& outstanding = ec.queues;
-	BOOST_FOREACH( std::string& msg_id, outstanding ){
-		m_ttracker.pending.erase(msg_id);
-		m_ttracker.all_completed.insert(msg_id);
-
-		auto& index = m_ttracker.tasks.get<task_id_t>();
-		auto it = index.find(msg_id);
-		if(it==index.end()) {
-			LOG(ERROR)<<"DB error handling stranded message "<<msg_id;
-			continue;
-		}
-		it->content     = "Engine died while running task `" + msg_id + "'";
-		it->completed   = boost::posix_time::microsec_clock::universal_time();
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	if(m_journal){
+		journal::entry_t e;
+		e.set_type(gpf_hub::journal_entry::ENGINE_DIED);
+		e.set_time_us(to_us(now));
+		e.set_eid(eid);
+		m_journal->append(e);
+	}
+	// the jobs journaled before go first, as in a replay
+	m_tasks->sync();
+	std::vector<msg_id_t> failed;
+	_fail_engine_tasks(eid, now, failed);
+	if(m_scheduler)
+		m_scheduler->fail(failed);
+	index.erase(it);
+}
+
+void hub::_fail_engine_tasks(int eid, const boost::posix_time::ptime& when, std::vector<msg_id_t>& failed){
+	for(unsigned int s=0;s<m_tasks->size();s++){
+		task_shards::locked tt(*m_tasks, s);
+		std::vector<msg_id_t> outstanding(tt->engine_pending(eid).begin(), tt->engine_pending(eid).end());
+		BOOST_FOREACH( const msg_id_t& msg_id, outstanding )
+			tt->engine_died(msg_id, when);
+		failed.insert(failed.end(), outstanding.begin(), outstanding.end());
 	}
 }
 
+// journal entry type for each monitor topic, -1: not journaled
+static const int journal_types[MONITOR_NUM_TOPICS] = {
+	gpf_hub::journal_entry::QUEUE_REQUEST,    // MONITOR_IN
+	gpf_hub::journal_entry::QUEUE_RESULT,     // MONITOR_OUT
+	gpf_hub::journal_entry::TASK_REQUEST,     // MONITOR_INTASK
+	gpf_hub::journal_entry::TASK_RESULT,      // MONITOR_OUTTASK
+	gpf_hub::journal_entry::TASK_DESTINATION, // MONITOR_TRACKTASK
+	-1,                                       // MONITOR_INCONTROL
+	-1                                        // MONITOR_OUTCONTROL
+};
+
+/// identity of the client that sent msg: the innermost frame of its routing envelope
+static bool routing_identity(const incoming_msg_t& msg, std::string& identity){
+	const ZmqMessage::MsgPtrVec& routing = msg->get_routing();
+	if(routing.empty())
+		return false;
+	zmq::message_t& m = *routing.back();
+	identity.assign(static_cast<const char*>(m.data()), m.size());
+	return true;
+}
+
+/// set the client_id of a request header from the routing envelope, unless the sender did
+template<class Header>
+static void set_client_id(Header& h, const incoming_msg_t& msg){
+	std::string identity;
+	if(!h.has_client_id() && msg && routing_identity(msg, identity))
+		h.set_client_id(identity);
+}
+
 void hub::dispatch_monitor_traffic(zmq::socket_t& s){
 	// all ME and Task queue messages come through here, as well as
-	// IOPub traffic.
-	incoming_msg_t incoming(new ZmqMessage::Incoming<ZmqMessage::XRouting>(s));
-	incoming->receive_all();
-	std::string type = ZmqMessage::get<std::string>((*incoming)[0]);
-	DLOG(INFO) << "Monitor traffic : "<< ZmqMessage::get<std::string>((*incoming)[0]);
-	
-	std::map<std::string,monitor_handler_t>::iterator handler = m_monitor_handlers.find(type);
-	if(handler == m_monitor_handlers.end()){
-		LOG(ERROR) << "Invalid monitor topic: "<<type;
+	// IOPub traffic. Up to m_monitor_batch messages are drained per
+	// wakeup, they are handled grouped by topic afterwards.
+	m_now = boost::posix_time::microsec_clock::universal_time();
+	unsigned int n = 0;
+	do{
+		incoming_msg_t incoming = m_incoming_pool.make(s);
+		incoming->receive_all();
+		n++;
+		monitor_topic type = monitor_topic_id((*incoming)[0]);
+		DLOG(INFO) << "Monitor traffic : "<< topic_name(type);
+
+		if(type == MONITOR_UNKNOWN){
+			LOG(ERROR) << "Invalid monitor topic: "<<ZmqMessage::get<std::string>((*incoming)[0]);
+			continue;
+		}
+		m_monitor_queue[type].push_back(incoming);
+	}while(n < m_monitor_batch && readable(s));
+
+	// requests first, so that results whose request arrived in the
+	// same batch find their task.
+	static const monitor_topic order[] = {
+		MONITOR_IN, MONITOR_INTASK, MONITOR_TRACKTASK,
+		MONITOR_OUT, MONITOR_OUTTASK,
+		MONITOR_INCONTROL, MONITOR_OUTCONTROL };
+	BOOST_FOREACH(monitor_topic type, order){
+		std::vector<incoming_msg_t>& queue = m_monitor_queue[type];
+		BOOST_FOREACH(incoming_msg_t& incoming, queue){
+			if(m_journal && journal_types[type] >= 0 && incoming->size() > 1){
+				zmq::message_t& header = (*incoming)[1];
+				journal::entry_t e;
+				e.set_type((journal::entry_t::Type)journal_types[type]);
+				e.set_time_us(to_us(m_now));
+				e.set_data(header.data(), header.size());
+				std::string identity;
+				if((type == MONITOR_IN || type == MONITOR_INTASK) && routing_identity(incoming, identity))
+					e.set_client(identity);
+				m_journal->append(e);
+			}
+			monitor_job job(type, incoming, ++m_arrivals);
+			m_shard_jobs[m_tasks->shard_of(job)].push_back(job);
+		}
+		queue.clear();
+	}
+	for(unsigned int i=0;i<m_shard_jobs.size();i++)
+		m_tasks->post(i, m_shard_jobs[i]);
+	_update_monitor_stats(n);
+}
+
+void hub::_apply_monitor_job(task_tracker& tt, const monitor_job& job){
+	tt.set_arrival(job.arrival);
+	(this->*m_monitor_handlers[job.type])(tt, job.msg);
+}
+
+void hub::_update_monitor_stats(unsigned int n){
+	monitor_stats& st = m_monitor_stats;
+	st.wakeups  ++;
+	st.messages += n;
+	st.last_batch = n;
+	st.max_batch  = std::max(st.max_batch, n);
+
+	st.window_wakeups  ++;
+	st.window_messages += n;
+	if(st.window_start.is_not_a_date_time())
+		st.window_start = m_now;
+	boost::posix_time::time_duration dt = m_now - st.window_start;
+	if(dt >= boost::posix_time::seconds(1)){
+		double secs = dt.total_microseconds() / 1e6;
+		st.wakeups_per_sec  = st.window_wakeups  / secs;
+		st.messages_per_sec = st.window_messages / secs;
+		st.window_start    = m_now;
+		st.window_wakeups  = 0;
+		st.window_messages = 0;
+	}
+}
+
+void hub::set_scheduler(boost::shared_ptr<task_scheduler> s){
+	m_scheduler = s;
+	if(!s)
+		return;
+	s->set_engine_tracker(&m_tracker);
+	// engines registered (or recovered) so far
+	BOOST_FOREACH(const engine_connector& ec, m_tracker.engines)
+		s->add_engine(ec.id, ec.queue);
+	if(s->chooser().scheme() == engine_chooser::WEIGHTED)
+		m_loop.add(deadline_timer(boost::posix_time::seconds(1), boost::bind(&hub::_update_weights, this, _1)));
+}
+
+void hub::_update_weights(zmq_reactor::reactor* r){
+	if(!m_scheduler || m_scheduler->chooser().scheme() != engine_chooser::WEIGHTED)
+		return;
+	std::vector<std::pair<int, double> > weights;
+	double known = 0.;
+	unsigned int n_known = 0;
+	BOOST_FOREACH(const engine_connector& ec, m_tracker.engines){
+		engine_load load;
+		for(unsigned int s=0;s<m_tasks->size();s++){
+			task_shards::locked tt(*m_tasks, s);
+			load.merge(tt->load(ec.id));
+		}
+		double w = load.service_secs > 0. ? 1./load.service_secs : 0.;
+		weights.push_back(std::make_pair(ec.id, w));
+		if(w > 0.){
+			known += w;
+			n_known ++;
+		}
+	}
+	// engines without results yet count as average ones
+	double average = n_known ? known/n_known : 1.;
+	for(std::size_t i=0;i<weights.size();i++)
+		m_scheduler->chooser().set_weight(weights[i].first, weights[i].second > 0. ? weights[i].second : average);
+	r->add(deadline_timer(boost::posix_time::seconds(1), boost::bind(&hub::_update_weights, this, _1)));
+}
+
+compression_stats hub::get_compression_stats(){
+	compression_stats st;
+	for(unsigned int s=0;s<m_tasks->size();s++){
+		task_shards::locked tt(*m_tasks, s);
+		st += tt->compression();
+	}
+	return st;
+}
+
+void hub::set_monitor_batch(unsigned int n){
+	m_monitor_batch = std::max(1u, n);
+}
+
+void hub::set_task_shards(unsigned int n){
+	m_tasks.reset(); // joins the old workers
+	m_tasks.reset(new task_shards(n, boost::bind(&hub::_apply_monitor_job, this, _1, _2)));
+	m_shard_jobs.assign(m_tasks->size(), std::vector<monitor_job>());
+	set_retention(m_retention);
+	if(m_db)
+		set_task_db(m_db);
+	for(unsigned int s=0;s<m_tasks->size();s++){
+		task_shards::locked tt(*m_tasks, s);
+		tt->set_clients(&m_clients);
+	}
+}
+
+void hub::set_task_db(boost::shared_ptr<task_db> db){
+	m_db = db;
+	for(unsigned int s=0;s<m_tasks->size();s++){
+		task_shards::locked tt(*m_tasks, s);
+		tt->set_db(db.get());
+	}
+	if(m_db && !m_db_timer){
+		m_db_timer = true;
+		m_loop.add(deadline_timer(boost::posix_time::seconds(1), boost::bind(&hub::_flush_task_db, this, _1)));
+	}
+}
+
+void hub::_flush_task_db(zmq_reactor::reactor* r){
+	if(!m_db){
+		m_db_timer = false;
 		return;
 	}
-	(this->*(handler->second))(incoming);
+	r->add(deadline_timer(boost::posix_time::seconds(1), boost::bind(&hub::_flush_task_db, this, _1)));
+	m_db->flush();
+}
+
+void hub::set_retention(const retention_policy& p){
+	m_retention = p;
+	for(unsigned int s=0;s<m_tasks->size();s++){
+		task_shards::locked tt(*m_tasks, s);
+		tt->set_retention(p);
+	}
+	if(!p.unlimited() && !m_retention_timer){
+		m_retention_timer = true;
+		m_loop.add(deadline_timer(p.interval, boost::bind(&hub::_enforce_retention, this, _1)));
+	}
+}
+
+void hub::_enforce_retention(zmq_reactor::reactor* r){
+	if(m_retention.unlimited()){
+		m_retention_timer = false;
+		return;
+	}
+	r->add(deadline_timer(m_retention.interval, boost::bind(&hub::_enforce_retention, this, _1)));
+
+	// one slice per shard, the workers only wait for a short while
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	std::size_t evicted = 0, retained = 0, bytes = 0;
+	for(unsigned int s=0;s<m_tasks->size();s++){
+		task_shards::locked tt(*m_tasks, s);
+		evicted  += tt->evict(now);
+		retained += tt->retained();
+		bytes    += tt->retained_bytes();
+	}
+	if(evicted)
+		VLOG(1)<<"Retention: evicted "<<evicted<<" tasks, "<<retained<<" completed tasks ("<<bytes<<" bytes) left";
 }
 
 void hub::dispatch_query(zmq::socket_t&s){
 	// Route registration requests and queries from clients.
-	incoming_msg_t incoming(new ZmqMessage::Incoming<ZmqMessage::XRouting>(s));
+	incoming_msg_t incoming = m_incoming_pool.make(s);
 	incoming->receive_all();
 	
-	std::string type = ZmqMessage::get<std::string>((*incoming)[0]);
-	std::map<std::string,query_handler_t>::iterator handler = m_query_handlers.find(type);
-	LOG(INFO) << "Incoming query: `"<<type<<"'";
-	if(handler == m_query_handlers.end()){
-		LOG(ERROR) << "Bad Message Type: "<<type;
+	query_topic type = query_topic_id((*incoming)[0]);
+	if(type == QUERY_UNKNOWN){
+		LOG(ERROR) << "Bad Message Type: "<<ZmqMessage::get<std::string>((*incoming)[0]);
 		return;
 	}
-	(this->*(handler->second))(incoming);
+	LOG(INFO) << "Incoming query: `"<<topic_name(type)<<"'";
+	(this->*m_query_handlers[type])(incoming);
 }
 
 const engine_connector& 
@@ -316,137 +565,227 @@ hub::get_num_engines(){
 
 hub::~hub()
 {
+	m_tasks.reset(); // the workers may still write to m_db
 }
 
-void hub::nop(incoming_msg_t){
+void hub::set_journal(boost::shared_ptr<journal> j, const boost::posix_time::time_duration& snapshot_interval){
+	m_journal.reset();
+	if(!j)
+		return;
+	boost::posix_time::ptime t0 = boost::posix_time::microsec_clock::universal_time();
+	_set_replaying(true);
+	j->recover(boost::bind(&hub::_restore_snapshot, this, _1), boost::bind(&hub::_replay, this, _1));
+	m_tasks->sync();
+	_set_replaying(false);
+	LOG(INFO)<<"Recovered "<<m_tracker.engines.size()<<" engines in "
+		<<(boost::posix_time::microsec_clock::universal_time()-t0);
 
+	m_journal           = j;
+	m_snapshot_interval = snapshot_interval;
+	m_loop.add(deadline_timer(m_snapshot_interval, boost::bind(&hub::_snapshot, this, _1)));
+	if(!m_tracker.engines.empty())
+		m_loop.add(deadline_timer(boost::posix_time::milliseconds(m_registration_timeout),
+					boost::bind(&hub::_check_recovered_engines, this)));
 }
-void hub::save_queue_request(incoming_msg_t incoming){
-
-	gpf_hub::in         inmsg;
-	if(0!=m_header_marshal.deserialize(inmsg,*incoming->iter_at<std::string>(1)))
-	        return;
 
-	task t;
-	t.id           = inmsg.msg_id();
-	t.incoming_msg = incoming;
-	t.engine_uuid  = inmsg.eid();
-	t.submitted    = boost::posix_time::from_iso_string(inmsg.submitted());
-	t.queue        = "mux";
+void hub::_set_replaying(bool r){
+	// replayed results carry no payload, they must not replace the stored ones
+	for(unsigned int s=0;s<m_tasks->size();s++){
+		task_shards::locked tt(*m_tasks, s);
+		tt->set_replaying(r);
+	}
+}
 
-	// TODO: it's possible that iopub arrived first (see ipython code...)
-	m_ttracker.pending.insert(t.id);
-	m_ttracker.tasks.insert(t);
+void hub::_restore_engine(const gpf_hub::registration& msg){
+	gpf::engine_connector ec;
+	ec.id           = msg.eid();
+	ec.queue        = msg.queue();
+	ec.heartbeat    = msg.heartbeat();
+	ec.registration = msg.reg();
+	std::copy(msg.services().begin(),msg.services().end(),std::back_inserter(ec.services));
+	m_tracker.engines.insert(ec);
+	m_tracker.add_services(ec);
+	m_tracker.reserve_id(ec.id);
 }
-void hub::save_queue_result (incoming_msg_t incoming){
-	gpf_hub::out        inmsg;
-	if(0!=m_header_marshal.deserialize(inmsg,*incoming->iter_at<std::string>(1)))
-	        return;
 
-	auto& index = m_ttracker.tasks.get<task_id_t>();
-	auto it = index.find(inmsg.msg_id());
-	if(it == index.end()){
-		LOG(ERROR)<<"save_queue_result: Got result for non-existent task";
+void hub::_erase_engine(int eid){
+	auto& index = m_tracker.engines.get<engine_id_t>();
+	auto it = index.find(eid);
+	if(it == index.end())
 		return;
-	}
-	std::string msg_id = inmsg.msg_id();
-	if(m_ttracker.pending.find(msg_id) != m_ttracker.pending.end()){
-		m_ttracker.pending.erase(msg_id);
-		m_ttracker.all_completed.insert(msg_id);
-	}else if(m_ttracker.all_completed.find(msg_id) == m_ttracker.all_completed.end()){
-		// it could be a result from a dead engine that died before delivering the result
-		LOG(ERROR)<<"queue:: unknown message ID "<<msg_id<<" finished.";
-	}
-	// update record anyway, because the unregistration could have been premature
-	it->completed    = boost::posix_time::from_iso_string(inmsg.completed());
-	it->started      = boost::posix_time::from_iso_string(inmsg.started());
-	it->outgoing_msg = incoming;
+	m_tracker.dead_engines.insert(it->queue);
+	m_tracker.remove_services(*it);
+	index.erase(it);
 }
-void hub::save_task_request(incoming_msg_t incoming){
-	// save the submission of a task
-	
-	gpf_hub::intask        inmsg;
-	if(0!=m_header_marshal.deserialize(inmsg,*incoming->iter_at<std::string>(1)))
-	        return;
-
-	bool has_eid = inmsg.has_eid();
 
-	task t;
-	t.id           = inmsg.msg_id();
-	t.incoming_msg = incoming;
-	t.engine_uuid  = has_eid ? inmsg.eid() : -1;
-	t.submitted    = boost::posix_time::from_iso_string(inmsg.submitted());
-	t.queue        = "task";
+void hub::_restore_snapshot(const journal::snapshot_t& s){
+	// called for every chunk, only the first has the engines
+	if(s.has_next_eid())
+		m_tracker.reserve_id(s.next_eid()-1);
+	BOOST_FOREACH(const gpf_hub::registration& r, s.engines())
+		_restore_engine(r);
+	BOOST_FOREACH(const task_db::record_t& r, s.tasks()){
+		msg_id_t id;
+		if(!parse_msg_id(r.msg_id(), id))
+			continue;
+		task_shards::locked tt(*m_tasks, m_tasks->shard_of(id));
+		tt->restore(r);
+	}
+}
 
-	// TODO: it's possible that iopub arrived first (see ipython code...)
-	if(has_eid)
-		m_ttracker.unassigned.insert(t.id);
-	m_ttracker.pending.insert(t.id);
-	m_ttracker.tasks.insert(t);
-	
+template<class Header>
+static void set_client_id(Header&, const journal::entry_t&){}
+static void set_client_id(gpf_hub::in& h, const journal::entry_t& e){
+	if(e.has_client() && !h.has_client_id())
+		h.set_client_id(e.client());
+}
+static void set_client_id(gpf_hub::intask& h, const journal::entry_t& e){
+	if(e.has_client() && !h.has_client_id())
+		h.set_client_id(e.client());
 }
-void hub::save_task_result(incoming_msg_t incoming){
-	gpf_hub::outtask    inmsg;
-	if(0!=m_header_marshal.deserialize(inmsg,*incoming->iter_at<std::string>(1)))
-	        return;
 
-	auto& index = m_ttracker.tasks.get<task_id_t>();
-	auto it = index.find(inmsg.msg_id());
-	if(it == index.end()){
-		LOG(ERROR)<<"save_queue_result: Got result for non-existent task";
+/// apply a journaled task transition to the shard owning its msg_id
+template<class Header, class Apply>
+static void replay_task(task_shards& tasks, const journal::entry_t& e, Apply apply){
+	Header h;
+	msg_id_t id;
+	if(!h.ParseFromString(e.data()) || !parse_msg_id(h.msg_id(), id)){
+		LOG(ERROR)<<"Replay: bad task entry";
 		return;
 	}
-	std::string msg_id = inmsg.msg_id();
-	{
-	  auto it = m_ttracker.unassigned.find(msg_id);
-	  if(m_ttracker.unassigned.end() != it)
-		  m_ttracker.unassigned.erase(it);
-	}
-
-	if(m_ttracker.pending.find(msg_id) != m_ttracker.pending.end()){
-		m_ttracker.pending.erase(msg_id);
-		m_ttracker.all_completed.insert(msg_id);
-	}else if(m_ttracker.all_completed.find(msg_id) == m_ttracker.all_completed.end()){
-		// it could be a result from a dead engine that died before delivering the result
-		LOG(ERROR)<<"queue:: unknown message ID "<<msg_id<<" finished.";
-	}
-	// update record anyway, because the unregistration could have been premature
-	it->completed    = boost::posix_time::from_iso_string(inmsg.completed());
-	it->started      = boost::posix_time::from_iso_string(inmsg.started());
-	it->outgoing_msg = incoming;
-	if(inmsg.has_eid()){
-		if(inmsg.eid() != it->engine_uuid){
-			task t = *it;
-			t.engine_uuid = inmsg.eid();
-			index.replace(it,t);
+	set_client_id(h, e);
+	task_shards::locked tt(tasks, tasks.shard_of(id));
+	apply(*tt, h);
+}
+
+void hub::_replay(const journal::entry_t& e){
+	using gpf_hub::journal_entry;
+	incoming_msg_t none;
+	switch(e.type()){
+		case journal_entry::REGISTRATION:
+			{
+				gpf_hub::registration r;
+				if(r.ParseFromString(e.data()))
+					_restore_engine(r);
+			}
+			break;
+		case journal_entry::UNREGISTRATION:
+			_erase_engine(e.eid());
+			break;
+		case journal_entry::QUEUE_REQUEST:
+			replay_task<gpf_hub::in>     (*m_tasks, e, boost::bind(&task_tracker::queue_request, _1, _2, none));
+			break;
+		case journal_entry::QUEUE_RESULT:
+			replay_task<gpf_hub::out>    (*m_tasks, e, boost::bind(&task_tracker::queue_result,  _1, _2, none));
+			break;
+		case journal_entry::TASK_REQUEST:
+			replay_task<gpf_hub::intask> (*m_tasks, e, boost::bind(&task_tracker::task_request,  _1, _2, none));
+			break;
+		case journal_entry::TASK_RESULT:
+			replay_task<gpf_hub::outtask>(*m_tasks, e, boost::bind(&task_tracker::task_result,   _1, _2, none));
+			break;
+		case journal_entry::TASK_DESTINATION:
+			replay_task<gpf_hub::tracktask>(*m_tasks, e, boost::bind(&task_tracker::task_destination, _1, _2));
+			break;
+		case journal_entry::ENGINE_DIED:
+			{
+				std::vector<msg_id_t> failed;
+				_fail_engine_tasks(e.eid(), from_us(e.time_us()), failed);
+			}
+			break;
+	}
+}
+
+/// write the tasks of one shard to a snapshot, on the shard's worker
+static void snapshot_shard(task_tracker& tt, journal::snapshot_writer_ptr w){
+	journal::snapshot_t chunk;
+	BOOST_FOREACH(const task& t, tt.tasks){
+		tt.metadata(t, *chunk.add_tasks());
+		if(chunk.tasks_size() == journal::snapshot_chunk){
+			w->write(chunk);
+			chunk.Clear();
 		}
 	}
+	if(chunk.tasks_size())
+		w->write(chunk);
+	w->done();
 }
-void hub::save_task_destination(incoming_msg_t incoming){
-	gpf_hub::tracktask    inmsg;
-	if(0!=m_header_marshal.deserialize(inmsg,*incoming->iter_at<std::string>(1)))
-	        return;
 
-	auto& index = m_ttracker.tasks.get<task_id_t>();
-	auto it = index.find(inmsg.msg_id());
-	if(it == index.end()){
-		LOG(ERROR)<<"save_task_destination: Got msg for non-existent task";
+void hub::_snapshot(zmq_reactor::reactor* r){
+	if(!m_journal)
 		return;
+	r->add(deadline_timer(m_snapshot_interval, boost::bind(&hub::_snapshot, this, _1)));
+
+	// the reactor thread is the only one journaling, and it posts the
+	// jobs of an entry right after appending it. The shards write their
+	// tasks once they applied the jobs posted before, so the snapshot
+	// matches the journal up to the new segment. Payloads are in the
+	// task db, snapshots only hold the metadata.
+	journal::snapshot_t head;
+	head.set_next_eid(m_tracker.peek_next_id());
+	BOOST_FOREACH(const engine_connector& ec, m_tracker.engines){
+		gpf_hub::registration& msg = *head.add_engines();
+		msg.set_heartbeat(ec.heartbeat);
+		msg.set_queue    (ec.queue);
+		msg.set_reg      (ec.registration);
+		msg.set_eid      (ec.id);
+		BOOST_FOREACH(const std::string& s, ec.services)
+			msg.add_services(s);
 	}
-	std::string msg_id = inmsg.msg_id();
-	{
-	  auto it = m_ttracker.unassigned.find(msg_id);
-	  if(m_ttracker.unassigned.end() != it)
-		  m_ttracker.unassigned.erase(it);
-	}
+	journal::snapshot_writer_ptr w = m_journal->begin_snapshot(head, m_tasks->size());
+	if(!w)
+		return;
+	for(unsigned int s=0;s<m_tasks->size();s++)
+		m_tasks->call(s, boost::bind(snapshot_shard, _1, w));
+}
 
-	if(inmsg.eid() != it->engine_uuid){
-		task t = *it;
-		t.engine_uuid = inmsg.eid();
-		index.replace(it,t);
+void hub::_check_recovered_engines(){
+	// engines from the journal whose hearts did not show up
+	std::vector<int> dead;
+	BOOST_FOREACH(const engine_connector& ec, m_tracker.engines)
+		if(!m_heartmonitor->alive(ec.heartbeat))
+			dead.push_back(ec.id);
+	BOOST_FOREACH(int eid, dead){
+		LOG(INFO)<<"Recovered engine "<<eid<<" did not beat, unregistering";
+		_unregister_engine(eid);
 	}
-	LOG(INFO)<<"Task "<<msg_id<<" arrived on "<<inmsg.eid();
+}
 
+void hub::nop(task_tracker&, const incoming_msg_t&){
+
+}
+void hub::save_queue_request(task_tracker& tt, const incoming_msg_t& incoming){
+	gpf_hub::in         inmsg;
+	if(0!=m_header_marshal.deserialize(inmsg,(*incoming)[1]))
+	        return;
+	set_client_id(inmsg, incoming);
+	tt.queue_request(inmsg, incoming);
+}
+void hub::save_queue_result (task_tracker& tt, const incoming_msg_t& incoming){
+	gpf_hub::out        inmsg;
+	if(0!=m_header_marshal.deserialize(inmsg,(*incoming)[1]))
+	        return;
+	tt.queue_result(inmsg, incoming);
+}
+void hub::save_task_request(task_tracker& tt, const incoming_msg_t& incoming){
+	// save the submission of a task
+	gpf_hub::intask        inmsg;
+	if(0!=m_header_marshal.deserialize(inmsg,(*incoming)[1]))
+	        return;
+	set_client_id(inmsg, incoming);
+	tt.task_request(inmsg, incoming);
+}
+void hub::save_task_result(task_tracker& tt, const incoming_msg_t& incoming){
+	gpf_hub::outtask    inmsg;
+	if(0!=m_header_marshal.deserialize(inmsg,(*incoming)[1]))
+	        return;
+	tt.task_result(inmsg, incoming);
+}
+void hub::save_task_destination(task_tracker& tt, const incoming_msg_t& incoming){
+	gpf_hub::tracktask    inmsg;
+	if(0!=m_header_marshal.deserialize(inmsg,(*incoming)[1]))
+	        return;
+	tt.task_destination(inmsg);
 }
 
 void hub::shutdown_request(incoming_msg_t incoming){
@@ -470,19 +809,31 @@ void hub::_shutdown(){
 void hub::check_load(incoming_msg_t incoming){
 	gpf_hub::load_request inmsg;
 	gpf_hub::load_reply   outmsg;
-	if(0!=m_header_marshal.deserialize(inmsg,*incoming->iter_at<std::string>(1)))
+	if(0!=m_header_marshal.deserialize(inmsg,(*incoming)[1]))
 	        return;
+	// counted by the task_trackers as the monitor traffic comes in
 	auto& index = m_tracker.engines.get<engine_id_t>();
 	bool ok = true;
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
 	for(int i=0;i<inmsg.eid_size();i++){
-		auto it = index.find(inmsg.eid(i));
-		if(it==index.end()) {
+		int eid = inmsg.eid(i);
+		if(index.find(eid)==index.end()) {
 			ok = false;
 			break;
 		}
-		outmsg.add_eid(inmsg.eid(i));
-		outmsg.add_queuelen(it->queues.size());
-		outmsg.add_taskslen(it->tasks.size());
+		engine_task_counts counts;
+		engine_load        load;
+		for(unsigned int s=0;s<m_tasks->size();s++){
+			task_shards::locked tt(*m_tasks, s);
+			counts += tt->engine_counts(eid);
+			load.merge(tt->load(eid));
+		}
+		outmsg.add_eid(eid);
+		outmsg.add_queuelen(counts.queue);
+		outmsg.add_taskslen(counts.tasks);
+		outmsg.add_throughput(load.rate_at(now));
+		outmsg.add_service_time(load.service_secs);
+		outmsg.add_completed(counts.completed);
 	}
 	if(ok){
 		ZmqMessage::Outgoing<ZmqMessage::XRouting> out(*m_query,*incoming,0);
@@ -499,39 +850,48 @@ void hub::queue_status(incoming_msg_t incoming){
 	// keys: queue (pending MUX jobs)
 	//       tasks (pending Task jobs)
 	//       completed (finished jobs from both queues)
+	// The lengths are counted by the task_trackers, so only verbose
+	// requests walk tasks.
 	gpf_hub::queue_status_request inmsg;
 	gpf_hub::queue_status_reply   outmsg;
-	if(0!=m_header_marshal.deserialize(inmsg,*incoming->iter_at<std::string>(1)))
+	if(0!=m_header_marshal.deserialize(inmsg,(*incoming)[1]))
 	        return;
 	auto& index = m_tracker.engines.get<engine_id_t>();
 	bool  ok = true;
 	bool  verbose = inmsg.verbose();
 	for(int i=0;i<inmsg.eids_size();i++){
-		auto it = index.find(inmsg.eids(i));
-		if(it==index.end()) {
+		int eid = inmsg.eids(i);
+		if(index.find(eid)==index.end()) {
 			ok = false;
 			break;
 		}
 		gpf_hub::queue_status_reply::status& smsg = *outmsg.add_engine();
 
-		auto& tindex = m_ttracker.tasks.get<engine_id_t>();
-
-		int task_cnt=0, compl_cnt=0;
-		BOOST_FOREACH(const task& t, tindex.equal_range(inmsg.eids(i))){
-			if(verbose){
-				if(t.completed.is_not_a_date_time()){
-					smsg.add_tasks(t.id);
-					task_cnt++;
-				}
-				else{
-					smsg.add_completed(t.id);
-					compl_cnt++;
-				}
+		engine_task_counts counts;
+		for(unsigned int s=0;s<m_tasks->size();s++){
+			task_shards::locked tt(*m_tasks, s);
+			counts += tt->engine_counts(eid);
+			if(!verbose)
+				continue;
+			auto& id_index = tt->tasks.get<task_id_t>();
+			BOOST_FOREACH(const msg_id_t& id, tt->engine_pending(eid)){
+				auto it = id_index.find(id);
+				if(strcmp(it->queue, "mux") == 0)
+					smsg.add_queues(to_string(id));
+				else
+					smsg.add_tasks(to_string(id));
+			}
+			if(inmsg.completed()){
+				BOOST_FOREACH(const task& t, tt->tasks.get<engine_id_t>().equal_range(eid))
+					if(t.state == TASK_COMPLETED)
+						smsg.add_completed(to_string(t.id));
 			}
 		}
 		
-		smsg.set_eid(inmsg.eids(i));
-		smsg.set_taskslen(task_cnt);
+		smsg.set_eid(eid);
+		smsg.set_queuelen(counts.queue);
+		smsg.set_taskslen(counts.tasks);
+		smsg.set_completed_len(counts.completed);
 	}
 	if(ok){
 		ZmqMessage::Outgoing<ZmqMessage::XRouting> out(*m_query,*incoming,0);
@@ -543,68 +903,442 @@ void hub::queue_status(incoming_msg_t incoming){
 }
 void hub::purge_results(incoming_msg_t incoming){
 	gpf_hub::purge_results_request inmsg;
-	gpf_hub::purge_results_reply   outmsg;
-	if(0!=m_header_marshal.deserialize(inmsg,*incoming->iter_at<std::string>(1)))
+	if(0!=m_header_marshal.deserialize(inmsg,(*incoming)[1]))
 	        return;
-	if(inmsg.all()){
-		m_ttracker.tasks.clear();
-	}else{
-		auto& id_index = m_ttracker.tasks.get<task_id_t>();
-		// purge messages from database
-		for(int i=0;i<inmsg.msg_ids_size();i++){
-			std::string id = inmsg.msg_ids(i);
-			if(m_ttracker.pending.find(id) != m_ttracker.pending.end()){
-				ZmqMessage::Outgoing<ZmqMessage::XRouting> out(*m_query,*incoming,0);
-				out << "purge_results_reply"<< format("Error: Got pending msg_id %s")%id;
-				return;
+	purge_job job;
+	job.request = incoming;
+	job.all     = inmsg.all();
+	job.cutoff  = m_arrivals + 1;
+	job.from    = time_key(time_key_min, time_key_min);
+	job.ids.resize(inmsg.msg_ids_size());
+	for(int i=0;i<inmsg.msg_ids_size();i++){
+		if(!parse_msg_id(inmsg.msg_ids(i), job.ids[i])){
+			ZmqMessage::Outgoing<ZmqMessage::XRouting> out(*m_query,*incoming,0);
+			out << "purge_results_reply"<< format("Error: Invalid msg_id %s")%inmsg.msg_ids(i);
+			return;
+		}
+	}
+	job.eids.assign(inmsg.eids().begin(), inmsg.eids().end());
+	job.next   = 0;
+	job.shard  = 0;
+	job.purged = 0;
+	job.failed = false;
+
+	m_purges.push_back(job);
+	if(m_purges.size() == 1)
+		_purge_slice(&m_loop);
+}
+
+// tasks removed per purge slice
+static const std::size_t purge_slice_tasks = 10000;
+
+bool hub::_purge_tasks(purge_job& job, std::size_t budget){
+	// returns true when job is done or failed
+	if(job.all){
+		if(job.shard == 0 && job.from.time == time_key_min)
+			m_tasks->sync(); // the shards hold every task that arrived before
+		while(budget && job.shard < m_tasks->size()){
+			task_shards::locked tt(*m_tasks, job.shard);
+			std::size_t n = tt->erase_arrived_before(job.cutoff, job.from, budget, job.purged);
+			if(n < budget){
+				job.shard ++;
+				job.from = time_key(time_key_min, time_key_min);
 			}
-			auto it = id_index.find(inmsg.msg_ids(i));
-			if(it!=id_index.end())
-				id_index.erase(it);
+			budget -= n;
 		}
+		return job.shard == m_tasks->size() && _purge_db(job, budget);
+	}
 
-		// purge messages from queue of specific engines
-		auto& tindex = m_tracker.engines.get<engine_id_t>();
-		for(int i=0;i<inmsg.eids_size();i++){
-			auto  p = tindex.equal_range(inmsg.eids(i));
-			tindex.erase(p.first, p.second);
+	// purge messages from database
+	for(; budget && job.next < job.ids.size(); job.next++, budget--){
+		const msg_id_t& id = job.ids[job.next];
+		task_shards::locked tt(*m_tasks, m_tasks->shard_of(id));
+		if(tt->is_pending(id)){
+			ZmqMessage::Outgoing<ZmqMessage::XRouting> out(*m_query,*job.request,0);
+			out << "purge_results_reply"<< format("Error: Got pending msg_id %s")%to_string(id);
+			job.failed = true;
+			return true;
 		}
+		if(tt->erase(id))
+			job.purged ++;
+		if(m_db)
+			m_db->erase(id);
 	}
-	ZmqMessage::Outgoing<ZmqMessage::XRouting> out(*m_query,*incoming,0);
-	out << "load_reply"<<m_header_marshal(outmsg);
+	if(job.next < job.ids.size())
+		return false;
+
+	// purge completed tasks of specific engines
+	while(budget && job.shard < m_tasks->size()){
+		task_shards::locked tt(*m_tasks, job.shard);
+		std::size_t n = 0;
+		BOOST_FOREACH(int eid, job.eids)
+			n += tt->erase_completed(eid, budget - n);
+		if(n < budget)
+			job.shard ++;
+		job.purged += n;
+		budget     -= n;
+	}
+	return job.shard == m_tasks->size() && (job.eids.empty() || _purge_db(job, budget));
+}
+
+bool hub::_purge_db(purge_job& job, std::size_t budget){
+	// what is left in the task db: tasks evicted from memory. Returns
+	// true when the db was scanned to its end.
+	if(!m_db)
+		return true;
+	if(!budget)
+		return false;
+	static const msg_id_t last(~0ULL, ~0ULL);
+	std::vector<msg_id_t> purge;
+	std::size_t n = 0;
+	m_db->scan(job.db_next, last, [&](const msg_id_t& id, const task_db::record_t& r)->bool{
+		job.db_next = id;
+		if(job.all ? r.arrival() < job.cutoff
+		           : std::find(job.eids.begin(), job.eids.end(), r.eid()) != job.eids.end())
+			purge.push_back(id);
+		return ++n < budget;
+	});
+	BOOST_FOREACH(const msg_id_t& id, purge)
+		m_db->erase(id);
+	job.purged += purge.size();
+	if(n < budget || job.db_next == last)
+		return true;
+	// continue after the last record looked at
+	if(++job.db_next.lo == 0)
+		job.db_next.hi ++;
+	return false;
 }
+
+void hub::_purge_slice(zmq_reactor::reactor* r){
+	// one slice of the oldest purge, the reactor serves heartbeats and
+	// queries before the next one
+	purge_job& job = m_purges.front();
+	if(_purge_tasks(job, purge_slice_tasks)){
+		if(!job.failed){
+			gpf_hub::purge_results_reply outmsg;
+			outmsg.set_purged(job.purged);
+			ZmqMessage::Outgoing<ZmqMessage::XRouting> out(*m_query,*job.request,0);
+			out << "purge_results_reply"<<m_header_marshal(outmsg);
+		}
+		LOG(INFO)<<"purge_results: purged "<<job.purged<<" tasks";
+		m_purges.pop_front();
+	}
+	if(!m_purges.empty())
+		r->add(deadline_timer(boost::posix_time::milliseconds(0), boost::bind(&hub::_purge_slice, this, _1)));
+}
+
 void hub::resubmit_task(incoming_msg_t){}
+
+static gpf_hub::get_results_reply::Status wire_status(task_state s){
+	switch(s){
+		case TASK_UNASSIGNED: return gpf_hub::get_results_reply::UNASSIGNED;
+		case TASK_PENDING:    return gpf_hub::get_results_reply::PENDING;
+		default:              return gpf_hub::get_results_reply::COMPLETED;
+	}
+}
+
+// pages of a get_results stream sent per reactor turn
+static const unsigned int max_pages_per_turn = 8;
+
+bool hub::_add_result(const msg_id_t& id, bool status_only, gpf_hub::get_results_reply& outmsg, result_frames& frames){
+	// the payload is not copied: frames of the stored reply are shared
+	// with zmq, buffers only held as strings (from the task db or
+	// inflated) are handed over to it.
+	gpf_hub::get_results_reply::result& res = *outmsg.add_results();
+	res.set_msg_id(to_string(id));
+	incoming_msg_t reply;
+	std::string    content;
+	task_db::record_t r;
+	task_payload   unpacked; // of compressed tasks
+	{
+		task_shards::locked tt(*m_tasks, m_tasks->shard_of(id));
+		auto& id_index = tt->tasks.get<task_id_t>();
+		auto it = id_index.find(id);
+		if(it!=id_index.end()){
+			tt->touch(id);
+			res.set_status(wire_status(it->state));
+			if(!status_only && !it->packed.empty()){
+				tt->unpack(*it, unpacked);
+				content.swap(unpacked.result_content);
+			}else if(!status_only){
+				reply = it->outgoing_msg;
+				if(!reply)
+					content = it->result_content;
+				// only the metadata is held (restored from a snapshot or evicted)
+				if(!reply && content.empty() && it->state == TASK_COMPLETED && m_db)
+					m_db->lookup(id, r);
+			}
+		}else if(m_db && m_db->lookup(id, r)){
+			// evicted from memory, but still in the task db
+			res.set_status(gpf_hub::get_results_reply::COMPLETED);
+		}else{
+			res.set_status(gpf_hub::get_results_reply::UNKNOWN);
+			outmsg.add_frames(0);
+			return false;
+		}
+	}
+	if(status_only){
+		outmsg.add_frames(0);
+	}else if(reply){
+		// frame 0 is the topic, 1 the header
+		for(std::size_t i=2;i<reply->size();i++){
+			frames.push_back(boost::make_shared<zmq::message_t>());
+			share_frame(reply, i, *frames.back());
+		}
+		outmsg.add_frames(reply->size()-2);
+	}else if(!unpacked.result_buffers.empty()){
+		BOOST_FOREACH(std::string& b, unpacked.result_buffers){
+			frames.push_back(boost::make_shared<zmq::message_t>());
+			move_to_frame(b, *frames.back());
+		}
+		outmsg.add_frames(unpacked.result_buffers.size());
+	}else if(r.result_buffers_size()){
+		for(int i=0;i<r.result_buffers_size();i++){
+			frames.push_back(boost::make_shared<zmq::message_t>());
+			move_to_frame(*r.mutable_result_buffers(i), *frames.back());
+		}
+		outmsg.add_frames(r.result_buffers_size());
+	}else{
+		if(r.has_result_content())
+			content.swap(*r.mutable_result_content());
+		frames.push_back(boost::make_shared<zmq::message_t>());
+		move_to_frame(content, *frames.back());
+		outmsg.add_frames(1);
+	}
+	return true;
+}
+
+void hub::_send_results(const incoming_msg_t& to, const gpf_hub::get_results_reply& outmsg, result_frames& frames, const char* topic){
+	ZmqMessage::Outgoing<ZmqMessage::XRouting> out(*m_query,*to,0);
+	out << topic<<m_header_marshal(outmsg);
+	BOOST_FOREACH(boost::shared_ptr<zmq::message_t>& f, frames)
+		out << *f;
+}
+
 void hub::get_results(incoming_msg_t incoming){
 	gpf_hub::get_results_request inmsg;
-	gpf_hub::get_results_reply   outmsg;
-	if(0!=m_header_marshal.deserialize(inmsg,*incoming->iter_at<std::string>(1)))
+	if(0!=m_header_marshal.deserialize(inmsg,(*incoming)[1]))
 	        return;
 
-	auto& id_index = m_ttracker.tasks.get<task_id_t>();
-	bool status_only = inmsg.status_only();
+	if(inmsg.has_stream()){
+		_continue_stream(incoming, inmsg);
+		return;
+	}
 
-	std::vector<std::string*> content_bufs;
+	std::vector<msg_id_t> ids(inmsg.msg_ids_size());
 	for(int i=0;i<inmsg.msg_ids_size();i++){
-		std::string id = inmsg.msg_ids(i);
-		auto it = id_index.find(inmsg.msg_ids(i));
-		if(it==id_index.end()){
+		if(!parse_msg_id(inmsg.msg_ids(i), ids[i])){
+			ZmqMessage::Outgoing<ZmqMessage::XRouting> out(*m_query,*incoming,0);
+			out << "get_results_reply"<<format("Invalid message id %s")%inmsg.msg_ids(i);
+			return;
+		}
+	}
+
+	if(!inmsg.has_page_size()){
+		// everything in one reply
+		gpf_hub::get_results_reply outmsg;
+		result_frames frames;
+		BOOST_FOREACH(const msg_id_t& id, ids){
+			if(!_add_result(id, inmsg.status_only(), outmsg, frames)){
+				ZmqMessage::Outgoing<ZmqMessage::XRouting> out(*m_query,*incoming,0);
+				out << "get_results_reply"<<format("Unknown message id %s")%to_string(id);
+				return;
+			}
+		}
+		_send_results(incoming, outmsg, frames);
+		return;
+	}
+
+	_open_stream(incoming, "get_results_reply", ids, inmsg.page_size(), inmsg.credit(), inmsg.status_only());
+}
+
+void hub::_open_stream(const incoming_msg_t& incoming, const char* topic, std::vector<msg_id_t>& ids,
+		std::size_t page_size, unsigned int credit, bool status_only){
+	boost::uint64_t sid = ++m_next_stream;
+	result_stream& st = m_streams[sid];
+	st.request     = incoming;
+	st.ids.swap(ids);
+	st.next        = 0;
+	st.page_size   = std::max<std::size_t>(1, page_size);
+	st.page        = 0;
+	st.credit      = credit;
+	st.topic       = topic;
+	st.status_only = status_only;
+	st.scheduled   = false;
+	st.used        = boost::posix_time::microsec_clock::universal_time();
+	if(!m_streams_timer){
+		m_streams_timer = true;
+		m_loop.add(deadline_timer(m_stream_timeout/4, boost::bind(&hub::_expire_streams, this, _1)));
+	}
+	_pump_stream(sid);
+}
+
+void hub::_continue_stream(const incoming_msg_t& incoming, const gpf_hub::get_results_request& inmsg){
+	auto it = m_streams.find(inmsg.stream());
+	if(it == m_streams.end()){
+		ZmqMessage::Outgoing<ZmqMessage::XRouting> out(*m_query,*incoming,0);
+		out << "get_results_reply"<<format("Unknown stream %d")%inmsg.stream();
+		return;
+	}
+	if(inmsg.cancel()){
+		// acknowledged with an empty last page
+		gpf_hub::get_results_reply outmsg;
+		outmsg.set_stream(it->first);
+		outmsg.set_page(it->second.page);
+		result_frames none;
+		_send_results(incoming, outmsg, none, it->second.topic);
+		m_streams.erase(it);
+		return;
+	}
+	it->second.request = incoming; // the client may have reconnected
+	it->second.credit += inmsg.credit();
+	_pump_stream(it->first);
+}
+
+void hub::_pump_stream(boost::uint64_t sid){
+	auto it = m_streams.find(sid);
+	if(it == m_streams.end())
+		return;
+	result_stream& st = it->second;
+	st.scheduled = false;
+	st.used      = boost::posix_time::microsec_clock::universal_time();
+
+	// a few pages per turn, the reactor serves other sockets in between
+	for(unsigned int n=0; n<max_pages_per_turn && st.credit>0; n++){
+		gpf_hub::get_results_reply outmsg;
+		result_frames frames;
+		std::size_t end = std::min(st.next + st.page_size, st.ids.size());
+		for(; st.next<end; st.next++)
+			_add_result(st.ids[st.next], st.status_only, outmsg, frames);
+		outmsg.set_stream(sid);
+		outmsg.set_page(st.page++);
+		outmsg.set_more(st.next < st.ids.size());
+		st.credit --;
+		_send_results(st.request, outmsg, frames, st.topic);
+		if(!outmsg.more()){
+			m_streams.erase(it);
+			return;
+		}
+	}
+	if(st.credit>0){
+		st.scheduled = true;
+		m_loop.add(deadline_timer(boost::posix_time::milliseconds(0), boost::bind(&hub::_pump_stream, this, sid)));
+	}
+}
+
+void hub::_expire_streams(zmq_reactor::reactor* r){
+	// streams the client abandoned
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	for(auto it = m_streams.begin(); it != m_streams.end(); ){
+		if(!it->second.scheduled && now - it->second.used > m_stream_timeout){
+			LOG(INFO)<<"get_results: dropping idle stream "<<it->first;
+			m_streams.erase(it++);
+		}else
+			++it;
+	}
+	if(m_streams.empty()){
+		m_streams_timer = false;
+		return;
+	}
+	r->add(deadline_timer(m_stream_timeout/4, boost::bind(&hub::_expire_streams, this, _1)));
+}
+
+void hub::set_stream_timeout(const boost::posix_time::time_duration& t){
+	m_stream_timeout = t;
+}
+
+void hub::client_status(incoming_msg_t incoming){
+	// the status of all tasks a client submitted, found through the
+	// client index, streamed like get_results
+	gpf_hub::client_status_request inmsg;
+	if(0!=m_header_marshal.deserialize(inmsg,(*incoming)[1]))
+	        return;
+	std::string identity;
+	if(inmsg.has_client_id())
+		identity = inmsg.client_id();
+	else
+		routing_identity(incoming, identity);
+	int client = m_clients.find(identity);
+
+	std::vector<msg_id_t> ids;
+	for(unsigned int s=0;s<m_tasks->size() && client>=0;s++){
+		task_shards::locked tt(*m_tasks, s);
+		BOOST_FOREACH(const task& t, tt->tasks.get<client_id_t>().equal_range(client))
+			ids.push_back(t.id);
+	}
+	_open_stream(incoming, "client_status_reply", ids, inmsg.batch(), inmsg.credit(), true);
+}
+
+static bool key_before(const task_time& a, const task_time& b){
+	return a.key < b.key;
+}
+
+void hub::time_range(incoming_msg_t incoming){
+	// tasks in a window of the submitted or completed index. Every
+	// shard contributes at most limit+1 tasks, so a page costs
+	// O(shards * (log(tasks) + limit)) regardless of the table size.
+	gpf_hub::time_range_request inmsg;
+	gpf_hub::time_range_reply   outmsg;
+	if(0!=m_header_marshal.deserialize(inmsg,(*incoming)[1]))
+	        return;
+	boost::int64_t from = inmsg.has_from_us() ? inmsg.from_us() : time_key_min;
+	boost::int64_t to   = inmsg.has_to_us()   ? inmsg.to_us()   : time_key_max;
+	std::size_t limit   = std::max(1u, inmsg.limit());
+
+	task_tracker::time_index which = task_tracker::BY_COMPLETED;
+	time_key lo, hi;
+	switch(inmsg.index()){
+		case gpf_hub::time_range_request::SUBMITTED:
+			which = task_tracker::BY_SUBMITTED;
+			lo = time_key(from, 0);
+			hi = time_key(to,   0);
+			break;
+		case gpf_hub::time_range_request::COMPLETED:
+			lo = time_key(from, time_key_min);
+			hi = time_key(to,   time_key_min); // pending tasks have completed == time_key_max
+			break;
+		case gpf_hub::time_range_request::PENDING:
+			lo = time_key(time_key_max, from);
+			hi = time_key(time_key_max, to);
+			break;
+	}
+	bool after = inmsg.has_cursor();
+	if(after){
+		if(inmsg.cursor().size() != sizeof(time_key)){
 			ZmqMessage::Outgoing<ZmqMessage::XRouting> out(*m_query,*incoming,0);
-			out << "get_results_reply"<<format("Unknown message id %s")%id;
+			out << "time_range_reply"<<"Error: Invalid cursor";
 			return;
 		}
-		gpf_hub::get_results_reply::result& res = *outmsg.add_results();
-		res.set_msg_id(id);
-		res.set_status(it->completed.is_not_a_date_time() 
-				? gpf_hub::get_results_reply::PENDING 
-				: gpf_hub::get_results_reply::COMPLETED);
-		if(!status_only)
-			content_bufs.push_back(&it->result_content);
+		memcpy(&lo, inmsg.cursor().data(), sizeof(time_key));
+	}
+
+	std::vector<task_time> found;
+	bool more = false;
+	for(unsigned int s=0;s<m_tasks->size();s++){
+		task_shards::locked tt(*m_tasks, s);
+		more |= !tt->time_range(which, lo, after, hi, limit, found);
+	}
+	std::sort(found.begin(), found.end(), key_before);
+	if(found.size() > limit){
+		found.resize(limit);
+		more = true;
 	}
 
+	BOOST_FOREACH(const task_time& t, found){
+		gpf_hub::time_range_reply::task& msg = *outmsg.add_tasks();
+		msg.set_msg_id(to_string(t.key.id));
+		msg.set_status(wire_status(t.state));
+		msg.set_eid(t.engine_uuid);
+		if(t.submitted_us != time_key_min)
+			msg.set_submitted_us(t.submitted_us);
+		if(t.completed_us != time_key_max)
+			msg.set_completed_us(t.completed_us);
+	}
+	if(more && !found.empty())
+		outmsg.set_cursor(&found.back().key, sizeof(time_key));
+
 	ZmqMessage::Outgoing<ZmqMessage::XRouting> out(*m_query,*incoming,0);
-	out << "load_reply"<<m_header_marshal(outmsg);
-	BOOST_FOREACH(std::string* s, content_bufs)
-		out << *s;
+	out << "time_range_reply"<<m_header_marshal(outmsg);
 }
 
 void hub::connection_request(incoming_msg_t){}
@@ -618,6 +1352,15 @@ void hub::unregister_engine(incoming_msg_t in){
 		return;
 	}
 	LOG(INFO)<<"Unregistring engine "<<it->id<< " ("<<queue<<")";
+	if(m_journal){
+		journal::entry_t e;
+		e.set_type(gpf_hub::journal_entry::UNREGISTRATION);
+		e.set_eid(it->id);
+		m_journal->append(e);
+	}
+	m_tracker.remove_services(*it);
+	if(m_scheduler)
+		m_scheduler->remove_engine(it->id);
 	index.erase(it);
 }
 
@@ -4,9 +4,11 @@
 #include <boost/function.hpp>
 #include <boost/utility.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/uuid/uuid.hpp>
 #include <string>
 #include <map>
+#include <deque>
 
 #include <zmq.hpp>
 #include <zmq_utils.h> 
@@ -20,6 +22,10 @@
 #include <gpf/except.hpp>
 #include <gpf/controller/engine_set.hpp>
 #include <gpf/controller/task_set.hpp>
+#include <gpf/controller/task_shards.hpp>
+#include <gpf/controller/topics.hpp>
+#include <gpf/controller/journal.hpp>
+#include <gpf/controller/scheduler.hpp>
 
 namespace gpf{
 
@@ -45,6 +51,62 @@ namespace gpf{
 	};
 
 
+	/// counters for draining the monitor socket
+	struct monitor_stats
+	{
+		unsigned long wakeups;          ///< number of reactor wakeups on the monitor socket
+		unsigned long messages;         ///< number of monitor messages received
+		unsigned int  last_batch;       ///< messages drained in the last wakeup
+		unsigned int  max_batch;        ///< largest number of messages drained in one wakeup
+		double        wakeups_per_sec;  ///< measured over the last full second
+		double        messages_per_sec; ///< measured over the last full second
+
+		/// average number of messages per wakeup
+		inline double mean_batch()const{ return wakeups ? (double)messages/wakeups : 0.; }
+
+		monitor_stats()
+		: wakeups(0), messages(0), last_batch(0), max_batch(0)
+		, wakeups_per_sec(0.), messages_per_sec(0.)
+		, window_wakeups(0), window_messages(0) {}
+
+		private:
+		friend class hub;
+		boost::posix_time::ptime window_start;
+		unsigned long window_wakeups;
+		unsigned long window_messages;
+	};
+
+	/// a get_results reply sent in pages, see hub.proto
+	struct result_stream
+	{
+		incoming_msg_t           request;     ///< last request, the pages are routed like it
+		std::vector<msg_id_t>    ids;
+		std::size_t              next;        ///< first id not sent yet
+		std::size_t              page_size;
+		unsigned int             page;        ///< number of the next page
+		unsigned int             credit;      ///< pages the client can take
+		const char*              topic;       ///< of the replies
+		bool                     status_only;
+		bool                     scheduled;   ///< a _pump_stream is queued
+		boost::posix_time::ptime used;        ///< last page sent
+	};
+
+	/// a purge_results request being worked off, see hub.proto
+	struct purge_job
+	{
+		incoming_msg_t        request;
+		bool                  all;
+		boost::uint64_t       cutoff;  ///< all: tasks that arrived before the request, see monitor_job::arrival
+		time_key              from;    ///< all: where the next slice of the shard starts
+		msg_id_t              db_next; ///< first task db record not looked at yet
+		std::vector<msg_id_t> ids;
+		std::size_t           next;    ///< first id not purged yet
+		std::vector<int>      eids;
+		unsigned int          shard;   ///< all, eids: shard being purged
+		std::size_t           purged;
+		bool                  failed;  ///< an error was replied
+	};
+
 	class hub
 	: boost::noncopyable
 	{
@@ -69,6 +131,68 @@ namespace gpf{
 		const engine_connector& get_engine(const std::string& queue);
 		unsigned int      get_num_engines();
 
+		/// drain up to n monitor messages per reactor wakeup (default: 1)
+		void set_monitor_batch(unsigned int n);
+
+		/**
+		 * do task bookkeeping in n worker threads, partitioned by msg_id.
+		 *
+		 * 0 (default) keeps the bookkeeping on the reactor thread.
+		 * Must be called before any traffic arrives.
+		 */
+		void set_task_shards(unsigned int n);
+
+		/**
+		 * limit the number of completed tasks kept in memory.
+		 *
+		 * Eviction runs on a reactor timer every p.interval, see
+		 * retention_policy.
+		 */
+		void set_retention(const retention_policy& p);
+		const retention_policy& get_retention()const{return m_retention;}
+
+		/**
+		 * keep completed tasks in db as well.
+		 *
+		 * get_results falls back to db for tasks the hub no longer holds
+		 * in memory (see set_retention), purge_results removes them from
+		 * db too. NULL (default) disables it.
+		 */
+		void set_task_db(boost::shared_ptr<task_db> db);
+		boost::shared_ptr<task_db> get_task_db()const{return m_db;}
+
+		/**
+		 * recover the state held in j, then journal all changes to it.
+		 *
+		 * Registrations and task transitions are journaled, a snapshot
+		 * is taken every snapshot_interval. Recovered engines whose
+		 * hearts do not beat within the registration timeout are
+		 * unregistered. Call before any traffic arrives and after
+		 * set_task_shards().
+		 */
+		void set_journal(boost::shared_ptr<journal> j, const boost::posix_time::time_duration& snapshot_interval);
+
+		/**
+		 * route the task queue through s.
+		 *
+		 * s gets the registered engines, and for the WEIGHTED scheme
+		 * their speed (1/service time, see engine_load) every second.
+		 */
+		void set_scheduler(boost::shared_ptr<task_scheduler> s);
+		boost::shared_ptr<task_scheduler> get_scheduler()const{return m_scheduler;}
+
+		/// drop result streams the client did not ask for more of within t (default: a minute)
+		void set_stream_timeout(const boost::posix_time::time_duration& t);
+
+		/// numbers of the clients that submitted tasks (task::client_uuid)
+		const client_table& get_clients()const{return m_clients;}
+
+		/// wait until all monitor traffic received so far is processed
+		inline void sync_tasks(){ m_tasks->sync(); }
+		const monitor_stats& get_monitor_stats()const{return m_monitor_stats;}
+		/// summed over all shards, see retention_policy::compress_bytes
+		compression_stats get_compression_stats();
+
 		void run();
 		void shutdown();
 		
@@ -80,20 +204,23 @@ namespace gpf{
 		void handle_new_heart(const std::string& heart);
 		void handle_heart_failure(const std::string& heart);
 
-		typedef boost::shared_ptr<ZmqMessage::Incoming<ZmqMessage::XRouting> > incoming_msg_t;
+		// Monitor traffic handlers. These run on the shard's worker
+		// thread and must only touch the task_tracker they are given.
 
 		// MUX Queue Traffic
-		void nop(incoming_msg_t); // TODO: should this func recv the msg nevertheless?
-		void save_queue_request(incoming_msg_t);
-		void save_queue_result (incoming_msg_t);
+		void nop(task_tracker&, const incoming_msg_t&); // TODO: should this func recv the msg nevertheless?
+		void save_queue_request(task_tracker&, const incoming_msg_t&);
+		void save_queue_result (task_tracker&, const incoming_msg_t&);
 
 		// Task Queue Traffic
-		void save_task_request(incoming_msg_t);
-		void save_task_result(incoming_msg_t);
-		void save_task_destination(incoming_msg_t);
+		void save_task_request(task_tracker&, const incoming_msg_t&);
+		void save_task_result(task_tracker&, const incoming_msg_t&);
+		void save_task_destination(task_tracker&, const incoming_msg_t&);
 
 		// IOPub traffic
-		void save_iopub_message(incoming_msg_t);
+		void save_iopub_message(task_tracker&, const incoming_msg_t&);
+
+		void _apply_monitor_job(task_tracker&, const monitor_job&);
 
 		// registration requests
 		void connection_request(incoming_msg_t);
@@ -102,6 +229,7 @@ namespace gpf{
 		void finish_registration(const std::string& heart);
 
 		void _handle_stranded_msgs(int eid, const std::string& uuid);
+		void _fail_engine_tasks(int eid, const boost::posix_time::ptime& when, std::vector<msg_id_t>& failed);
 		void _purge_stalled_registration(const std::string& heart);
 		void _unregister_engine( int eid );
 
@@ -114,6 +242,8 @@ namespace gpf{
 		void resubmit_task(incoming_msg_t);
 		//void _extract_record(incoming_msg_t);
 		void get_results(incoming_msg_t);
+		void client_status(incoming_msg_t);
+		void time_range(incoming_msg_t);
 
 		zmq_reactor::reactor&          m_loop;
 
@@ -123,10 +253,10 @@ namespace gpf{
 		boost::shared_ptr<zmq::socket_t> m_notifier;
 		boost::shared_ptr<zmq::socket_t> m_resubmit;
 
-		typedef void (hub::*monitor_handler_t)(incoming_msg_t);
+		typedef void (hub::*monitor_handler_t)(task_tracker&, const incoming_msg_t&);
 		typedef void (hub::*query_handler_t)(incoming_msg_t);
-		std::map<std::string,monitor_handler_t> m_monitor_handlers;
-		std::map<std::string,query_handler_t>   m_query_handlers;
+		monitor_handler_t m_monitor_handlers[MONITOR_NUM_TOPICS]; ///< indexed by monitor_topic
+		query_handler_t   m_query_handlers[QUERY_NUM_TOPICS];     ///< indexed by query_topic
 
 		serialization::serializer<serialization::protobuf_archive> m_header_marshal;
 
@@ -138,7 +268,65 @@ namespace gpf{
 		engine_info                    m_engine_info;
 		client_info                    m_client_info;
 
-		task_tracker                   m_ttracker;
+		incoming_pool&                 m_incoming_pool;
+
+		client_table                   m_clients;
+		boost::scoped_ptr<task_shards> m_tasks;
+		std::vector<std::vector<monitor_job> > m_shard_jobs; ///< current batch, per shard
+		boost::uint64_t                        m_arrivals;   ///< monitor messages received, see monitor_job::arrival
+
+		// monitor batching
+		unsigned int                m_monitor_batch;                      ///< max. messages drained per wakeup
+		std::vector<incoming_msg_t> m_monitor_queue[MONITOR_NUM_TOPICS];  ///< current batch, grouped by topic
+		monitor_stats               m_monitor_stats;
+		boost::posix_time::ptime    m_now;                                ///< time the current batch was received
+		void _update_monitor_stats(unsigned int batch_size);
+
+		// retention of completed tasks
+		retention_policy            m_retention;
+		bool                        m_retention_timer;                    ///< eviction timer is scheduled
+		void _enforce_retention(zmq_reactor::reactor*);
+
+		// storage of completed tasks
+		boost::shared_ptr<task_db>  m_db;
+		bool                        m_db_timer;                           ///< flush timer is scheduled
+		void _flush_task_db(zmq_reactor::reactor*);
+
+		// write-ahead journal
+		boost::shared_ptr<journal>       m_journal;
+		boost::posix_time::time_duration m_snapshot_interval;
+		void _restore_snapshot(const journal::snapshot_t&);
+		void _set_replaying(bool r);
+		void _replay(const journal::entry_t&);
+		void _restore_engine(const gpf_hub::registration&);
+		void _erase_engine(int eid);
+		void _snapshot(zmq_reactor::reactor*);
+		void _check_recovered_engines();
+
+		// get_results, pages of streams are sent from reactor timers
+		typedef std::vector<boost::shared_ptr<zmq::message_t> > result_frames;
+		std::map<boost::uint64_t, result_stream> m_streams;
+		boost::uint64_t                          m_next_stream;
+		boost::posix_time::time_duration         m_stream_timeout;
+		bool                                     m_streams_timer;  ///< expiry timer is scheduled
+		bool _add_result(const msg_id_t& id, bool status_only, gpf_hub::get_results_reply& outmsg, result_frames& frames);
+		void _send_results(const incoming_msg_t& to, const gpf_hub::get_results_reply& outmsg, result_frames& frames,
+				const char* topic="get_results_reply");
+		void _continue_stream(const incoming_msg_t& incoming, const gpf_hub::get_results_request& inmsg);
+		void _open_stream(const incoming_msg_t& incoming, const char* topic, std::vector<msg_id_t>& ids,
+				std::size_t page_size, unsigned int credit, bool status_only);
+		void _pump_stream(boost::uint64_t stream);
+		void _expire_streams(zmq_reactor::reactor*);
+
+		// task scheduling
+		boost::shared_ptr<task_scheduler> m_scheduler;
+		void _update_weights(zmq_reactor::reactor*);
+
+		// purge_results, in slices from reactor timers
+		std::deque<purge_job>            m_purges;  ///< front is running
+		void _purge_slice(zmq_reactor::reactor*);
+		bool _purge_tasks(purge_job& job, std::size_t budget);
+		bool _purge_db(purge_job& job, std::size_t budget);
 
 
 	};
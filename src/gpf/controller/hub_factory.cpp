@@ -12,6 +12,12 @@ hub_factory::hub_factory(int startport)
 :m_portpool(startport),
  m_ctx(1),
  m_heartmonitor_interval_millisec(2000),
+ m_monitor_batch(1),
+ m_task_shards(0),
+ m_snapshot_interval_sec(60),
+ m_task_scheme("leastload"),
+ m_prefetch(0),
+ m_engine_hwm(0),
  m_reactor(m_ctx)
 {
 	m_hb_ports      = m_portpool.get(2);
@@ -56,6 +62,60 @@ hub_factory::hm_interval(int millisecs){
 	return *this;
 }
 
+hub_factory&
+hub_factory::monitor_batch(unsigned int n){
+	m_monitor_batch = n;
+	return *this;
+}
+
+hub_factory&
+hub_factory::shards(unsigned int n_threads){
+	m_task_shards = n_threads;
+	return *this;
+}
+
+hub_factory&
+hub_factory::retention(const retention_policy& p){
+	m_retention = p;
+	return *this;
+}
+
+hub_factory&
+hub_factory::database(const std::string& spec){
+	m_database = spec;
+	return *this;
+}
+
+hub_factory&
+hub_factory::journal_dir(const std::string& dir){
+	m_journal_dir = dir;
+	return *this;
+}
+
+hub_factory&
+hub_factory::snapshot_interval(int secs){
+	m_snapshot_interval_sec = secs;
+	return *this;
+}
+
+hub_factory&
+hub_factory::task_scheme(const std::string& scheme){
+	m_task_scheme = scheme;
+	return *this;
+}
+
+hub_factory&
+hub_factory::work_stealing(unsigned int prefetch){
+	m_prefetch = prefetch;
+	return *this;
+}
+
+hub_factory&
+hub_factory::engine_hwm(unsigned int hwm){
+	m_engine_hwm = hwm;
+	return *this;
+}
+
 boost::shared_ptr<hub>
 hub_factory::get(){
 	typedef boost::shared_ptr<zmq::socket_t> zmq_socket;
@@ -101,6 +161,22 @@ hub_factory::get(){
 	sub->bind(m_monitor_url.c_str());
 	sub->bind("inproc://monitor");
 
+	// task queue
+	engine_chooser::scheme_t scheme;
+	if(!engine_chooser::parse_scheme(m_task_scheme, scheme)){
+		LOG(ERROR)<<"unknown task scheme `"<<m_task_scheme<<"', using leastload";
+		scheme = engine_chooser::LEAST_LOAD;
+	}
+	zmq_socket tclient( new zmq::socket_t(m_ctx, ZMQ_ROUTER) );
+	tclient->bind(str(format(client_iface)%m_task_ports[0]).c_str());
+	zmq_socket tengine( new zmq::socket_t(m_ctx, ZMQ_ROUTER) );
+	tengine->bind(str(format(engine_iface)%m_task_ports[1]).c_str());
+	zmq_socket tmon( new zmq::socket_t(m_ctx, ZMQ_PUB) );
+	tmon->connect("inproc://monitor");
+	boost::shared_ptr<task_scheduler> sched(new task_scheduler(m_reactor, tclient, tengine, tmon, scheme));
+	sched->set_prefetch(m_prefetch);
+	sched->chooser().set_hwm(m_engine_hwm);
+
 	// build info structs
 	client_info ci;
 	ci.hub_registration =  str(format(client_iface) % m_reg_port);
@@ -109,7 +185,7 @@ hub_factory::get(){
 	ci.iopub        = str(format(client_iface) % m_iopub_ports[0]);
 	ci.notification = str(format(client_iface) % m_notifier_port);
 	ci.task         = str(format(client_iface) % m_task_ports[0]);
-	ci.task_scheme  = "default";
+	ci.task_scheme  = engine_chooser::scheme_name(scheme);
 
 	engine_info ei;
 	ei.hub_registration =  str(format(engine_iface) % m_reg_port);
@@ -142,6 +218,17 @@ hub_factory::get(){
 	r->setsockopt(ZMQ_IDENTITY, session_name, strlen(session_name));
 	r->connect(ci.task.c_str());
 	boost::shared_ptr<hub> H( new hub(m_reactor, sub, q, n, r,m_heartmonitor, ei,ci));
+	H->set_monitor_batch(m_monitor_batch);
+	H->set_task_shards(m_task_shards);
+	H->set_retention(m_retention);
+	if(!m_database.empty())
+		H->set_task_db(make_task_db(m_database));
+	if(!m_journal_dir.empty()){
+		boost::shared_ptr<journal> j(new journal(m_journal_dir));
+		if(j->ok())
+			H->set_journal(j, boost::posix_time::seconds(m_snapshot_interval_sec));
+	}
+	H->set_scheduler(sched);
 
 	return H;
 }
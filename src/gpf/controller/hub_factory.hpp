@@ -13,6 +13,20 @@ namespace gpf
 			hub_factory& ip(const std::string&);
 			hub_factory& transport(const std::string&);
 			hub_factory& hm_interval(int millisecs);
+			hub_factory& monitor_batch(unsigned int n);
+			hub_factory& shards(unsigned int n_threads);
+			hub_factory& retention(const retention_policy& p);
+			/// where completed tasks are stored, see make_task_db(). Default: nowhere.
+			hub_factory& database(const std::string& spec);
+			/// recover from and journal to dir, see hub::set_journal(). Default: no journal.
+			hub_factory& journal_dir(const std::string& dir);
+			hub_factory& snapshot_interval(int secs);
+			/// how the task queue picks engines, see engine_chooser::parse_scheme(). Default: leastload.
+			hub_factory& task_scheme(const std::string& scheme);
+			/// send engines at most n tasks and steal the rest between them, see task_scheduler::set_prefetch(). Default: 0, off.
+			hub_factory& work_stealing(unsigned int prefetch);
+			/// max. tasks the task queue assigns to an engine before it has results, see engine_chooser::set_hwm(). Default: 0, unlimited.
+			hub_factory& engine_hwm(unsigned int hwm);
 
 			hub_factory(int startport);
 
@@ -24,6 +38,16 @@ namespace gpf
 
 			int m_heartmonitor_interval_millisec;
 
+			unsigned int m_monitor_batch; ///< max. monitor messages handled per wakeup
+			unsigned int m_task_shards;   ///< bookkeeping threads, 0: use reactor thread
+			retention_policy m_retention; ///< limits for completed tasks, default: keep all
+			std::string  m_database;      ///< task_db spec, empty: none
+			std::string  m_journal_dir;   ///< empty: no journal
+			int          m_snapshot_interval_sec;
+			std::string  m_task_scheme;
+			unsigned int m_prefetch;      ///< work stealing, 0: off
+			unsigned int m_engine_hwm;    ///< 0: unlimited
+
 			// monitor
 			std::string m_monitor_transport;
 			std::string m_monitor_ip;
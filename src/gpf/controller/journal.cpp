@@ -0,0 +1,478 @@
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include <boost/crc.hpp>
+#include <boost/foreach.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <glog/logging.h>
+#include <gpf/controller/journal.hpp>
+#include <gpf/util/time.hpp>
+
+using namespace gpf;
+namespace fs = boost::filesystem;
+
+// entries and snapshots are framed as <u32 size><u32 crc32><size bytes>
+
+static boost::uint32_t crc32(const char* data, std::size_t size){
+	boost::crc_32_type crc;
+	crc.process_bytes(data, size);
+	return crc.checksum();
+}
+
+static void frame(const std::string& data, std::string& out){
+	boost::uint32_t head[2] = { (boost::uint32_t)data.size(), crc32(data.data(), data.size()) };
+	out.append(reinterpret_cast<const char*>(head), sizeof(head));
+	out.append(data);
+}
+
+/// read the next frame of buf starting at pos. false at the end or at a torn/corrupt frame.
+static bool unframe(const std::string& buf, std::size_t& pos, const char*& data, std::size_t& size){
+	boost::uint32_t head[2];
+	if(buf.size() - pos < sizeof(head))
+		return false;
+	memcpy(head, buf.data()+pos, sizeof(head));
+	if(buf.size() - pos - sizeof(head) < head[0])
+		return false;
+	data = buf.data() + pos + sizeof(head);
+	size = head[0];
+	if(crc32(data, size) != head[1])
+		return false;
+	pos += sizeof(head) + size;
+	return true;
+}
+
+/// read the next frame of is into data. false at the end or at a torn/corrupt frame.
+static bool read_frame(std::istream& is, std::string& data){
+	boost::uint32_t head[2];
+	if(!is.read(reinterpret_cast<char*>(head), sizeof(head)))
+		return false;
+	data.resize(head[0]);
+	if(head[0] && !is.read(&data[0], head[0]))
+		return false;
+	return crc32(data.data(), data.size()) == head[1];
+}
+
+/// log_seq of the snapshot at path, false if there is none or its head is corrupt
+static bool snapshot_seq(const std::string& path, boost::uint64_t& log_seq){
+	std::ifstream is(path.c_str(), std::ios::binary);
+	std::string data;
+	gpf_hub::hub_snapshot s;
+	if(!is || !read_frame(is, data) || !s.ParseFromString(data))
+		return false;
+	log_seq = s.log_seq();
+	return true;
+}
+
+/// true if every chunk of the snapshot at path is intact, see snapshot_seq()
+static bool check_snapshot(const std::string& path, boost::uint64_t& log_seq){
+	if(!snapshot_seq(path, log_seq))
+		return false;
+	std::ifstream is(path.c_str(), std::ios::binary);
+	std::string data;
+	boost::uintmax_t bytes = 0;
+	while(read_frame(is, data))
+		bytes += 2*sizeof(boost::uint32_t) + data.size();
+	boost::system::error_code ec;
+	return bytes == fs::file_size(path, ec);
+}
+
+static bool read_file(const std::string& path, std::string& buf){
+	std::ifstream is(path.c_str(), std::ios::binary);
+	if(!is)
+		return false;
+	buf.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+	return true;
+}
+
+static bool write_all(int fd, const char* p, std::size_t n){
+	while(n > 0){
+		ssize_t w = ::write(fd, p, n);
+		if(w < 0){
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		p += w;
+		n -= w;
+	}
+	return true;
+}
+
+static std::string segment_name(boost::uint64_t seq){
+	return "journal." + boost::lexical_cast<std::string>(seq);
+}
+
+/// journal segments in dir, by sequence number
+static std::map<boost::uint64_t, std::string> list_segments(const std::string& dir){
+	std::map<boost::uint64_t, std::string> segs;
+	for(fs::directory_iterator it(dir), end; it != end; ++it){
+		std::string name = it->path().filename().string();
+		if(name.compare(0, 8, "journal.") != 0)
+			continue;
+		try{
+			segs[boost::lexical_cast<boost::uint64_t>(name.substr(8))] = it->path().string();
+		}catch(const boost::bad_lexical_cast&){
+		}
+	}
+	return segs;
+}
+
+journal::journal(const std::string& dir)
+: m_dir(dir)
+, m_fd(-1)
+, m_seq(0)
+, m_old_fd(-1)
+, m_switch_at(0)
+, m_appended(0)
+, m_durable(0)
+, m_stop(false)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+	boost::system::error_code ec;
+	fs::create_directories(dir, ec);
+	if(!fs::is_directory(dir)){
+		LOG(ERROR)<<"journal: `"<<dir<<"' is not a directory";
+		return;
+	}
+	std::map<boost::uint64_t, std::string> segs = list_segments(dir);
+	m_seq = segs.empty() ? 1 : segs.rbegin()->first + 1;
+	m_fd  = _open_segment(m_seq);
+	if(m_fd < 0)
+		return;
+	m_writer = boost::thread(boost::bind(&journal::_write_loop, this));
+}
+
+journal::~journal(){
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_stop = true;
+		m_cond.notify_all();
+	}
+	if(m_writer.joinable())
+		m_writer.join();
+	if(m_old_fd >= 0)
+		::close(m_old_fd);
+	if(m_fd >= 0)
+		::close(m_fd);
+}
+
+int journal::_open_segment(boost::uint64_t seq){
+	std::string path = (fs::path(m_dir) / segment_name(seq)).string();
+	int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if(fd < 0)
+		LOG(ERROR)<<"journal: could not open `"<<path<<"': "<<strerror(errno);
+	return fd;
+}
+
+bool journal::_replay_segment(const std::string& path, const replay_t& replay, std::size_t& n){
+	std::string buf;
+	if(!read_file(path, buf)){
+		LOG(ERROR)<<"journal: could not read `"<<path<<"'";
+		return false;
+	}
+	std::size_t pos = 0;
+	const char* data;
+	std::size_t size;
+	entry_t e;
+	while(unframe(buf, pos, data, size)){
+		if(!e.ParseFromArray(data, size))
+			break;
+		replay(e);
+		n++;
+	}
+	if(pos != buf.size()){
+		LOG(WARNING)<<"journal: ignoring "<<(buf.size()-pos)<<" bytes of a torn entry in `"<<path<<"'";
+		return false;
+	}
+	return true;
+}
+
+std::size_t journal::recover(const restore_t& restore, const replay_t& replay){
+	std::string path = (fs::path(m_dir) / "snapshot").string();
+	std::string old  = (fs::path(m_dir) / "snapshot.old").string();
+	std::map<boost::uint64_t, std::string> segs = list_segments(m_dir);
+	boost::uint64_t first = 0;
+	// the chunks are checked before any is restored, so a corrupt
+	// snapshot can be replaced by the previous one as a whole
+	if(!check_snapshot(path, first)){
+		if(fs::exists(path))
+			LOG(ERROR)<<"journal: corrupt snapshot in `"<<m_dir<<"', falling back to the previous one";
+		path = old;
+		if(!check_snapshot(path, first)){
+			path.clear();
+			first = 0;
+			if(fs::exists(old))
+				LOG(ERROR)<<"journal: corrupt previous snapshot in `"<<m_dir<<"'";
+			// a snapshot removed the segments before the first one left
+			if(!segs.empty() && segs.begin()->first > 1)
+				LOG(ERROR)<<"journal: no usable snapshot in `"<<m_dir<<"', state before segment "
+					<<segs.begin()->first<<" is unrecoverable";
+		}
+	}
+	if(!path.empty()){
+		std::ifstream is(path.c_str(), std::ios::binary);
+		std::string data;
+		snapshot_t s;
+		std::size_t engines = 0, tasks = 0;
+		while(read_frame(is, data)){
+			if(!s.ParseFromString(data)){
+				LOG(ERROR)<<"journal: corrupt chunk in `"<<path<<"', state after it is lost";
+				break;
+			}
+			engines += s.engines_size();
+			tasks   += s.tasks_size();
+			restore(s);
+		}
+		LOG(INFO)<<"journal: restored `"<<path<<"' with "<<engines<<" engines and "<<tasks<<" tasks";
+	}
+
+	std::size_t n = 0;
+	typedef std::pair<const boost::uint64_t, std::string> seg_t;
+	BOOST_FOREACH(const seg_t& seg, segs){
+		if(seg.first < first || seg.first >= m_seq)
+			continue;
+		_replay_segment(seg.second, replay, n);
+	}
+	LOG(INFO)<<"journal: replayed "<<n<<" entries";
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_stats.replayed += n;
+	return n;
+}
+
+void journal::append(const entry_t& e){
+	std::string data;
+	e.SerializeToString(&data);
+	boost::mutex::scoped_lock lock(m_mutex);
+	std::size_t before = m_buffer.size();
+	frame(data, m_buffer);
+	m_appended += m_buffer.size() - before;
+	m_stats.entries ++;
+	m_cond.notify_one();
+}
+
+void journal::append(entry_t::Type t, const void* data, std::size_t size){
+	entry_t e;
+	e.set_type(t);
+	e.set_time_us(to_us(boost::posix_time::microsec_clock::universal_time()));
+	e.set_data(data, size);
+	append(e);
+}
+
+void journal::sync(){
+	boost::mutex::scoped_lock lock(m_mutex);
+	boost::uint64_t target = m_appended;
+	while(m_durable < target && m_writer.joinable())
+		m_synced_cond.wait(lock);
+}
+
+void journal::_write_loop(){
+	std::string buf;
+	boost::mutex::scoped_lock lock(m_mutex);
+	while(true){
+		while(m_buffer.empty() && m_old_fd < 0 && !m_stop)
+			m_cond.wait(lock);
+		if(m_buffer.empty() && m_old_fd < 0)
+			break;
+		// everything appended so far goes into this commit, the part
+		// before a segment switch into the previous segment
+		buf.swap(m_buffer);
+		boost::uint64_t target = m_appended;
+		int fd = m_fd, old_fd = m_old_fd;
+		std::size_t old_bytes = m_switch_at;
+		m_old_fd    = -1;
+		m_switch_at = 0;
+		lock.unlock();
+
+		if(old_fd >= 0){
+			if(!write_all(old_fd, buf.data(), old_bytes) || ::fdatasync(old_fd) != 0)
+				LOG(ERROR)<<"journal: could not write `"<<m_dir<<"': "<<strerror(errno);
+			::close(old_fd);
+		}
+		if(buf.size() > old_bytes
+		&& (!write_all(fd, buf.data() + old_bytes, buf.size() - old_bytes) || ::fdatasync(fd) != 0))
+			LOG(ERROR)<<"journal: could not write `"<<m_dir<<"': "<<strerror(errno);
+		std::size_t written = buf.size();
+		buf.clear();
+
+		lock.lock();
+		m_durable = target;
+		m_stats.commits ++;
+		m_stats.bytes   += written;
+		m_synced_cond.notify_all();
+	}
+}
+
+journal::snapshot_writer_ptr journal::begin_snapshot(snapshot_t& head, unsigned int parts){
+	if(!m_snapshot.expired()){
+		LOG(WARNING)<<"journal: previous snapshot still being written, skipping this one";
+		return snapshot_writer_ptr();
+	}
+	boost::mutex::scoped_lock lock(m_mutex);
+	if(m_old_fd >= 0){
+		LOG(WARNING)<<"journal: previous segment not finished yet, skipping this snapshot";
+		return snapshot_writer_ptr();
+	}
+	std::string tmp = (fs::path(m_dir) / "snapshot.tmp").string();
+	int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0){
+		LOG(ERROR)<<"journal: could not open `"<<tmp<<"': "<<strerror(errno);
+		return snapshot_writer_ptr();
+	}
+	int seg = _open_segment(m_seq + 1);
+	if(seg < 0){
+		::close(fd);
+		return snapshot_writer_ptr();
+	}
+	// all entries up to now belong to the old segments, the writer
+	// finishes them before it writes to the new one
+	m_old_fd    = m_fd;
+	m_switch_at = m_buffer.size();
+	m_fd        = seg;
+	m_seq      ++;
+	m_cond.notify_one();
+	lock.unlock();
+
+	snapshot_writer_ptr w(new snapshot_writer(m_dir, fd, m_seq, parts));
+	m_snapshot = w;
+	head.set_log_seq(m_seq);
+	w->write(head);
+	if(!parts)
+		w->_commit();
+	return w;
+}
+
+bool journal::snapshot(snapshot_t& s){
+	snapshot_t head, chunk;
+	head.set_next_eid(s.next_eid());
+	head.mutable_engines()->CopyFrom(s.engines());
+	snapshot_writer_ptr w = begin_snapshot(head, 1);
+	if(!w)
+		return false;
+	s.set_log_seq(head.log_seq());
+	for(int i=0;i<s.tasks_size();i++){
+		chunk.add_tasks()->CopyFrom(s.tasks(i));
+		if(chunk.tasks_size() == snapshot_chunk){
+			w->write(chunk);
+			chunk.Clear();
+		}
+	}
+	if(chunk.tasks_size())
+		w->write(chunk);
+	w->done();
+	return w->ok();
+}
+
+journal::snapshot_writer::snapshot_writer(const std::string& dir, int fd, boost::uint64_t log_seq, unsigned int parts)
+: m_dir(dir)
+, m_fd(fd)
+, m_log_seq(log_seq)
+, m_parts(parts)
+, m_ok(true)
+, m_bytes(0)
+{
+}
+
+journal::snapshot_writer::~snapshot_writer(){
+	if(m_fd < 0)
+		return;
+	// dropped before all parts were done
+	::close(m_fd);
+	boost::system::error_code ec;
+	fs::remove(fs::path(m_dir) / "snapshot.tmp", ec);
+}
+
+bool journal::snapshot_writer::ok(){
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_ok;
+}
+
+void journal::snapshot_writer::write(const snapshot_t& s){
+	std::string data, buf;
+	if(!s.SerializeToString(&data)){
+		// e.g. over protobuf's 2GB limit
+		LOG(ERROR)<<"journal: could not serialize a snapshot chunk of "<<s.tasks_size()<<" tasks";
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_ok = false;
+		return;
+	}
+	frame(data, buf);
+	boost::mutex::scoped_lock lock(m_mutex);
+	if(!m_ok || m_fd < 0)
+		return;
+	if(!write_all(m_fd, buf.data(), buf.size())){
+		LOG(ERROR)<<"journal: could not write the snapshot in `"<<m_dir<<"': "<<strerror(errno);
+		m_ok = false;
+	}
+	m_bytes += buf.size();
+}
+
+void journal::snapshot_writer::done(){
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		if(m_parts == 0 || --m_parts > 0)
+			return;
+	}
+	_commit();
+}
+
+void journal::snapshot_writer::_commit(){
+	boost::mutex::scoped_lock lock(m_mutex);
+	std::string tmp  = (fs::path(m_dir) / "snapshot.tmp").string();
+	std::string path = (fs::path(m_dir) / "snapshot").string();
+	std::string old  = (fs::path(m_dir) / "snapshot.old").string();
+	int fd = m_fd;
+	m_fd = -1;
+	if(m_ok && ::fsync(fd) != 0){
+		LOG(ERROR)<<"journal: could not sync `"<<tmp<<"': "<<strerror(errno);
+		m_ok = false;
+	}
+	::close(fd);
+	// the previous snapshot is kept as snapshot.old, recover() falls
+	// back to it and the segments since if the new one is corrupt
+	boost::uint64_t old_seq = 0;
+	if(m_ok && fs::is_regular_file(path)){
+		if(!snapshot_seq(path, old_seq))
+			old_seq = 0; // unusable, keep all the segments
+		if(::rename(path.c_str(), old.c_str()) != 0){
+			LOG(ERROR)<<"journal: could not rename `"<<path<<"': "<<strerror(errno);
+			m_ok = false;
+		}
+	}
+	if(m_ok && ::rename(tmp.c_str(), path.c_str()) != 0){
+		LOG(ERROR)<<"journal: could not rename `"<<tmp<<"': "<<strerror(errno);
+		m_ok = false;
+	}
+	if(!m_ok){
+		// the previous snapshot and the segments since are still valid,
+		// recover() uses snapshot.old if it was moved already
+		boost::system::error_code ec;
+		fs::remove(tmp, ec);
+		return;
+	}
+	int dfd = ::open(m_dir.c_str(), O_RDONLY);
+	if(dfd >= 0){
+		::fsync(dfd);
+		::close(dfd);
+	}
+
+	// only the segments the previous snapshot covers are not needed
+	// any more, the rest is replayed after it in a fallback
+	typedef std::pair<const boost::uint64_t, std::string> seg_t;
+	BOOST_FOREACH(const seg_t& seg, list_segments(m_dir)){
+		if(seg.first < old_seq){
+			boost::system::error_code ec;
+			fs::remove(seg.second, ec);
+		}
+	}
+	DLOG(INFO)<<"journal: snapshot of "<<m_bytes<<" bytes, now at segment "<<m_log_seq;
+}
+
+journal::stats_t journal::stats(){
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_stats;
+}
@@ -0,0 +1,164 @@
+#ifndef __GPF_JOURNAL_HPP__
+#     define __GPF_JOURNAL_HPP__
+
+#include <string>
+#include <boost/utility.hpp>
+#include <boost/function.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include <gpf/messages/hub.pb.h>
+
+namespace gpf
+{
+	/**
+	 * write-ahead journal of hub state transitions.
+	 *
+	 * Entries are appended to an in-memory buffer. A writer thread
+	 * writes the buffer and fdatasync()s it. Everything that was
+	 * appended while one sync ran is committed together by the next
+	 * one (group commit), so there is no fsync per message. The hub
+	 * does not wait for commits, so a crash loses at most the last
+	 * group.
+	 *
+	 * A directory holds a snapshot and journal segments
+	 * (journal.<seq>). begin_snapshot() starts a new segment, so
+	 * recover() reads the snapshot and then only the entries logged
+	 * after it. A snapshot is a sequence of chunks, each framed like an
+	 * entry, so no single message has to hold the whole hub state.
+	 *
+	 * The previous snapshot is kept as snapshot.old together with the
+	 * segments logged since, recover() falls back to it if the latest
+	 * one is corrupt. Older segments are removed when a snapshot is
+	 * committed, so the directory holds at most two snapshot intervals.
+	 *
+	 * append() and begin_snapshot() must be called from a single
+	 * thread. The chunks of a snapshot may be written from others.
+	 */
+	class journal
+	: boost::noncopyable
+	{
+		public:
+			typedef gpf_hub::journal_entry entry_t;
+			typedef gpf_hub::hub_snapshot  snapshot_t;
+			/// called for every chunk of the snapshot
+			typedef boost::function<void (const snapshot_t&)> restore_t;
+			typedef boost::function<void (const entry_t&)>    replay_t;
+
+			/// tasks per snapshot chunk
+			static const int snapshot_chunk = 1000;
+
+			/**
+			 * a snapshot being written, see begin_snapshot().
+			 *
+			 * Chunks may be written from several threads. When the
+			 * last of the parts is done, the snapshot is synced and
+			 * replaces the previous one, which becomes snapshot.old,
+			 * and the journal segments before snapshot.old are
+			 * removed. If anything fails on the way, the previous
+			 * snapshot and the segments are kept.
+			 */
+			class snapshot_writer
+			: boost::noncopyable
+			{
+				public:
+					/// append a chunk, s.log_seq is ignored
+					void write(const snapshot_t& s);
+					/// one part is complete, the last one commits the snapshot
+					void done();
+					/// false once a chunk could not be written
+					bool ok();
+					~snapshot_writer();
+				private:
+					friend class journal;
+					snapshot_writer(const std::string& dir, int fd, boost::uint64_t log_seq, unsigned int parts);
+					void _commit();
+
+					std::string     m_dir;
+					int             m_fd;       ///< snapshot.tmp
+					boost::uint64_t m_log_seq;
+					unsigned int    m_parts;    ///< not done yet
+					bool            m_ok;
+					std::size_t     m_bytes;
+					boost::mutex    m_mutex;
+			};
+			typedef boost::shared_ptr<snapshot_writer> snapshot_writer_ptr;
+
+			struct stats_t{
+				unsigned long entries;   ///< appended
+				unsigned long commits;   ///< fdatasync()s
+				unsigned long bytes;     ///< written
+				unsigned long replayed;  ///< entries replayed by recover()
+			};
+
+			explicit journal(const std::string& dir);
+			/// commits what is left
+			~journal();
+
+			/// false if the directory could not be used
+			inline bool ok()const{ return m_fd >= 0; }
+
+			/**
+			 * load the latest snapshot and replay the entries logged after it.
+			 *
+			 * A corrupt snapshot is skipped for snapshot.old. restore
+			 * is only called if there is a usable snapshot. Call this
+			 * once, before appending.
+			 * @return the number of entries replayed
+			 */
+			std::size_t recover(const restore_t& restore, const replay_t& replay);
+
+			void append(const entry_t& e);
+			/// append an entry of type t with data, time stamped now
+			void append(entry_t::Type t, const void* data, std::size_t size);
+
+			/// wait until everything appended so far is on disk
+			void sync();
+
+			/**
+			 * start a snapshot of the state up to now.
+			 *
+			 * Switches to a new journal segment without waiting for the
+			 * writer and writes head (engines etc.; log_seq is set
+			 * here) as the first chunk. The rest of the state is
+			 * written in `parts' parts, each ending with done().
+			 *
+			 * @return null if a snapshot is still being written or the
+			 *         snapshot file could not be created
+			 */
+			snapshot_writer_ptr begin_snapshot(snapshot_t& head, unsigned int parts);
+
+			/// store s in chunks and drop the journal up to now. false if that failed.
+			bool snapshot(snapshot_t& s);
+
+			stats_t stats();
+
+		private:
+			/// -1 on errors
+			int  _open_segment(boost::uint64_t seq);
+			bool _replay_segment(const std::string& path, const replay_t& replay, std::size_t& n);
+			void _write_loop();
+
+			std::string     m_dir;
+			int             m_fd;
+			boost::uint64_t m_seq;         ///< current segment
+			int             m_old_fd;      ///< previous segment, until the writer finished it
+			std::size_t     m_switch_at;   ///< bytes of m_buffer that belong to m_old_fd
+			boost::weak_ptr<snapshot_writer> m_snapshot; ///< in progress
+
+			boost::mutex              m_mutex;
+			boost::condition_variable m_cond;        ///< data appended or stopping
+			boost::condition_variable m_synced_cond; ///< a commit finished
+			std::string     m_buffer;      ///< appended, not written yet
+			boost::uint64_t m_appended;    ///< bytes appended in total
+			boost::uint64_t m_durable;     ///< bytes synced in total
+			bool            m_stop;
+			stats_t         m_stats;
+			boost::thread   m_writer;
+	};
+}
+
+#endif /* __GPF_JOURNAL_HPP__ */
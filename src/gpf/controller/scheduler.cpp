@@ -0,0 +1,683 @@
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <glog/logging.h>
+#include <gpf/controller/scheduler.hpp>
+#include <gpf/messages/hub.pb.h>
+#include <gpf/util/time.hpp>
+
+using namespace gpf;
+
+/**********************************
+ *         engine_chooser
+ **********************************/
+
+static const char* scheme_names[] = { "leastload", "lru", "weighted", "twobin" };
+
+bool engine_chooser::parse_scheme(const std::string& name, scheme_t& s){
+	if(name == "default"){
+		s = LEAST_LOAD;
+		return true;
+	}
+	for(int i=0;i<4;i++){
+		if(name == scheme_names[i]){
+			s = (scheme_t)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* engine_chooser::scheme_name(scheme_t s){
+	return scheme_names[s];
+}
+
+engine_chooser::engine_chooser(scheme_t s)
+: m_scheme(s)
+, m_hwm(0)
+, m_seq(0)
+{
+}
+
+engine_chooser::key_t engine_chooser::_key(const slot& e)const{
+	return key_t(m_scheme == LRU ? e.used : e.outstanding, e.eid);
+}
+
+static bool ordered(engine_chooser::scheme_t s){
+	return s == engine_chooser::LEAST_LOAD || s == engine_chooser::LRU;
+}
+
+void engine_chooser::add(int eid){
+	if(has(eid))
+		return;
+	slot e;
+	e.eid         = eid;
+	e.outstanding = 0;
+	e.weight      = 1.;
+	e.used        = 0;
+	m_pos[eid] = m_engines.size();
+	m_engines.push_back(e);
+	if(ordered(m_scheme))
+		m_order.insert(_key(e));
+}
+
+void engine_chooser::remove(int eid){
+	auto it = m_pos.find(eid);
+	if(it == m_pos.end())
+		return;
+	std::size_t i = it->second;
+	if(ordered(m_scheme))
+		m_order.erase(_key(m_engines[i]));
+	m_pos.erase(it);
+	if(i != m_engines.size()-1){
+		m_engines[i] = m_engines.back();
+		m_pos[m_engines[i].eid] = i;
+	}
+	m_engines.pop_back();
+}
+
+void engine_chooser::set_weight(int eid, double w){
+	auto it = m_pos.find(eid);
+	if(it != m_pos.end())
+		m_engines[it->second].weight = std::max(0., w);
+}
+
+bool engine_chooser::can_take(int eid)const{
+	auto it = m_pos.find(eid);
+	return it != m_pos.end() && !_full(m_engines[it->second]);
+}
+
+unsigned int engine_chooser::outstanding(int eid)const{
+	auto it = m_pos.find(eid);
+	return it == m_pos.end() ? 0 : m_engines[it->second].outstanding;
+}
+
+int engine_chooser::choose(){
+	if(m_engines.empty())
+		return -1;
+	switch(m_scheme){
+		case LEAST_LOAD:
+			{
+				// the least loaded one is full only if all are
+				const slot& e = m_engines[m_pos[m_order.begin()->second]];
+				return _full(e) ? -1 : e.eid;
+			}
+		case LRU:
+			BOOST_FOREACH(const key_t& k, m_order)
+				if(!_full(m_engines[m_pos[k.second]]))
+					return k.second;
+			return -1;
+		case WEIGHTED:
+			{
+				double total = 0.;
+				BOOST_FOREACH(const slot& e, m_engines)
+					if(!_full(e))
+						total += e.weight / (1 + e.outstanding);
+				if(total <= 0.)
+					break;
+				double r = total * (m_random() / (m_random.max() + 1.));
+				BOOST_FOREACH(const slot& e, m_engines){
+					if(_full(e))
+						continue;
+					r -= e.weight / (1 + e.outstanding);
+					if(r < 0.)
+						return e.eid;
+				}
+				break;
+			}
+		case TWO_CHOICE:
+			{
+				const slot& a = m_engines[m_random() % m_engines.size()];
+				const slot& b = m_engines[m_random() % m_engines.size()];
+				const slot& e = a.outstanding <= b.outstanding ? a : b;
+				if(!_full(e))
+					return e.eid;
+				break;
+			}
+	}
+	// all weights 0, or both random picks full: take any that has room
+	BOOST_FOREACH(const slot& e, m_engines)
+		if(!_full(e) && (m_scheme != WEIGHTED || e.weight > 0.))
+			return e.eid;
+	return -1;
+}
+
+void engine_chooser::assigned(int eid){
+	auto it = m_pos.find(eid);
+	if(it == m_pos.end())
+		return;
+	slot& e = m_engines[it->second];
+	if(ordered(m_scheme))
+		m_order.erase(_key(e));
+	e.outstanding ++;
+	e.used = ++m_seq;
+	if(ordered(m_scheme))
+		m_order.insert(_key(e));
+}
+
+void engine_chooser::finished(int eid){
+	auto it = m_pos.find(eid);
+	if(it == m_pos.end())
+		return;
+	slot& e = m_engines[it->second];
+	if(e.outstanding == 0)
+		return;
+	if(ordered(m_scheme))
+		m_order.erase(_key(e));
+	e.outstanding --;
+	if(ordered(m_scheme))
+		m_order.insert(_key(e));
+}
+
+/**********************************
+ *         task_scheduler
+ **********************************/
+
+task_scheduler::task_scheduler(zmq_reactor::reactor& loop, socket_ptr client, socket_ptr engine, socket_ptr monitor,
+		engine_chooser::scheme_t scheme)
+: m_loop(loop)
+, m_client(client)
+, m_engine(engine)
+, m_monitor(monitor)
+, m_chooser(scheme)
+, m_incoming_pool(incoming_pool::instance())
+, m_seq(0)
+, m_tracker(NULL)
+, m_prefetch(0)
+, m_steals(0)
+{
+	m_loop.add(m_client, ZMQ_POLLIN, boost::bind(&task_scheduler::dispatch_submission, this, _1));
+	m_loop.add(m_engine, ZMQ_POLLIN, boost::bind(&task_scheduler::dispatch_result,     this, _1));
+}
+
+void task_scheduler::add_engine(int eid, const std::string& queue){
+	m_queues[eid]  = queue;
+	m_eids[queue]  = eid;
+	m_chooser.add(eid);
+	_drain();
+	_drain_services(eid);
+	if(m_prefetch)
+		_refill(eid);
+}
+
+void task_scheduler::remove_engine(int eid){
+	m_chooser.remove(eid);
+	auto it = m_queues.find(eid);
+	if(it == m_queues.end())
+		return;
+	m_eids.erase(it->second);
+	m_queues.erase(it);
+	m_sent.erase(eid);
+
+	// the backlog never reached the engine, it can run elsewhere
+	task_queue backlog;
+	auto b = m_backlog.find(eid);
+	if(b != m_backlog.end()){
+		m_backlog_size.erase(std::make_pair(b->second.size(), eid));
+		backlog.tasks.swap(b->second.tasks);
+		m_backlog.erase(b);
+	}
+	BOOST_FOREACH(const task_queue::map_t::value_type& v, backlog.tasks)
+		_dispatch(v.second);
+}
+
+void task_scheduler::fail(const std::vector<msg_id_t>& ids){
+	// the tasks waiting for them go ahead, as after a failed result
+	BOOST_FOREACH(const msg_id_t& id, ids)
+		_release(id, -1);
+}
+
+static std::string frame_string(zmq::message_t& m){
+	return std::string(static_cast<const char*>(m.data()), m.size());
+}
+
+void task_scheduler::dispatch_submission(zmq::socket_t& s){
+	pending_task t;
+	t.msg = m_incoming_pool.make(s);
+	t.msg->receive_all();
+	const ZmqMessage::MsgPtrVec& routing = t.msg->get_routing();
+	gpf_hub::intask header;
+	if(routing.empty() || t.msg->size() < 1 || 0!=m_header_marshal.deserialize(header, (*t.msg)[0])){
+		LOG(ERROR)<<"task_scheduler: dropping malformed submission";
+		return;
+	}
+	t.client = frame_string(*routing.back());
+	t.msg_id = header.msg_id();
+	if(header.has_service())
+		t.service = header.service();
+	t.priority = header.priority();
+	t.seq      = m_seq++;
+
+	// tell the hub, with what it cannot see on the monitor socket
+	if(!header.has_client_id())
+		header.set_client_id(t.client);
+	if(!header.has_submitted_us())
+		header.set_submitted_us(to_us(boost::posix_time::microsec_clock::universal_time()));
+	{
+		ZmqMessage::Outgoing<ZmqMessage::SimpleRouting> out(*m_monitor, 0);
+		out << t.client << "" << "intask" << m_header_marshal(header);
+		for(std::size_t i=1;i<t.msg->size();i++){
+			zmq::message_t f;
+			share_frame(t.msg, i, f);
+			out << f;
+		}
+		out << ZmqMessage::Flush;
+	}
+
+	msg_id_t id;
+	bool valid_id = parse_msg_id(t.msg_id, id);
+	if(header.has_deadline_us()){
+		t.deadline = from_us(header.deadline_us());
+		deadline_entry& e = m_deadlines[std::make_pair(t.deadline, t.seq)];
+		e.id       = id;
+		e.msg_id   = t.msg_id;
+		e.client   = t.client;
+		e.service  = t.service;
+		e.priority = t.priority;
+		e.place    = PLACE_NONE;
+		e.eid      = -1;
+		_arm_deadlines();
+	}
+
+	// every task goes into the graph, later ones may depend on it
+	if(valid_id){
+		int n_after = header.after_size();
+		std::vector<msg_id_t> deps;
+		deps.reserve(n_after + header.follow_size());
+		for(int i=0;i<n_after+header.follow_size();i++){
+			const std::string& dep = i < n_after ? header.after(i) : header.follow(i-n_after);
+			msg_id_t d;
+			if(!parse_msg_id(dep, d)){
+				LOG(ERROR)<<"task_scheduler: ignoring invalid dependency `"<<dep<<"' of "<<t.msg_id;
+				continue;
+			}
+			deps.push_back(d);
+			if(i >= n_after && !t.has_follow){
+				t.follow     = d;
+				t.has_follow = true;
+			}
+		}
+		if(!m_graph.add(id, deps)){
+			m_blocked[id] = t;
+			_place(t, PLACE_BLOCKED);
+			return;
+		}
+	}
+	_dispatch(t);
+}
+
+void task_scheduler::_dispatch(const pending_task& t){
+	if(t.has_follow){
+		int eid = m_graph.engine(t.follow);
+		if(m_chooser.has(eid)){
+			_assign(t, eid);
+			return;
+		}
+		LOG(ERROR)<<"task_scheduler: the engine that ran "<<t.follow<<" is unknown or gone, "<<t.msg_id<<" runs elsewhere";
+	}
+
+	// first come, first served
+	if(!t.service.empty()){
+		// an engine offering it may still register, so the task waits
+		auto q = m_waiting_service.find(t.service);
+		bool queued = q != m_waiting_service.end() && !q->second.empty();
+		int eid = queued ? -1 : _choose_offering(t.service);
+		if(eid < 0){
+			m_waiting_service[t.service].push(t);
+			_place(t, PLACE_WAITING);
+		}else
+			_assign(t, eid);
+		return;
+	}
+	int eid = m_waiting.empty() ? m_chooser.choose() : -1;
+	if(eid < 0){
+		m_waiting.push(t);
+		_place(t, PLACE_WAITING);
+	}else
+		_assign(t, eid);
+}
+
+int task_scheduler::_choose_offering(const std::string& service)const{
+	if(!m_tracker)
+		return -1;
+	int best = -1;
+	unsigned int best_n = 0;
+	auto r = m_tracker->offering(service);
+	for(service_index::const_iterator it=r.first; it!=r.second; ++it){
+		if(!m_chooser.can_take(it->second))
+			continue;
+		unsigned int n = m_chooser.outstanding(it->second);
+		if(best < 0 || n < best_n){
+			best   = it->second;
+			best_n = n;
+		}
+	}
+	return best;
+}
+
+void task_scheduler::_assign(const pending_task& t, int eid){
+	m_chooser.assigned(eid);
+	_track(t, eid);
+	if(m_prefetch && m_sent[eid] >= m_prefetch)
+		_push_backlog(eid, t);
+	else
+		_send(t, eid);
+}
+
+void task_scheduler::_send(const pending_task& t, int eid){
+	_forget_deadline(t);
+	if(m_prefetch)
+		m_sent[eid] ++;
+	// the engine's REP socket sees [header, payload...] and
+	// replies through the client's envelope
+	ZmqMessage::Outgoing<ZmqMessage::SimpleRouting> out(*m_engine, 0);
+	out << m_queues[eid] << t.client << "";
+	for(std::size_t i=0;i<t.msg->size();i++){
+		zmq::message_t f;
+		share_frame(t.msg, i, f);
+		out << f;
+	}
+	out << ZmqMessage::Flush;
+}
+
+void task_scheduler::_track(const pending_task& t, int eid){
+	gpf_hub::tracktask track;
+	track.set_msg_id(t.msg_id);
+	track.set_eid(eid);
+	ZmqMessage::Outgoing<ZmqMessage::SimpleRouting> out(*m_monitor, 0);
+	out << m_queues[eid] << "" << "tracktask" << m_header_marshal(track) << ZmqMessage::Flush;
+}
+
+void task_scheduler::dispatch_result(zmq::socket_t& s){
+	incoming_msg_t msg = m_incoming_pool.make(s);
+	msg->receive_all();
+	const ZmqMessage::MsgPtrVec& routing = msg->get_routing();
+	gpf_hub::outtask header;
+	// engines need not know their eid, it is filled in here
+	if(routing.size() < 2 || msg->size() < 1
+	|| !header.ParsePartialFromArray((*msg)[0].data(), (*msg)[0].size()) || !header.has_msg_id()){
+		LOG(ERROR)<<"task_scheduler: dropping malformed result";
+		return;
+	}
+	std::string queue  = frame_string(*routing.front());
+	std::string client = frame_string(*routing.back());
+	auto it = m_eids.find(queue);
+	if(it == m_eids.end())
+		LOG(ERROR)<<"task_scheduler: result from unknown engine `"<<queue<<"'";
+	else{
+		header.set_eid(it->second);
+		m_chooser.finished(it->second);
+		if(m_prefetch && m_sent[it->second] > 0)
+			m_sent[it->second] --;
+	}
+	if(!header.has_completed_us())
+		header.set_completed_us(to_us(boost::posix_time::microsec_clock::universal_time()));
+	std::string h = m_header_marshal(header);
+
+	{
+		ZmqMessage::Outgoing<ZmqMessage::SimpleRouting> out(*m_monitor, 0);
+		out << queue << "" << "outtask" << h;
+		for(std::size_t i=1;i<msg->size();i++){
+			zmq::message_t f;
+			share_frame(msg, i, f);
+			out << f;
+		}
+		out << ZmqMessage::Flush;
+	}
+	{
+		ZmqMessage::Outgoing<ZmqMessage::SimpleRouting> out(*m_client, 0);
+		out << client << "" << h;
+		for(std::size_t i=1;i<msg->size();i++){
+			zmq::message_t f;
+			share_frame(msg, i, f);
+			out << f;
+		}
+		out << ZmqMessage::Flush;
+	}
+
+	// tasks waiting for this one
+	msg_id_t id;
+	if(parse_msg_id(header.msg_id(), id))
+		_release(id, it == m_eids.end() ? -1 : it->second);
+
+	if(it == m_eids.end()){
+		_drain();
+		return;
+	}
+	int eid = it->second;
+	if(m_prefetch)
+		_refill(eid);
+	_drain();
+	_drain_services(eid);
+}
+
+void task_scheduler::_drain(){
+	while(!m_waiting.empty()){
+		int eid = m_chooser.choose();
+		if(eid < 0)
+			break;
+		_assign(m_waiting.front(), eid);
+		m_waiting.pop_front();
+	}
+}
+
+void task_scheduler::_drain_services(int eid){
+	// only the queues of the services eid offers can move
+	if(!m_tracker || m_waiting_service.empty())
+		return;
+	auto& index = m_tracker->engines.get<engine_id_t>();
+	auto e = index.find(eid);
+	if(e == index.end())
+		return;
+	BOOST_FOREACH(const std::string& service, e->services){
+		auto q = m_waiting_service.find(service);
+		if(q == m_waiting_service.end())
+			continue;
+		while(!q->second.empty()){
+			int chosen = _choose_offering(service);
+			if(chosen < 0)
+				break;
+			_assign(q->second.front(), chosen);
+			q->second.pop_front();
+		}
+		if(q->second.empty())
+			m_waiting_service.erase(q);
+	}
+}
+
+std::size_t task_scheduler::waiting()const{
+	std::size_t n = m_waiting.size();
+	typedef std::map<std::string, task_queue>::value_type queue_t;
+	BOOST_FOREACH(const queue_t& q, m_waiting_service)
+		n += q.second.size();
+	return n;
+}
+
+void task_scheduler::_push_backlog(int eid, const pending_task& t){
+	task_queue& q = m_backlog[eid];
+	m_backlog_size.erase(std::make_pair(q.size(), eid));
+	q.push(t);
+	m_backlog_size.insert(std::make_pair(q.size(), eid));
+	_place(t, PLACE_BACKLOG, eid);
+}
+
+bool task_scheduler::_pop_backlog(int eid, pending_task& t){
+	auto it = m_backlog.find(eid);
+	if(it == m_backlog.end())
+		return false;
+	_take_backlog(eid, it->second.tasks.begin(), t);
+	return true;
+}
+
+void task_scheduler::_take_backlog(int eid, task_queue::map_t::iterator pos, pending_task& t){
+	auto it = m_backlog.find(eid);
+	task_queue& q = it->second;
+	m_backlog_size.erase(std::make_pair(q.size(), eid));
+	t = pos->second;
+	q.tasks.erase(pos);
+	if(q.empty())
+		m_backlog.erase(it);
+	else
+		m_backlog_size.insert(std::make_pair(q.size(), eid));
+}
+
+void task_scheduler::_refill(int eid){
+	while(m_chooser.has(eid) && m_sent[eid] < m_prefetch){
+		pending_task t;
+		if(_pop_backlog(eid, t))
+			_send(t, eid);
+		else if(!_steal(eid))
+			break;
+	}
+}
+
+bool task_scheduler::_can_steal(const pending_task& t, int thief)const{
+	if(t.has_follow)
+		return false; // runs where the task it follows ran
+	return t.service.empty()
+		|| (m_tracker && m_tracker->services.count(std::make_pair(t.service, thief)));
+}
+
+bool task_scheduler::_steal(int thief){
+	// from the longest backlog, at the end its owner gets to last. Where
+	// the thief can take none of a backlog, the next longest is tried.
+	int victim = -1;
+	task_queue::map_t::iterator pos;
+	for(auto b = m_backlog_size.rbegin(); victim < 0 && b != m_backlog_size.rend(); ++b){
+		if(b->second == thief)
+			continue;
+		task_queue::map_t& q = m_backlog[b->second].tasks;
+		for(auto it = q.rbegin(); it != q.rend(); ++it){
+			if(_can_steal(it->second, thief)){
+				victim = b->second;
+				pos    = --it.base();
+				break;
+			}
+		}
+	}
+	if(victim < 0)
+		return false;
+	pending_task t;
+	_take_backlog(victim, pos, t);
+	m_chooser.finished(victim);
+	m_chooser.assigned(thief);
+	m_steals ++;
+	_track(t, thief);
+	_send(t, thief);
+	return true;
+}
+
+void task_scheduler::_place(const pending_task& t, place_t place, int eid){
+	if(t.deadline.is_special())
+		return;
+	auto it = m_deadlines.find(std::make_pair(t.deadline, t.seq));
+	if(it == m_deadlines.end())
+		return;
+	it->second.place = place;
+	it->second.eid   = eid;
+}
+
+void task_scheduler::_forget_deadline(const pending_task& t){
+	if(!t.deadline.is_special())
+		m_deadlines.erase(std::make_pair(t.deadline, t.seq));
+}
+
+void task_scheduler::_arm_deadlines(){
+	// one timer, at the first deadline. It is replaced when an earlier
+	// one comes, and looks at most a second ahead, so that replaced
+	// timers do not pile up in the reactor.
+	if(m_deadlines.empty())
+		return;
+	boost::posix_time::ptime first = m_deadlines.begin()->first.first;
+	if(m_deadline_timer){
+		if(m_deadline_timer->m_deadline <= first)
+			return;
+		m_deadline_timer->set_inactive();
+	}
+	boost::posix_time::ptime latest = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(1);
+	m_deadline_timer.reset(new deadline_timer(std::min(first, latest),
+				boost::bind(&task_scheduler::_expire_due, this, _1)));
+	m_loop.add(m_deadline_timer);
+}
+
+void task_scheduler::_expire_due(zmq_reactor::reactor*){
+	m_deadline_timer.reset();
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	while(!m_deadlines.empty() && m_deadlines.begin()->first.first <= now){
+		boost::uint64_t seq = m_deadlines.begin()->first.second;
+		deadline_entry  e   = m_deadlines.begin()->second;
+		m_deadlines.erase(m_deadlines.begin());
+		_expire(seq, e);
+	}
+	_arm_deadlines();
+}
+
+void task_scheduler::_expire(boost::uint64_t seq, const deadline_entry& e){
+	// the task was not sent, take it out of where it waits
+	switch(e.place){
+		case PLACE_BLOCKED:
+			m_blocked.erase(e.id);
+			break;
+		case PLACE_WAITING:
+			if(e.service.empty())
+				m_waiting.erase(e.priority, seq);
+			else{
+				auto q = m_waiting_service.find(e.service);
+				if(q != m_waiting_service.end() && q->second.erase(e.priority, seq) && q->second.empty())
+					m_waiting_service.erase(q);
+			}
+			break;
+		case PLACE_BACKLOG:
+			{
+				auto b = m_backlog.find(e.eid);
+				if(b == m_backlog.end())
+					break;
+				auto pos = b->second.tasks.find(std::make_pair(e.priority, seq));
+				if(pos == b->second.tasks.end())
+					break;
+				pending_task t;
+				_take_backlog(e.eid, pos, t);
+				m_chooser.finished(e.eid);
+			}
+			break;
+		case PLACE_NONE:
+			break;
+	}
+	LOG(INFO)<<"task_scheduler: task "<<e.msg_id<<" missed its deadline";
+
+	gpf_hub::outtask header;
+	header.set_msg_id(e.msg_id);
+	header.set_eid(-1);
+	header.set_completed_us(to_us(boost::posix_time::microsec_clock::universal_time()));
+	header.set_error("deadline expired");
+	std::string h = m_header_marshal(header);
+	{
+		ZmqMessage::Outgoing<ZmqMessage::SimpleRouting> out(*m_monitor, 0);
+		out << e.client << "" << "outtask" << h << ZmqMessage::Flush;
+	}{
+		ZmqMessage::Outgoing<ZmqMessage::SimpleRouting> out(*m_client, 0);
+		out << e.client << "" << h << ZmqMessage::Flush;
+	}
+
+	// a failed task does not hold up the tasks waiting for it
+	_release(e.id, -1);
+	if(e.place == PLACE_BACKLOG){
+		// its engine has room for another task
+		_drain();
+		_drain_services(e.eid);
+	}
+}
+
+void task_scheduler::_release(const msg_id_t& id, int eid){
+	std::vector<msg_id_t> ready;
+	m_graph.completed(id, eid, ready);
+	BOOST_FOREACH(const msg_id_t& r, ready){
+		auto b = m_blocked.find(r);
+		if(b == m_blocked.end())
+			continue;
+		pending_task t = b->second;
+		m_blocked.erase(b);
+		_dispatch(t);
+	}
+}
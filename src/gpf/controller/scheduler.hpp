@@ -0,0 +1,264 @@
+#ifndef __GPF_SCHEDULER_HPP__
+#     define __GPF_SCHEDULER_HPP__
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <boost/utility.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <zmq.hpp>
+#include <zmq-poll-wrapper/reactor.hpp>
+#include <zmq-poll-wrapper/timer.hpp>
+#include <gpf/util/incoming_pool.hpp>
+#include <gpf/serialization.hpp>
+#include <gpf/serialization/protobuf.hpp>
+#include <gpf/controller/engine_set.hpp>
+#include <gpf/controller/dag.hpp>
+
+namespace gpf
+{
+	/**
+	 * picks the engine for the next task.
+	 *
+	 * Engines are numbered by eid. The chooser only knows how many
+	 * tasks each engine has outstanding (assigned, no result yet) and
+	 * an optional weight, see scheme_t for how it uses them.
+	 */
+	class engine_chooser
+	{
+		public:
+			enum scheme_t{
+				LEAST_LOAD, ///< fewest outstanding tasks, O(log engines)
+				LRU,        ///< assigned to least recently, O(log engines)
+				WEIGHTED,   ///< random, by weight/(1+outstanding), O(engines)
+				TWO_CHOICE  ///< the less loaded of two random engines, O(1)
+			};
+			/// "leastload", "lru", "weighted", "twobin"; "default" is leastload
+			static bool parse_scheme(const std::string& name, scheme_t& s);
+			static const char* scheme_name(scheme_t s);
+
+			explicit engine_chooser(scheme_t s=LEAST_LOAD);
+
+			inline scheme_t scheme()const{ return m_scheme; }
+			/// max. outstanding tasks per engine, 0 (default): unlimited
+			inline void set_hwm(unsigned int hwm){ m_hwm = hwm; }
+			inline void seed(boost::uint32_t s){ m_random.seed(s); }
+
+			void add(int eid);
+			void remove(int eid);
+			inline bool has(int eid)const{ return m_pos.count(eid) > 0; }
+			inline std::size_t size()const{ return m_engines.size(); }
+
+			/// eid is known and below the hwm
+			bool can_take(int eid)const;
+
+			/// relative speed of eid for WEIGHTED (default 1)
+			void set_weight(int eid, double w);
+			unsigned int outstanding(int eid)const;
+
+			/// the engine for the next task, -1 if none can take one
+			int choose();
+			/// eid got a task / returned a result
+			void assigned(int eid);
+			void finished(int eid);
+
+		private:
+			struct slot{
+				int             eid;
+				unsigned int    outstanding;
+				double          weight;
+				boost::uint64_t used;    ///< assignment sequence number, for LRU
+			};
+			typedef std::pair<boost::uint64_t, int> key_t;
+
+			key_t _key(const slot& e)const;
+			inline bool _full(const slot& e)const{ return m_hwm && e.outstanding >= m_hwm; }
+
+			scheme_t                         m_scheme;
+			unsigned int                     m_hwm;
+			boost::uint64_t                  m_seq;
+			std::vector<slot>                m_engines;
+			boost::unordered_map<int, std::size_t> m_pos;   ///< eid -> index in m_engines
+			std::set<key_t>                  m_order;       ///< LEAST_LOAD: (outstanding, eid), LRU: (used, eid)
+			boost::mt19937                   m_random;
+	};
+
+	/**
+	 * routes tasks from clients to engines.
+	 *
+	 * Clients send [header, payload...] (header: gpf_hub::intask) to
+	 * the client socket, engines get it on the engine socket with the
+	 * client's envelope and reply [header, payload...] (header:
+	 * gpf_hub::outtask), which goes back to the client. Submission,
+	 * assignment and result are published on the monitor socket as
+	 * intask, tracktask and outtask, which is how the hub sees them.
+	 *
+	 * Tasks wait in a queue while no engine can take them. The engines
+	 * are those registered at the hub, see add_engine().
+	 *
+	 * A task whose header names a service goes to the engine with the
+	 * fewest outstanding tasks among those offering it, whatever the
+	 * scheme. It waits in a queue of that service until one can take it.
+	 *
+	 * With work stealing (see set_prefetch()) an engine is sent only
+	 * `prefetch' tasks at a time, the rest of the tasks assigned to it
+	 * wait in its backlog here. An engine that has room and an empty
+	 * backlog takes the newest task of the longest backlog that it may
+	 * run, which is published as another tracktask. `follow' tasks are
+	 * not taken, and tasks of a service only by engines offering it.
+	 *
+	 * A task with `after' or `follow' dependencies is held back until
+	 * the results of those tasks came through here, see
+	 * dependency_graph. `follow' tasks then go to the engine that ran
+	 * the first task of the list, if it is still there.
+	 *
+	 * Wherever tasks wait here, those of higher `priority' go first,
+	 * FIFO among equals. A task not sent to an engine by its
+	 * `deadline_us' is failed: the client and the hub get an outtask
+	 * with `error' set, and it is taken out of wherever it waits. The
+	 * deadlines are kept in order here and share a single reactor
+	 * timer. Priorities only matter if tasks do wait here, i.e. with an
+	 * hwm (engine_chooser::set_hwm()) or prefetch.
+	 */
+	class task_scheduler
+	: boost::noncopyable
+	{
+		public:
+			typedef boost::shared_ptr<zmq::socket_t> socket_ptr;
+
+			/**
+			 * @param client  ROUTER, clients connect here
+			 * @param engine  ROUTER, engine queues connect here
+			 * @param monitor PUB, connected to the hub's monitor socket
+			 */
+			task_scheduler(zmq_reactor::reactor& loop, socket_ptr client, socket_ptr engine, socket_ptr monitor,
+					engine_chooser::scheme_t scheme);
+
+			/// an engine registered, queue is the identity of its task socket
+			void add_engine(int eid, const std::string& queue);
+			/// an engine is gone. The hub fails its outstanding tasks.
+			void remove_engine(int eid);
+			/// these tasks failed without a result passing here (their engine died)
+			void fail(const std::vector<msg_id_t>& ids);
+
+			/**
+			 * steal work between engines, sending each at most n tasks.
+			 *
+			 * 0 (default) sends tasks to their engine at once. Set before
+			 * traffic arrives.
+			 */
+			inline void set_prefetch(unsigned int n){ m_prefetch = n; }
+			/// tasks run by another engine than they were assigned to
+			inline unsigned long steals()const{ return m_steals; }
+
+			/// where the services of the engines are looked up
+			inline void set_engine_tracker(const engine_tracker* t){ m_tracker = t; }
+
+			inline engine_chooser&       chooser(){ return m_chooser; }
+			inline const dependency_graph& dependencies()const{ return m_graph; }
+			std::size_t waiting()const;
+
+			void dispatch_submission(zmq::socket_t&);
+			void dispatch_result(zmq::socket_t&);
+
+		private:
+			struct pending_task{
+				incoming_msg_t msg;    ///< [header, payload...]
+				std::string    msg_id;
+				std::string    client; ///< socket identity
+				std::string    service;
+				msg_id_t       follow;     ///< run where this ran, if has_follow
+				bool           has_follow;
+				int            priority;
+				boost::uint64_t seq;       ///< submission order
+				boost::posix_time::ptime deadline; ///< not_a_date_time if none
+				pending_task():has_follow(false),priority(0),seq(0){}
+			};
+			/// higher priority first, then lower seq
+			struct queue_order{
+				inline bool operator()(const std::pair<int, boost::uint64_t>& a, const std::pair<int, boost::uint64_t>& b)const{
+					return a.first > b.first || (a.first == b.first && a.second < b.second);
+				}
+			};
+			/// waiting tasks, front() goes first
+			struct task_queue{
+				typedef std::map<std::pair<int, boost::uint64_t>, pending_task, queue_order> map_t;
+				map_t tasks;
+				inline bool        empty()const{ return tasks.empty(); }
+				inline std::size_t size()const{ return tasks.size(); }
+				inline void        push(const pending_task& t){ tasks.insert(std::make_pair(std::make_pair(t.priority, t.seq), t)); }
+				inline const pending_task& front()const{ return tasks.begin()->second; }
+				inline void        pop_front(){ tasks.erase(tasks.begin()); }
+				inline bool        erase(int priority, boost::uint64_t seq){ return tasks.erase(std::make_pair(priority, seq)) > 0; }
+			};
+
+			/// where a task with a deadline waits
+			enum place_t{ PLACE_NONE, PLACE_BLOCKED, PLACE_WAITING, PLACE_BACKLOG };
+			struct deadline_entry{
+				msg_id_t    id;
+				std::string msg_id;
+				std::string client;
+				std::string service;  ///< PLACE_WAITING: in the queue of this service, or m_waiting
+				int         priority;
+				place_t     place;
+				int         eid;      ///< PLACE_BACKLOG: whose
+			};
+			/// by (deadline, seq)
+			typedef std::map<std::pair<boost::posix_time::ptime, boost::uint64_t>, deadline_entry> deadline_map;
+
+			void _place(const pending_task& t, place_t place, int eid=-1);
+			void _forget_deadline(const pending_task& t);
+			void _arm_deadlines();
+			void _expire_due(zmq_reactor::reactor*);
+			void _expire(boost::uint64_t seq, const deadline_entry& e);
+			void _dispatch(const pending_task& t);
+			void _release(const msg_id_t& id, int eid);
+			void _assign(const pending_task& t, int eid);
+			void _send(const pending_task& t, int eid);
+			void _track(const pending_task& t, int eid);
+			int  _choose_offering(const std::string& service)const;
+			void _drain();
+			void _drain_services(int eid);
+			void _push_backlog(int eid, const pending_task& t);
+			bool _pop_backlog(int eid, pending_task& t);
+			void _take_backlog(int eid, task_queue::map_t::iterator pos, pending_task& t);
+			void _refill(int eid);
+			bool _can_steal(const pending_task& t, int thief)const;
+			bool _steal(int thief);
+
+			zmq_reactor::reactor&                   m_loop;
+			socket_ptr                              m_client;
+			socket_ptr                              m_engine;
+			socket_ptr                              m_monitor;
+			engine_chooser                          m_chooser;
+			incoming_pool&                          m_incoming_pool;
+			boost::unordered_map<int, std::string>  m_queues;   ///< eid -> socket identity
+			boost::unordered_map<std::string, int>  m_eids;     ///< socket identity -> eid
+			boost::uint64_t                         m_seq;
+			task_queue                              m_waiting;  ///< tasks no engine took yet
+			std::map<std::string, task_queue>       m_waiting_service; ///< the same, by service
+			const engine_tracker*                   m_tracker;
+
+			// dependencies
+			dependency_graph                                  m_graph;
+			boost::unordered_map<msg_id_t, pending_task>      m_blocked; ///< tasks waiting for others
+
+			// work stealing
+			unsigned int                                m_prefetch;
+			unsigned long                               m_steals;
+			boost::unordered_map<int, unsigned int>     m_sent;          ///< tasks sent, no result yet
+			boost::unordered_map<int, task_queue>       m_backlog;       ///< tasks assigned, not sent
+			std::set<std::pair<std::size_t, int> >      m_backlog_size;  ///< (size, eid) of nonempty backlogs
+
+			// deadlines of the tasks that wait here
+			deadline_map                       m_deadlines;
+			boost::shared_ptr<deadline_timer>  m_deadline_timer;  ///< fires at the first deadline, at the latest
+			serialization::serializer<serialization::protobuf_archive> m_header_marshal;
+	};
+}
+
+#endif /* __GPF_SCHEDULER_HPP__ */
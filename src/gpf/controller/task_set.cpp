@@ -0,0 +1,814 @@
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <time.h>
+#include <boost/foreach.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <glog/logging.h>
+#include <gpf/controller/task_set.hpp>
+#include <gpf/util/time.hpp>
+
+using namespace gpf;
+
+int client_table::intern(const std::string& identity){
+	if(identity.empty())
+		return -1;
+	boost::mutex::scoped_lock lock(m_mutex);
+	auto it = m_ids.find(identity);
+	if(it != m_ids.end())
+		return it->second;
+	int id = m_identities.size();
+	m_identities.push_back(identity);
+	m_ids[identity] = id;
+	return id;
+}
+
+int client_table::find(const std::string& identity)const{
+	boost::mutex::scoped_lock lock(m_mutex);
+	auto it = m_ids.find(identity);
+	return it == m_ids.end() ? -1 : it->second;
+}
+
+std::string client_table::identity(int id)const{
+	boost::mutex::scoped_lock lock(m_mutex);
+	if(id < 0 || id >= (int)m_identities.size())
+		return std::string();
+	return m_identities[id];
+}
+
+std::size_t client_table::size()const{
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_identities.size();
+}
+
+task_tracker::task_tracker()
+: m_db(NULL)
+, m_replaying(false)
+, m_clients(NULL)
+, m_lru_seq(0)
+, m_arrival(0)
+, m_retained(0)
+, m_retained_bytes(0)
+{
+	std::fill(m_count, m_count+TASK_NUM_STATES, 0);
+}
+
+static std::size_t message_bytes(const incoming_msg_t& msg){
+	if(!msg)
+		return 0;
+	std::size_t n = 0;
+	for(std::size_t i=0;i<msg->size();i++)
+		n += (*msg)[i].size();
+	return n;
+}
+
+static boost::uint32_t payload_bytes(const task& t){
+	std::size_t n = message_bytes(t.incoming_msg) + message_bytes(t.outgoing_msg)
+		+ t.content.size() + t.result_content.size() + t.packed.size();
+	return std::min(n, (std::size_t)0xffffffffu);
+}
+
+void task_tracker::_insert(const task& t){
+	if(tasks.insert(t).second){
+		m_count[t.state] ++;
+		m_by_completed.insert(completed_key()(t));
+		_count_engine(t, 1);
+	}
+	else
+		LOG(ERROR)<<"task_tracker: duplicate message ID "<<t.id;
+}
+
+void task_tracker::_set_state(const task& t, task_state s){
+	m_count[t.state] --;
+	m_count[s]       ++;
+	_count_engine(t, -1);
+	t.state = s;
+	_count_engine(t, 1);
+}
+
+void task_tracker::_count_engine(const task& t, int delta){
+	if(t.engine_uuid < 0)
+		return;
+	engine_tasks& e = m_engines[t.engine_uuid];
+	if(t.state == TASK_COMPLETED)
+		e.counts.completed += delta;
+	else{
+		if(strcmp(t.queue, "mux") == 0)
+			e.counts.queue += delta;
+		else
+			e.counts.tasks += delta;
+		if(delta > 0)
+			e.pending.insert(t.id);
+		else
+			e.pending.erase(t.id);
+	}
+	if(!e.counts.queue && !e.counts.tasks && !e.counts.completed)
+		m_engines.erase(t.engine_uuid);
+}
+
+#ifndef GPF_HASHED_TASK_INDEX
+namespace{
+	struct set_engine_uuid{
+		int eid;
+		explicit set_engine_uuid(int e):eid(e){}
+		void operator()(task& t)const{ t.engine_uuid = eid; }
+	};
+}
+#endif
+
+template<class Iterator>
+void task_tracker::_set_engine(Iterator it, int eid){
+	// engine_uuid is a key of tasks. The index is non-unique, so
+	// reindexing cannot fail.
+	_count_engine(*it, -1);
+#ifdef GPF_HASHED_TASK_INDEX
+	// modify() on the hashed_non_unique engine index takes time linear
+	// in the tasks of the engine, which makes reassigning them quadratic
+	// (see bench_task_set). replace() does not.
+	task t = *it;
+	t.engine_uuid = eid;
+	tasks.get<task_id_t>().replace(it, t);
+#else
+	// reindexes in place, without copying the task
+	tasks.get<task_id_t>().modify(it, set_engine_uuid(eid));
+#endif
+	_count_engine(*it, 1);
+}
+
+engine_task_counts task_tracker::engine_counts(int eid)const{
+	auto it = m_engines.find(eid);
+	return it == m_engines.end() ? engine_task_counts() : it->second.counts;
+}
+
+const std::set<msg_id_t>& task_tracker::engine_pending(int eid)const{
+	static const std::set<msg_id_t> none;
+	auto it = m_engines.find(eid);
+	return it == m_engines.end() ? none : it->second.pending;
+}
+
+static double decay(const boost::posix_time::ptime& from, const boost::posix_time::ptime& to){
+	if(from.is_special() || to <= from)
+		return 1.;
+	return exp(-(to - from).total_microseconds()*1e-6 / engine_load_tau);
+}
+
+void engine_load::add(const boost::posix_time::ptime& when, double service){
+	// results may arrive out of order, those count as if they came now
+	boost::posix_time::ptime t = last.is_special() || when > last ? when : last;
+	double d = decay(last, t);
+	rate = rate*d + 1./engine_load_tau;
+	last = t;
+	if(service < 0.){
+		service_weight *= d;
+		return;
+	}
+	service_weight = service_weight*d + 1.;
+	service_secs  += (service - service_secs) / service_weight;
+}
+
+double engine_load::rate_at(const boost::posix_time::ptime& now)const{
+	return rate * decay(last, now);
+}
+
+void engine_load::merge(const engine_load& o){
+	if(o.last.is_special())
+		return;
+	boost::posix_time::ptime t = last.is_special() || o.last > last ? o.last : last;
+	double w  = service_weight   * decay(last, t);
+	double wo = o.service_weight * decay(o.last, t);
+	rate = rate*decay(last, t) + o.rate*decay(o.last, t);
+	if(w + wo > 0.)
+		service_secs = (service_secs*w + o.service_secs*wo) / (w + wo);
+	service_weight = w + wo;
+	last = t;
+}
+
+void task_tracker::_count_load(const task& t){
+	// a result arrived for the first time
+	if(t.engine_uuid < 0 || t.completed.is_special())
+		return;
+	double service = -1.;
+	if(!t.started.is_special() && t.started <= t.completed)
+		service = (t.completed - t.started).total_microseconds()*1e-6;
+	m_load[t.engine_uuid].add(t.completed, service);
+}
+
+engine_load task_tracker::load(int eid)const{
+	auto it = m_load.find(eid);
+	return it == m_load.end() ? engine_load() : it->second;
+}
+
+void task_tracker::_forget(const task& t){
+	m_count[t.state] --;
+	_count_engine(t, -1);
+	m_by_completed.erase(completed_key()(t));
+	if(t.lru_seq){
+		m_retained --;
+		m_retained_bytes -= t.payload_bytes;
+	}
+}
+
+void task_tracker::_use(const task& t, const boost::posix_time::ptime& when){
+	if(++m_lru_seq == 0)
+		++m_lru_seq;
+	t.lru_seq = m_lru_seq;
+	if(m_retention.unlimited())
+		return;
+	m_lru.push_back(lru_entry(t.id, t.lru_seq, when));
+	// every touch leaves a stale entry behind, evict() only drops those
+	// it meets at the front
+	if(m_lru.size() > 2*m_retained + 64)
+		_compact_lru();
+}
+
+void task_tracker::_compact_lru(){
+	auto& index = tasks.get<task_id_t>();
+	std::deque<lru_entry> live;
+	BOOST_FOREACH(const lru_entry& e, m_lru){
+		auto it = index.find(e.id);
+		if(it != index.end() && it->lru_seq == e.seq)
+			live.push_back(e);
+	}
+	m_lru.swap(live);
+}
+
+void task_tracker::_retain(const task& t, bool store){
+	// (re-)count a completed task's payload, called whenever it changes
+	if(t.lru_seq)
+		m_retained_bytes -= t.payload_bytes;
+	else
+		m_retained ++;
+	if(m_db && store && !m_replaying){
+		task_db::record_t r;
+		record(t, r);
+		m_db->insert(t.id, r);
+	}
+	if(m_retention.compress_bytes && payload_bytes(t) > m_retention.compress_bytes)
+		_pack(t);
+	t.payload_bytes   = payload_bytes(t);
+	m_retained_bytes += t.payload_bytes;
+	_use(t, boost::posix_time::microsec_clock::universal_time());
+}
+
+static void add_frames(const incoming_msg_t& msg, google::protobuf::RepeatedPtrField<std::string>* out){
+	// frame 0 is the topic, 1 the header
+	if(!msg)
+		return;
+	for(std::size_t i=2;i<msg->size();i++){
+		zmq::message_t& m = (*msg)[i];
+		out->Add()->assign(static_cast<const char*>(m.data()), m.size());
+	}
+}
+
+static void set_us(const boost::posix_time::ptime& t, task_db::record_t& r, void (task_db::record_t::*setter)(boost::int64_t)){
+	if(!t.is_special())
+		(r.*setter)(to_us(t));
+}
+
+/// frames 2.. of msg, replacing out
+static void copy_frames(const incoming_msg_t& msg, std::vector<std::string>& out){
+	out.clear();
+	for(std::size_t i=2;i<msg->size();i++){
+		zmq::message_t& m = (*msg)[i];
+		out.push_back(std::string(static_cast<const char*>(m.data()), m.size()));
+	}
+}
+
+/// add the parts of t's payload that are not packed (yet) to p
+static void merge_unpacked(const task& t, task_payload& p){
+	if(!t.content.empty())
+		p.content = t.content;
+	if(!t.result_content.empty())
+		p.result_content = t.result_content;
+	if(t.incoming_msg)
+		copy_frames(t.incoming_msg, p.buffers);
+	if(t.outgoing_msg)
+		copy_frames(t.outgoing_msg, p.result_buffers);
+}
+
+void gpf::to_metadata(const task& t, task_db::record_t& r){
+	r.set_msg_id(to_string(t.id));
+	r.set_client_uuid("");
+	r.set_eid(t.engine_uuid);
+	r.mutable_headers();
+	r.set_content("");
+	r.set_submitted("");
+	set_us(t.submitted,   r, &task_db::record_t::set_submitted_us);
+	set_us(t.started,     r, &task_db::record_t::set_started_us);
+	set_us(t.completed,   r, &task_db::record_t::set_completed_us);
+	set_us(t.resubmitted, r, &task_db::record_t::set_resubmitted_us);
+	r.set_state(t.state);
+	r.set_queue(t.queue);
+	r.set_arrival(t.arrival);
+}
+
+void gpf::to_record(const task& t, task_db::record_t& r, bool with_frames){
+	to_metadata(t, r);
+	if(!t.packed.empty()){
+		task_payload p;
+		if(!unpack_payload(t.packed, p))
+			LOG(ERROR)<<"to_record: corrupt payload of "<<t.id;
+		merge_unpacked(t, p);
+		r.set_content(p.content);
+		r.set_result_content(p.result_content);
+		if(with_frames){
+			BOOST_FOREACH(const std::string& b, p.buffers)
+				r.add_buffers(b);
+			BOOST_FOREACH(const std::string& b, p.result_buffers)
+				r.add_result_buffers(b);
+		}
+		return;
+	}
+	r.set_content(t.content);
+	r.set_result_content(t.result_content);
+	if(!with_frames)
+		return;
+	add_frames(t.incoming_msg, r.mutable_buffers());
+	add_frames(t.outgoing_msg, r.mutable_result_buffers());
+}
+
+void task_tracker::record(const task& t, task_db::record_t& r, bool with_frames)const{
+	to_record(t, r, with_frames);
+	if(m_clients && t.client_uuid >= 0)
+		r.set_client_uuid(m_clients->identity(t.client_uuid));
+}
+
+void task_tracker::metadata(const task& t, task_db::record_t& r)const{
+	to_metadata(t, r);
+	if(m_clients && t.client_uuid >= 0)
+		r.set_client_uuid(m_clients->identity(t.client_uuid));
+}
+
+int task_tracker::_client(bool has, const std::string& identity){
+	return has && m_clients ? m_clients->intern(identity) : -1;
+}
+
+static boost::posix_time::ptime get_us(bool has, boost::int64_t us){
+	return has ? from_us(us) : boost::posix_time::ptime();
+}
+
+void task_tracker::_drop_payload(const task& t){
+	m_retained --;
+	m_retained_bytes -= t.payload_bytes;
+	t.lru_seq       = 0;
+	t.payload_bytes = 0;
+	t.incoming_msg.reset();
+	t.outgoing_msg.reset();
+	std::string().swap(t.content);
+	std::string().swap(t.result_content);
+	std::string().swap(t.packed);
+}
+
+/**********************************
+ *         compression
+ **********************************/
+
+static double thread_cpu_secs(){
+	timespec ts;
+	if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+		return 0.;
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void put_string(std::ostream& os, const std::string& s){
+	boost::uint32_t n = s.size();
+	os.write(reinterpret_cast<const char*>(&n), sizeof(n));
+	os.write(s.data(), n);
+}
+
+static void put_strings(std::ostream& os, const std::vector<std::string>& v){
+	boost::uint32_t n = v.size();
+	os.write(reinterpret_cast<const char*>(&n), sizeof(n));
+	BOOST_FOREACH(const std::string& s, v)
+		put_string(os, s);
+}
+
+static bool get_string(std::istream& is, std::string& s){
+	boost::uint32_t n;
+	if(!is.read(reinterpret_cast<char*>(&n), sizeof(n)))
+		return false;
+	s.resize(n);
+	return n == 0 || is.read(&s[0], n);
+}
+
+static bool get_strings(std::istream& is, std::vector<std::string>& v){
+	boost::uint32_t n;
+	if(!is.read(reinterpret_cast<char*>(&n), sizeof(n)))
+		return false;
+	v.resize(n);
+	for(boost::uint32_t i=0;i<n;i++)
+		if(!get_string(is, v[i]))
+			return false;
+	return true;
+}
+
+static std::size_t payload_size(const task_payload& p){
+	std::size_t n = p.content.size() + p.result_content.size();
+	BOOST_FOREACH(const std::string& s, p.buffers)
+		n += s.size();
+	BOOST_FOREACH(const std::string& s, p.result_buffers)
+		n += s.size();
+	return n;
+}
+
+void gpf::pack_payload(const task_payload& p, std::string& packed, int level){
+	namespace io = boost::iostreams;
+	packed.clear();
+	io::filtering_ostream os;
+	os.push(io::zlib_compressor(io::zlib_params(level)));
+	os.push(io::back_inserter(packed));
+	put_string (os, p.content);
+	put_string (os, p.result_content);
+	put_strings(os, p.buffers);
+	put_strings(os, p.result_buffers);
+	os.reset(); // flushes the compressor
+}
+
+bool gpf::unpack_payload(const std::string& packed, task_payload& p){
+	namespace io = boost::iostreams;
+	try{
+		io::filtering_istream is;
+		is.push(io::zlib_decompressor());
+		is.push(io::array_source(packed.data(), packed.size()));
+		return get_string (is, p.content)
+			&& get_string (is, p.result_content)
+			&& get_strings(is, p.buffers)
+			&& get_strings(is, p.result_buffers);
+	}catch(const io::zlib_error&){
+		return false;
+	}
+}
+
+compression_stats& compression_stats::operator+=(const compression_stats& o){
+	packed          += o.packed;
+	skipped         += o.skipped;
+	unpacked        += o.unpacked;
+	raw_bytes       += o.raw_bytes;
+	packed_bytes    += o.packed_bytes;
+	pack_cpu_secs   += o.pack_cpu_secs;
+	unpack_cpu_secs += o.unpack_cpu_secs;
+	return *this;
+}
+
+void task_tracker::_pack(const task& t){
+	double start = thread_cpu_secs();
+	task_payload p;
+	if(!t.packed.empty() && !unpack_payload(t.packed, p)){
+		LOG(ERROR)<<"task_tracker: corrupt payload of "<<t.id;
+		return;
+	}
+	merge_unpacked(t, p); // what arrived since it was packed
+	std::string packed;
+	pack_payload(p, packed, m_retention.compress_level);
+	m_compression.pack_cpu_secs += thread_cpu_secs() - start;
+
+	std::size_t raw = payload_size(p);
+	if(packed.size() >= raw){
+		m_compression.skipped ++;
+		return;
+	}
+	m_compression.packed ++;
+	m_compression.raw_bytes    += raw;
+	m_compression.packed_bytes += packed.size();
+	t.packed.swap(packed);
+	t.incoming_msg.reset();
+	t.outgoing_msg.reset();
+	std::string().swap(t.content);
+	std::string().swap(t.result_content);
+}
+
+bool task_tracker::unpack(const task& t, task_payload& out){
+	double start = thread_cpu_secs();
+	bool ok = unpack_payload(t.packed, out);
+	merge_unpacked(t, out);
+	m_compression.unpacked ++;
+	m_compression.unpack_cpu_secs += thread_cpu_secs() - start;
+	if(!ok)
+		LOG(ERROR)<<"task_tracker: corrupt payload of "<<t.id;
+	return ok;
+}
+
+void task_tracker::_complete(const task& t, const boost::posix_time::ptime& completed){
+	// results without a time stamp are dated on arrival, so that they
+	// leave the not-completed end of m_by_completed
+	boost::posix_time::ptime when = completed.is_special()
+		? boost::posix_time::microsec_clock::universal_time() : completed;
+	if(t.completed == when)
+		return;
+	m_by_completed.erase(completed_key()(t));
+	t.completed = when;
+	m_by_completed.insert(completed_key()(t));
+}
+
+void task_tracker::_finish(const task& t){
+	// if it is completed already, it could be a result from a dead
+	// engine that died before delivering the result
+	if(t.state != TASK_COMPLETED)
+		_set_state(t, TASK_COMPLETED);
+}
+
+static void add_task_time(const time_key& key, const task& t, std::vector<task_time>& out){
+	task_time tt;
+	tt.key          = key;
+	tt.state        = t.state;
+	tt.engine_uuid  = t.engine_uuid;
+	tt.submitted_us = time_key_us(t.submitted, time_key_min);
+	tt.completed_us = time_key_us(t.completed, time_key_max);
+	out.push_back(tt);
+}
+
+bool task_tracker::time_range(time_index which, const time_key& from, bool after, const time_key& to,
+		std::size_t limit, std::vector<task_time>& out)const{
+	if(to < from || (after && to == from))
+		return true;
+	std::size_t n = 0;
+	if(which == BY_SUBMITTED){
+		auto& index = tasks.get<submitted_time_t>();
+		auto it  = after ? index.upper_bound(from) : index.lower_bound(from);
+		auto end = index.lower_bound(to);
+		for(; it != end; ++it, ++n){
+			if(n == limit)
+				return false;
+			add_task_time(index.key_extractor()(*it), *it, out);
+		}
+		return true;
+	}
+	auto& index = tasks.get<task_id_t>();
+	auto it  = after ? m_by_completed.upper_bound(from) : m_by_completed.lower_bound(from);
+	auto end = m_by_completed.lower_bound(to);
+	for(; it != end; ++it, ++n){
+		if(n == limit)
+			return false;
+		add_task_time(*it, *index.find(it->id), out);
+	}
+	return true;
+}
+
+bool task_tracker::is_pending(const msg_id_t& msg_id)const{
+	auto& index = tasks.get<task_id_t>();
+	auto it = index.find(msg_id);
+	return it != index.end() && it->state != TASK_COMPLETED;
+}
+
+bool task_tracker::erase(const msg_id_t& msg_id){
+	auto& index = tasks.get<task_id_t>();
+	auto it = index.find(msg_id);
+	if(it == index.end())
+		return false;
+	_forget(*it);
+	index.erase(it);
+	return true;
+}
+
+std::size_t task_tracker::erase_arrived_before(boost::uint64_t cutoff, time_key& from, std::size_t max, std::size_t& erased){
+	auto& index = tasks.get<submitted_time_t>();
+	auto it = index.lower_bound(from);
+	std::size_t n = 0;
+	for(; n<max && it != index.end(); n++){
+		if(it->arrival >= cutoff){
+			++it;
+			continue;
+		}
+		if(m_db && it->state == TASK_COMPLETED)
+			m_db->erase(it->id);
+		_forget(*it);
+		it = index.erase(it);
+		erased ++;
+	}
+	if(it != index.end())
+		from = submitted_key()(*it);
+	return n;
+}
+
+std::size_t task_tracker::erase_completed(int eid, std::size_t max){
+	auto& index = tasks.get<engine_id_t>();
+	auto range  = index.equal_range(eid);
+	std::size_t n = 0;
+	for(auto it = range.first; n<max && it != range.second; ){
+		if(it->state != TASK_COMPLETED){
+			++it;
+			continue;
+		}
+		if(m_db)
+			m_db->erase(it->id);
+		_forget(*it);
+		it = index.erase(it);
+		n ++;
+	}
+	return n;
+}
+
+void task_tracker::clear(){
+	tasks.clear();
+	m_by_completed.clear();
+	m_engines.clear();
+	m_lru.clear();
+	std::fill(m_count, m_count+TASK_NUM_STATES, 0);
+	m_retained       = 0;
+	m_retained_bytes = 0;
+}
+
+static bool used_before(const task* a, const task* b){
+	return a->lru_seq < b->lru_seq;
+}
+
+void task_tracker::set_retention(const retention_policy& p){
+	bool was_unlimited = m_retention.unlimited();
+	m_retention = p;
+	if(p.unlimited()){
+		m_lru.clear();
+		return;
+	}
+	if(!was_unlimited)
+		return;
+	// nothing was queued so far, start with the completed tasks in the
+	// order they were last used
+	std::vector<const task*> retained;
+	BOOST_FOREACH(const task& t, in_state(TASK_COMPLETED))
+		if(t.lru_seq)
+			retained.push_back(&t);
+	std::sort(retained.begin(), retained.end(), used_before);
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	BOOST_FOREACH(const task* t, retained)
+		_use(*t, now);
+}
+
+void task_tracker::touch(const msg_id_t& msg_id){
+	if(m_retention.unlimited())
+		return;
+	auto& index = tasks.get<task_id_t>();
+	auto it = index.find(msg_id);
+	if(it != index.end() && it->lru_seq)
+		_use(*it, boost::posix_time::microsec_clock::universal_time());
+}
+
+std::size_t task_tracker::evict(const boost::posix_time::ptime& now){
+	const retention_policy& p = m_retention;
+	auto& index = tasks.get<task_id_t>();
+	std::size_t evicted = 0;
+	for(std::size_t step=0; step<p.max_steps && !m_lru.empty(); step++){
+		const lru_entry& e = m_lru.front();
+		auto it = index.find(e.id);
+		if(it == index.end() || it->lru_seq != e.seq){
+			m_lru.pop_front(); // erased, evicted or used again later
+			continue;
+		}
+		bool over = (p.max_records && m_retained > p.max_records)
+			|| (p.max_bytes && m_retained_bytes > p.max_bytes)
+			|| (!p.max_age.is_special() && e.used + p.max_age < now);
+		if(!over)
+			break;
+		m_lru.pop_front();
+		if(p.keep_metadata)
+			_drop_payload(*it);
+		else{
+			_forget(*it);
+			index.erase(it);
+		}
+		evicted ++;
+	}
+	return evicted;
+}
+
+void task_tracker::queue_request(const gpf_hub::in& inmsg, const incoming_msg_t& incoming){
+	task t;
+	if(!parse_msg_id(inmsg.msg_id(), t.id)){
+		LOG(ERROR)<<"save_queue_request: Got invalid msg_id "<<inmsg.msg_id();
+		return;
+	}
+	t.state        = TASK_PENDING;
+	t.incoming_msg = incoming;
+	t.client_uuid  = _client(inmsg.has_client_id(), inmsg.client_id());
+	t.engine_uuid  = inmsg.eid();
+	t.submitted    = wire_time(inmsg.has_submitted_us(), inmsg.submitted_us(), inmsg.submitted());
+	t.arrival      = m_arrival;
+	t.queue        = "mux";
+
+	// TODO: it's possible that iopub arrived first (see ipython code...)
+	_insert(t);
+}
+
+void task_tracker::queue_result(const gpf_hub::out& inmsg, const incoming_msg_t& incoming){
+	msg_id_t id;
+	auto& index = tasks.get<task_id_t>();
+	auto it = parse_msg_id(inmsg.msg_id(), id) ? index.find(id) : index.end();
+	if(it == index.end()){
+		LOG(ERROR)<<"save_queue_result: Got result for non-existent task";
+		return;
+	}
+	bool first = it->state != TASK_COMPLETED;
+	_finish(*it);
+	// update record anyway, because the unregistration could have been premature
+	_complete(*it, wire_time(inmsg.has_completed_us(), inmsg.completed_us(), inmsg.completed()));
+	it->started      = wire_time(inmsg.has_started_us(),   inmsg.started_us(),   inmsg.started());
+	it->outgoing_msg = incoming;
+	if(first)
+		_count_load(*it);
+	_retain(*it);
+}
+
+void task_tracker::task_request(const gpf_hub::intask& inmsg, const incoming_msg_t& incoming){
+	bool has_eid = inmsg.has_eid();
+
+	task t;
+	if(!parse_msg_id(inmsg.msg_id(), t.id)){
+		LOG(ERROR)<<"save_task_request: Got invalid msg_id "<<inmsg.msg_id();
+		return;
+	}
+	t.state        = has_eid ? TASK_PENDING : TASK_UNASSIGNED;
+	t.incoming_msg = incoming;
+	t.client_uuid  = _client(inmsg.has_client_id(), inmsg.client_id());
+	t.engine_uuid  = has_eid ? inmsg.eid() : -1;
+	t.submitted    = wire_time(inmsg.has_submitted_us(), inmsg.submitted_us(), inmsg.submitted());
+	t.arrival      = m_arrival;
+	t.queue        = "task";
+
+	// TODO: it's possible that iopub arrived first (see ipython code...)
+	_insert(t);
+}
+
+void task_tracker::task_result(const gpf_hub::outtask& inmsg, const incoming_msg_t& incoming){
+	msg_id_t id;
+	auto& index = tasks.get<task_id_t>();
+	auto it = parse_msg_id(inmsg.msg_id(), id) ? index.find(id) : index.end();
+	if(it == index.end()){
+		LOG(ERROR)<<"save_task_result: Got result for non-existent task";
+		return;
+	}
+	bool first = it->state != TASK_COMPLETED;
+	_finish(*it);
+
+	// update record anyway, because the unregistration could have been premature
+	_complete(*it, wire_time(inmsg.has_completed_us(), inmsg.completed_us(), inmsg.completed()));
+	it->started      = wire_time(inmsg.has_started_us(),   inmsg.started_us(),   inmsg.started());
+	it->outgoing_msg = incoming;
+	if(inmsg.has_eid() && inmsg.eid() != it->engine_uuid)
+		_set_engine(it, inmsg.eid());
+	if(first)
+		_count_load(*it);
+	_retain(*it);
+}
+
+void task_tracker::task_destination(const gpf_hub::tracktask& inmsg){
+	msg_id_t id;
+	auto& index = tasks.get<task_id_t>();
+	auto it = parse_msg_id(inmsg.msg_id(), id) ? index.find(id) : index.end();
+	if(it == index.end()){
+		LOG(ERROR)<<"save_task_destination: Got msg for non-existent task";
+		return;
+	}
+	if(it->state == TASK_COMPLETED){
+		// a late reassignment, the engine that ran it is known
+		LOG(ERROR)<<"save_task_destination: task "<<id<<" is completed already";
+		return;
+	}
+	if(it->state == TASK_UNASSIGNED)
+		_set_state(*it, TASK_PENDING);
+
+	// assigned again (work stealing): moves from the old engine's
+	// counts to the new one's
+	if(inmsg.eid() != it->engine_uuid)
+		_set_engine(it, inmsg.eid());
+	LOG(INFO)<<"Task "<<id<<" arrived on "<<inmsg.eid();
+}
+
+void task_tracker::engine_died(const msg_id_t& msg_id, const boost::posix_time::ptime& when){
+	auto& index = tasks.get<task_id_t>();
+	auto it = index.find(msg_id);
+	if(it==index.end()) {
+		LOG(ERROR)<<"DB error handling stranded message "<<msg_id;
+		return;
+	}
+	_finish(*it);
+	it->content     = "Engine died while running task `" + to_string(msg_id) + "'";
+	_complete(*it, when);
+	_retain(*it);
+}
+
+void task_tracker::restore(const task_db::record_t& r){
+	task t;
+	if(!parse_msg_id(r.msg_id(), t.id)){
+		LOG(ERROR)<<"restore: Got invalid msg_id "<<r.msg_id();
+		return;
+	}
+	t.state          = r.state() < TASK_NUM_STATES ? (task_state)r.state() : TASK_COMPLETED;
+	t.client_uuid    = _client(true, r.client_uuid());
+	t.engine_uuid    = r.has_eid() ? r.eid() : -1;
+	t.queue          = r.queue() == "mux" ? "mux" : "task";
+	t.submitted      = get_us(r.has_submitted_us(),   r.submitted_us());
+	t.started        = get_us(r.has_started_us(),     r.started_us());
+	t.completed      = get_us(r.has_completed_us(),   r.completed_us());
+	t.resubmitted    = get_us(r.has_resubmitted_us(), r.resubmitted_us());
+	t.arrival        = r.arrival();
+	t.content        = r.content();
+	t.result_content = r.result_content();
+	_insert(t);
+	if(t.state == TASK_COMPLETED){
+		auto& index = tasks.get<task_id_t>();
+		_retain(*index.find(t.id), false); // the task db has it already
+	}
+}
@@ -4,22 +4,46 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <deque>
+#include <limits>
+#include <boost/cstdint.hpp>
+#include <boost/utility.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/identity.hpp>
 #include <boost/multi_index/member.hpp>
+#include <boost/range/adaptor/filtered.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <gpf/util/zmqmessage.hpp>
+#include <gpf/util/incoming_pool.hpp>
+#include <gpf/util/msg_id.hpp>
+#include <gpf/util/time.hpp>
+#include <gpf/messages/hub.pb.h>
+#include <gpf/controller/db.hpp>
 
 namespace gpf
 {
+	enum task_state{
+		TASK_UNASSIGNED = 0, ///< submitted to the task queue, no engine yet
+		TASK_PENDING,        ///< submitted to an engine
+		TASK_COMPLETED,      ///< result arrived (or engine died)
+		TASK_NUM_STATES
+	};
 
 	struct task{
-		std::string id;
-		int         client_uuid;
+		msg_id_t    id;
+		mutable task_state state;
+		int         client_uuid; ///< see client_table, -1 if unknown
 		int         engine_uuid;
-		std::string  queue; // e.g. mux, task
-		mutable boost::posix_time::ptime submitted;
+		mutable boost::uint32_t lru_seq;       ///< position in the retention queue, 0: not retained
+		mutable boost::uint32_t payload_bytes; ///< counted against retention_policy::max_bytes
+		boost::uint64_t arrival;     ///< hub-side order of arrival, see task_tracker::set_arrival()
+		const char*  queue; // "mux" or "task", static strings only
+		boost::posix_time::ptime submitted; ///< key of the submitted index, see time_key
 		mutable boost::posix_time::ptime   started;
 		mutable boost::posix_time::ptime completed;
 		mutable boost::posix_time::ptime resubmitted;
@@ -27,28 +51,424 @@ namespace gpf
 		mutable std::string  content;
 		mutable std::string  result_content;
 
-		mutable boost::shared_ptr<ZmqMessage::Incoming<ZmqMessage::XRouting> > incoming_msg; ///< request
-		mutable boost::shared_ptr<ZmqMessage::Incoming<ZmqMessage::XRouting> > outgoing_msg; ///< reply
+		mutable incoming_msg_t incoming_msg; ///< request
+		mutable incoming_msg_t outgoing_msg; ///< reply
+		mutable std::string    packed;       ///< the payload above compressed, see retention_policy::compress_bytes
+
+		task()
+		: state(TASK_UNASSIGNED), client_uuid(-1), engine_uuid(-1)
+		, lru_seq(0), payload_bytes(0), arrival(0), queue("") {}
+	};
+
+	/**
+	 * sort key of the time indexes (see task_set, task_tracker::time_range()).
+	 *
+	 * Ties are broken by the following fields, so every task has its
+	 * own key and a key can serve as a cursor to resume a scan.
+	 */
+	struct time_key{
+		boost::int64_t time;  ///< us since the epoch
+		boost::int64_t time2;
+		msg_id_t       id;
+
+		time_key(boost::int64_t t=0, boost::int64_t t2=0, const msg_id_t& i=msg_id_t())
+		: time(t), time2(t2), id(i){}
+
+		inline bool operator<(const time_key& o)const{
+			if(time  != o.time)  return time  < o.time;
+			if(time2 != o.time2) return time2 < o.time2;
+			return id < o.id;
+		}
+		inline bool operator==(const time_key& o)const{ return time == o.time && time2 == o.time2 && id == o.id; }
+	};
+	static const boost::int64_t time_key_min = std::numeric_limits<boost::int64_t>::min();
+	static const boost::int64_t time_key_max = std::numeric_limits<boost::int64_t>::max();
+
+	/// t in us since the epoch, special if t is not a date
+	inline boost::int64_t time_key_us(const boost::posix_time::ptime& t, boost::int64_t special){
+		return t.is_special() ? special : to_us(t);
+	}
+
+	/// (submitted, 0, id), tasks without submission time first
+	struct submitted_key{
+		typedef time_key result_type;
+		inline result_type operator()(const task& t)const{
+			return time_key(time_key_us(t.submitted, time_key_min), 0, t.id);
+		}
 	};
 
+	/// (completed, submitted, id), tasks that did not complete yet last, by submission
+	struct completed_key{
+		typedef time_key result_type;
+		inline result_type operator()(const task& t)const{
+			return time_key(time_key_us(t.completed, time_key_max), time_key_us(t.submitted, time_key_min), t.id);
+		}
+	};
 
+	/// tasks sorted by id, client, engine and submission time (four tree nodes per task)
 	typedef boost::multi_index::multi_index_container<
 		task,
 		boost::multi_index::indexed_by<
 			// sort by ID
-			boost::multi_index::ordered_unique<boost::multi_index::tag<struct task_id_t>,boost::multi_index::member<task,std::string,&task::id> >,
+			boost::multi_index::ordered_unique<boost::multi_index::tag<struct task_id_t>,boost::multi_index::member<task,msg_id_t,&task::id> >,
 			// sort by client ID
 			boost::multi_index::ordered_non_unique<boost::multi_index::tag<struct client_id_t>,boost::multi_index::member<task,int,&task::client_uuid> >,
 			// sort by engine ID
-			boost::multi_index::ordered_non_unique<boost::multi_index::tag<struct engine_id_t>,boost::multi_index::member<task,int,&task::engine_uuid> >
+			boost::multi_index::ordered_non_unique<boost::multi_index::tag<struct engine_id_t>,boost::multi_index::member<task,int,&task::engine_uuid> >,
+			// sort by submission time
+			boost::multi_index::ordered_unique<boost::multi_index::tag<struct submitted_time_t>,submitted_key>
+		> 
+	> ordered_task_set;
+
+	/**
+	 * tasks hashed by id, with client and engine buckets.
+	 *
+	 * Each index costs a single link per task instead of a tree node.
+	 * Lookups by id and equal_range on client/engine work the same,
+	 * only iteration order is unspecified. The submitted index is
+	 * ordered, as it serves range queries.
+	 */
+	typedef boost::multi_index::multi_index_container<
+		task,
+		boost::multi_index::indexed_by<
+			boost::multi_index::hashed_unique<boost::multi_index::tag<struct task_id_t>,boost::multi_index::member<task,msg_id_t,&task::id> >,
+			boost::multi_index::hashed_non_unique<boost::multi_index::tag<struct client_id_t>,boost::multi_index::member<task,int,&task::client_uuid> >,
+			boost::multi_index::hashed_non_unique<boost::multi_index::tag<struct engine_id_t>,boost::multi_index::member<task,int,&task::engine_uuid> >,
+			boost::multi_index::ordered_unique<boost::multi_index::tag<struct submitted_time_t>,submitted_key>
 		> 
-	> task_set;
+	> hashed_task_set;
+
+#ifdef GPF_HASHED_TASK_INDEX
+	typedef hashed_task_set  task_set;
+#else
+	typedef ordered_task_set task_set;
+#endif
+
+	/**
+	 * how many completed tasks the hub keeps.
+	 *
+	 * Completed tasks are evicted least recently used first (completion
+	 * and get_results count as use) while any of the limits is
+	 * exceeded. A limit of 0 (or not_a_date_time for max_age) is
+	 * unlimited, which is the default.
+	 *
+	 * Payloads of completed tasks larger than compress_bytes are kept
+	 * zlib compressed and only inflated when a client asks for them
+	 * (see task_tracker::unpack()).
+	 */
+	struct retention_policy{
+		std::size_t max_records;  ///< completed tasks holding payloads
+		std::size_t max_bytes;    ///< message and result bytes held by completed tasks
+		boost::posix_time::time_duration max_age; ///< time since last use
+		bool        keep_metadata; ///< evict payloads only, keep the task record
+
+		boost::posix_time::time_duration interval; ///< how often eviction runs
+		std::size_t max_steps;    ///< max. tasks examined per shard and run
+
+		std::size_t compress_bytes; ///< compress larger payloads, 0 (default): never
+		int         compress_level; ///< zlib level, -1: zlib's default
+
+		retention_policy()
+		: max_records(0), max_bytes(0), max_age(boost::posix_time::not_a_date_time)
+		, keep_metadata(false)
+		, interval(boost::posix_time::seconds(1)), max_steps(10000)
+		, compress_bytes(0), compress_level(-1){}
+
+		inline bool unlimited()const{ return !max_records && !max_bytes && max_age.is_special(); }
+	};
+
+	/**
+	 * numbers for client identities.
+	 *
+	 * Tasks store the submitting client as a small int, so the client
+	 * index of task_set compares ints instead of socket identities.
+	 * Numbers are never reused. Thread safe, it is shared by all
+	 * task_trackers of a hub.
+	 */
+	class client_table
+	: boost::noncopyable
+	{
+		public:
+			/// the number of identity, a new one if it is unknown. -1 for the empty identity.
+			int intern(const std::string& identity);
+			/// the number of identity, -1 if it is unknown
+			int find(const std::string& identity)const;
+			/// the identity numbered id, empty if there is none
+			std::string identity(int id)const;
+			std::size_t size()const;
+
+		private:
+			mutable boost::mutex                   m_mutex;
+			boost::unordered_map<std::string, int> m_ids;
+			std::vector<std::string>               m_identities;
+	};
+
+	/// fill r from a task, with its payload frames if with_frames is set
+	void to_record(const task& t, task_db::record_t& r, bool with_frames=true);
+	/// fill r from a task without its payload, as snapshots store it
+	void to_metadata(const task& t, task_db::record_t& r);
+
+	/// the payload of a task, as packed into task::packed
+	struct task_payload{
+		std::string              content;
+		std::string              result_content;
+		std::vector<std::string> buffers;        ///< frames of the request after its header
+		std::vector<std::string> result_buffers; ///< frames of the reply after its header
+	};
+	/// compress p into packed (replacing it)
+	void pack_payload(const task_payload& p, std::string& packed, int level=-1);
+	/// inflate packed into p. Returns false if packed is corrupt.
+	bool unpack_payload(const std::string& packed, task_payload& p);
+
+	/// what compressing payloads saves and costs, see retention_policy::compress_bytes
+	struct compression_stats{
+		unsigned long   packed;          ///< payloads compressed
+		unsigned long   skipped;         ///< payloads that did not shrink, kept as they were
+		unsigned long   unpacked;        ///< payloads inflated for clients
+		boost::uint64_t raw_bytes;       ///< size of the compressed payloads before
+		boost::uint64_t packed_bytes;    ///< and after compression
+		double          pack_cpu_secs;   ///< thread CPU time spent compressing
+		double          unpack_cpu_secs; ///< and inflating
+
+		compression_stats()
+		: packed(0), skipped(0), unpacked(0), raw_bytes(0), packed_bytes(0)
+		, pack_cpu_secs(0.), unpack_cpu_secs(0.){}
+
+		/// raw_bytes per packed byte, 1 if nothing was compressed
+		inline double ratio()const{ return packed_bytes ? (double)raw_bytes/packed_bytes : 1.; }
+
+		compression_stats& operator+=(const compression_stats& o);
+	};
+
+	/// a task found by task_tracker::time_range()
+	struct task_time{
+		time_key       key;
+		task_state     state;
+		int            engine_uuid;
+		boost::int64_t submitted_us; ///< time_key_min if unknown
+		boost::int64_t completed_us; ///< time_key_max if not completed
+	};
+
+	/// tasks of one engine, see task_tracker::engine_counts()
+	struct engine_task_counts{
+		unsigned int queue;     ///< pending on the MUX queue
+		unsigned int tasks;     ///< pending on the task queue
+		unsigned int completed;
+
+		engine_task_counts():queue(0),tasks(0),completed(0){}
+		inline engine_task_counts& operator+=(const engine_task_counts& o){
+			queue += o.queue; tasks += o.tasks; completed += o.completed;
+			return *this;
+		}
+	};
+
+	/// time constant of engine_load, in seconds
+	static const double engine_load_tau = 10.;
+
+	/**
+	 * recent throughput and service time of an engine.
+	 *
+	 * Exponentially weighted over time: a completion engine_load_tau
+	 * seconds ago weighs 1/e of one now.
+	 */
+	struct engine_load{
+		double                   rate;           ///< completions per second, at `last'
+		double                   service_secs;   ///< weighted mean of completed - started
+		double                   service_weight; ///< decayed number of tasks behind service_secs, at `last'
+		boost::posix_time::ptime last;           ///< latest completion
 
+		engine_load():rate(0.),service_secs(0.),service_weight(0.){}
+
+		/// a task completed at when, after running service_secs (< 0: unknown)
+		void add(const boost::posix_time::ptime& when, double service_secs);
+		/// rate decayed to now
+		double rate_at(const boost::posix_time::ptime& now)const;
+		/// add the completions counted in o (e.g. by another task_tracker)
+		void merge(const engine_load& o);
+	};
+
+	/// predicate for filtering tasks by state
+	struct task_in_state{
+		task_state m_state;
+		task_in_state(task_state s):m_state(s){}
+		inline bool operator()(const task& t)const{ return t.state == m_state; }
+	};
+
+	/**
+	 * bookkeeping of tasks seen on the monitor socket.
+	 *
+	 * The methods take the already parsed message header and the
+	 * message it came in. The state of a task is stored in its record,
+	 * so a state change costs a single lookup by id. Headers whose
+	 * msg_id is not a UUID are logged and dropped.
+	 */
 	struct task_tracker{
 		task_set          tasks;
-		std::set<std::string> pending;
-		std::set<std::string> all_completed;
-		std::set<std::string> unassigned;
+
+		task_tracker();
+
+		/// number of tasks in state s
+		inline std::size_t count(task_state s)const{ return m_count[s]; }
+
+		/// all tasks in state s (a view on tasks, O(tasks.size()) to iterate)
+		inline boost::filtered_range<task_in_state, const task_set>
+		in_state(task_state s)const{ return tasks | boost::adaptors::filtered(task_in_state(s)); }
+
+		enum time_index{ BY_SUBMITTED, BY_COMPLETED };
+		/**
+		 * tasks with from <= key < to in the time index which, in key order.
+		 *
+		 * Appends at most limit tasks to out. With after set, a task
+		 * keyed from is skipped (from is a cursor).
+		 * O(log(tasks.size()) + limit).
+		 * @return false if there are more tasks in the range
+		 */
+		bool time_range(time_index which, const time_key& from, bool after, const time_key& to,
+				std::size_t limit, std::vector<task_time>& out)const;
+
+		/// tasks of engine eid by queue and state, O(1)
+		engine_task_counts engine_counts(int eid)const;
+		/// ids of the tasks of engine eid that are not completed
+		const std::set<msg_id_t>& engine_pending(int eid)const;
+		/// throughput and service time of engine eid, from the results seen so far
+		engine_load load(int eid)const;
+
+		/// true if msg_id is known and not completed yet
+		bool is_pending(const msg_id_t& msg_id)const;
+
+		/// remove a task. Returns false if it does not exist.
+		bool erase(const msg_id_t& msg_id);
+		/// remove all tasks
+		void clear();
+		/**
+		 * remove the tasks that arrived before cutoff (see set_arrival()).
+		 *
+		 * Walks the submitted index from `from' and visits at most max
+		 * tasks, so a purge can run in slices. from is set to where the
+		 * next slice starts. Tasks arriving meanwhile are not removed,
+		 * wherever they are in the index. Removed tasks are removed
+		 * from the task db as well.
+		 * @return number of tasks visited, less than max when done
+		 */
+		std::size_t erase_arrived_before(boost::uint64_t cutoff, time_key& from, std::size_t max, std::size_t& erased);
+		/**
+		 * remove up to max completed tasks of engine eid, from the task db as well.
+		 * @return number of tasks removed, less than max when done
+		 */
+		std::size_t erase_completed(int eid, std::size_t max);
+
+		/// new tasks arrived at the hub as number seq, monitor messages are numbered in order
+		inline void set_arrival(boost::uint64_t seq){ m_arrival = seq; }
+
+		/// write completed tasks (and later changes to them) to db. May be NULL.
+		inline void set_db(task_db* db){ m_db = db; }
+		/// the handlers replay the journal: the db has the results already, and their payloads
+		inline void set_replaying(bool r){ m_replaying = r; }
+
+		/// number the submitting clients of new tasks in c. May be NULL, then client_uuid stays -1.
+		inline void set_clients(client_table* c){ m_clients = c; }
+		/// to_record() plus the client identity
+		void record(const task& t, task_db::record_t& r, bool with_frames=true)const;
+		/// to_metadata() plus the client identity
+		void metadata(const task& t, task_db::record_t& r)const;
+
+		/// limits for completed tasks. Existing tasks are subject to them as well.
+		void set_retention(const retention_policy& p);
+		inline const retention_policy& retention()const{ return m_retention; }
+		/// a client accessed msg_id, see retention_policy
+		void touch(const msg_id_t& msg_id);
+		/**
+		 * evict completed tasks exceeding the retention limits.
+		 *
+		 * Examines at most retention().max_steps tasks so it can run in
+		 * slices.
+		 * @return number of tasks evicted
+		 */
+		std::size_t evict(const boost::posix_time::ptime& now);
+		/// number of completed tasks holding payloads
+		inline std::size_t retained()const{ return m_retained; }
+		/// bytes held by them
+		inline std::size_t retained_bytes()const{ return m_retained_bytes; }
+		/// entries in the retention queue, including stale ones
+		inline std::size_t retention_queue()const{ return m_lru.size(); }
+
+		/**
+		 * the payload of t, inflated if it is compressed.
+		 *
+		 * Only for compressed tasks (t.packed not empty), the others
+		 * are read directly. Counted in compression().
+		 */
+		bool unpack(const task& t, task_payload& out);
+		inline const compression_stats& compression()const{ return m_compression; }
+
+		/// MUX queue: a request was sent to an engine (by inmsg.client_id)
+		void queue_request(const gpf_hub::in&, const incoming_msg_t&);
+		/// MUX queue: an engine replied
+		void queue_result(const gpf_hub::out&, const incoming_msg_t&);
+		/// Task queue: a task was submitted (by inmsg.client_id)
+		void task_request(const gpf_hub::intask&, const incoming_msg_t&);
+		/// Task queue: an engine replied
+		void task_result(const gpf_hub::outtask&, const incoming_msg_t&);
+		/// Task queue: a task arrived on an engine
+		void task_destination(const gpf_hub::tracktask&);
+		/// the engine running msg_id died before replying
+		void engine_died(const msg_id_t& msg_id, const boost::posix_time::ptime& when);
+
+		/// re-create a task from a snapshot record (see to_record(), journal)
+		void restore(const task_db::record_t& r);
+
+		private:
+		void _insert(const task& t);
+		void _set_state(const task& t, task_state s);
+		void _finish(const task& t);
+		void _retain(const task& t, bool store=true);
+		void _forget(const task& t);
+		void _drop_payload(const task& t);
+		void _pack(const task& t);
+		void _use(const task& t, const boost::posix_time::ptime& when);
+		void _compact_lru();
+		void _complete(const task& t, const boost::posix_time::ptime& completed);
+		void _count_engine(const task& t, int delta);
+		template<class Iterator> void _set_engine(Iterator it, int eid);
+		int  _client(bool has, const std::string& identity);
+
+		std::size_t m_count[TASK_NUM_STATES];
+
+		/**
+		 * completed_key of every task.
+		 *
+		 * Kept next to tasks rather than as one of its indexes:
+		 * modify() on a hashed_non_unique index walks the group of
+		 * equal keys (e.g. all tasks of a client), and completion
+		 * would pay that for every task.
+		 */
+		std::set<time_key>    m_by_completed;
+
+		/// per engine counts, maintained on every change so status queries need not walk tasks
+		struct engine_tasks{
+			engine_task_counts counts;
+			std::set<msg_id_t> pending;
+		};
+		boost::unordered_map<int, engine_tasks> m_engines;
+		boost::unordered_map<int, engine_load>  m_load;
+		void _count_load(const task& t);
+
+		struct lru_entry{
+			msg_id_t                 id;
+			boost::uint32_t          seq; ///< stale unless equal to the task's lru_seq
+			boost::posix_time::ptime used;
+			lru_entry(const msg_id_t& i, boost::uint32_t s, const boost::posix_time::ptime& u):id(i),seq(s),used(u){}
+		};
+		task_db*              m_db;
+		bool                  m_replaying;
+		client_table*         m_clients;
+		retention_policy      m_retention;
+		std::deque<lru_entry> m_lru;  ///< least recently used first, only kept with limits
+		boost::uint32_t       m_lru_seq;
+		boost::uint64_t       m_arrival;
+		std::size_t           m_retained;
+		std::size_t           m_retained_bytes;
+		compression_stats     m_compression;
 	};
 
 }
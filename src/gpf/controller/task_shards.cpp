@@ -0,0 +1,147 @@
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <glog/logging.h>
+#include <gpf/controller/task_shards.hpp>
+
+using namespace gpf;
+
+bool gpf::peek_msg_id(const char* data, std::size_t size, const char*& id, std::size_t& id_len){
+	// field 1, wire type 2 (length delimited)
+	if(size < 2 || data[0] != 0x0a)
+		return false;
+	std::size_t len = 0;
+	std::size_t pos = 1;
+	for(int shift=0; shift<35; shift+=7){
+		if(pos >= size)
+			return false;
+		unsigned char b = data[pos++];
+		len |= (std::size_t)(b & 0x7f) << shift;
+		if(!(b & 0x80)){
+			if(len > size - pos)
+				return false;
+			id     = data + pos;
+			id_len = len;
+			return true;
+		}
+	}
+	return false;
+}
+
+task_shards::task_shards(unsigned int n_threads, const handler_t& handler)
+: m_handler(handler)
+, m_threaded(n_threads > 0)
+, m_stop(false)
+{
+	unsigned int n = std::max(1u, n_threads);
+	for(unsigned int i=0;i<n;i++)
+		m_shards.push_back(boost::shared_ptr<shard>(new shard()));
+	if(m_threaded){
+		for(unsigned int i=0;i<n;i++)
+			m_workers.create_thread(boost::bind(&task_shards::work, this, boost::ref(*m_shards[i])));
+		LOG(INFO)<<"task_shards: started "<<n<<" worker threads";
+	}
+}
+
+task_shards::~task_shards(){
+	BOOST_FOREACH(boost::shared_ptr<shard>& s, m_shards){
+		boost::mutex::scoped_lock lock(s->queue_mutex);
+		m_stop = true;
+		s->queue_cond.notify_all();
+	}
+	m_workers.join_all();
+}
+
+unsigned int
+task_shards::shard_of(const msg_id_t& id)const{
+	if(m_shards.size() == 1)
+		return 0;
+	return hash_value(id) % m_shards.size();
+}
+
+unsigned int
+task_shards::shard_of(const monitor_job& job)const{
+	if(m_shards.size() == 1 || job.msg->size() < 2)
+		return 0;
+	zmq::message_t& header = (*job.msg)[1];
+	const char* p;
+	std::size_t len;
+	msg_id_t    id;
+	if(!peek_msg_id(static_cast<const char*>(header.data()), header.size(), p, len)
+	|| !parse_msg_id(p, len, id))
+		return 0; // will fail to parse in the handler as well
+	return shard_of(id);
+}
+
+void
+task_shards::post(unsigned int i, std::vector<monitor_job>& jobs){
+	if(jobs.empty())
+		return;
+	shard& s = *m_shards[i];
+	if(!m_threaded){
+		apply(s, jobs);
+		jobs.clear();
+		return;
+	}
+	boost::mutex::scoped_lock lock(s.queue_mutex);
+	if(s.queue.empty())
+		s.queue.swap(jobs);
+	else{
+		s.queue.insert(s.queue.end(), jobs.begin(), jobs.end());
+		jobs.clear();
+	}
+	s.queue_cond.notify_all();
+}
+
+void
+task_shards::call(unsigned int i, const monitor_job::call_t& f){
+	std::vector<monitor_job> jobs(1, monitor_job(f));
+	post(i, jobs);
+}
+
+void
+task_shards::sync(){
+	if(!m_threaded)
+		return;
+	BOOST_FOREACH(boost::shared_ptr<shard>& s, m_shards){
+		boost::mutex::scoped_lock lock(s->queue_mutex);
+		while(s->busy || !s->queue.empty())
+			s->queue_cond.wait(lock);
+	}
+}
+
+void
+task_shards::apply(shard& s, std::vector<monitor_job>& jobs){
+	boost::mutex::scoped_lock lock(s.tracker_mutex);
+	BOOST_FOREACH(const monitor_job& job, jobs){
+		if(job.call)
+			job.call(s.tracker);
+		else
+			m_handler(s.tracker, job);
+	}
+}
+
+void
+task_shards::work(shard& s){
+	std::vector<monitor_job> jobs;
+	while(true){
+		{
+			boost::mutex::scoped_lock lock(s.queue_mutex);
+			s.busy = false;
+			s.queue_cond.notify_all(); // wake up sync()
+			while(s.queue.empty() && !m_stop)
+				s.queue_cond.wait(lock);
+			if(s.queue.empty())
+				return; // stopped, and nothing left to do
+			jobs.swap(s.queue);
+			s.busy = true;
+		}
+		apply(s, jobs);
+		jobs.clear();
+	}
+}
+
+task_shards::locked::locked(task_shards& ts, unsigned int shard)
+: m_lock(ts.m_shards[shard]->tracker_mutex)
+, m_tracker(ts.m_shards[shard]->tracker)
+{
+}
@@ -0,0 +1,109 @@
+#ifndef __GPF_TASK_SHARDS_HPP__
+#     define __GPF_TASK_SHARDS_HPP__
+
+#include <vector>
+#include <boost/utility.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include <gpf/controller/task_set.hpp>
+#include <gpf/controller/topics.hpp>
+
+namespace gpf
+{
+	/// a monitor message waiting to be applied to a task_tracker
+	struct monitor_job{
+		typedef boost::function<void (task_tracker&)> call_t;
+		monitor_topic   type;
+		incoming_msg_t  msg;
+		boost::uint64_t arrival; ///< numbers the messages in the order the hub received them
+		call_t          call;    ///< run instead of the handler if set, see task_shards::call()
+		monitor_job(monitor_topic t, const incoming_msg_t& m, boost::uint64_t a=0):type(t),msg(m),arrival(a){}
+		explicit monitor_job(const call_t& c):type(MONITOR_UNKNOWN),arrival(0),call(c){}
+	};
+
+	/**
+	 * extract the msg_id from a serialized monitor header without parsing it.
+	 *
+	 * All monitor headers (in, out, intask, outtask, tracktask) carry
+	 * the msg_id as field 1, which protobuf serializes first.
+	 *
+	 * @return false if the header does not start with field 1
+	 */
+	bool peek_msg_id(const char* data, std::size_t size, const char*& id, std::size_t& id_len);
+
+	/**
+	 * task_trackers partitioned by msg_id.
+	 *
+	 * With n_threads == 0 there is a single shard, and posted jobs are
+	 * applied right away on the calling thread.  Otherwise every shard
+	 * has a worker thread which owns its task_tracker and applies
+	 * posted jobs in the order they were posted.
+	 *
+	 * Queries take a shard's lock (see locked) and thereby see every
+	 * job that was applied before.
+	 */
+	class task_shards
+	: boost::noncopyable
+	{
+		public:
+			typedef boost::function<void (task_tracker&, const monitor_job&)> handler_t;
+
+			task_shards(unsigned int n_threads, const handler_t& handler);
+			~task_shards();
+
+			inline unsigned int size()const{ return m_shards.size(); }
+			inline bool     threaded()const{ return m_threaded; }
+
+			/// the shard responsible for a msg_id
+			unsigned int shard_of(const msg_id_t& id)const;
+			/// the shard responsible for a monitor message (header in frame 1)
+			unsigned int shard_of(const monitor_job& job)const;
+
+			/// hand over jobs to a shard. jobs is empty afterwards.
+			void post(unsigned int shard, std::vector<monitor_job>& jobs);
+
+			/// run f on a shard's task_tracker after the jobs posted so far
+			void call(unsigned int shard, const monitor_job::call_t& f);
+
+			/// wait until all jobs posted so far have been applied
+			void sync();
+
+			/// a shard's task_tracker, locked for the lifetime of this object
+			class locked
+			: boost::noncopyable
+			{
+				public:
+					locked(task_shards& ts, unsigned int shard);
+					inline task_tracker& operator*() { return m_tracker; }
+					inline task_tracker* operator->(){ return &m_tracker; }
+				private:
+					boost::mutex::scoped_lock m_lock;
+					task_tracker&             m_tracker;
+			};
+
+		private:
+			struct shard{
+				task_tracker              tracker;
+				boost::mutex              tracker_mutex; ///< held while tracker is used
+				boost::mutex              queue_mutex;   ///< protects queue and busy
+				boost::condition_variable queue_cond;
+				std::vector<monitor_job>  queue;
+				bool                      busy;          ///< worker is applying jobs
+				shard():busy(false){}
+			};
+
+			void work(shard& s);
+			void apply(shard& s, std::vector<monitor_job>& jobs);
+
+			handler_t                            m_handler;
+			bool                                 m_threaded;
+			bool                                 m_stop;
+			std::vector<boost::shared_ptr<shard> > m_shards;
+			boost::thread_group                  m_workers;
+	};
+}
+
+#endif /* __GPF_TASK_SHARDS_HPP__ */
@@ -0,0 +1,131 @@
+#ifndef __GPF_TOPICS_HPP__
+#     define __GPF_TOPICS_HPP__
+
+#include <cstring>
+#include <zmq.hpp>
+
+namespace gpf
+{
+	/**
+	 * Topics arriving on the hub's monitor (SUB) socket.
+	 *
+	 * The values are dense so that they can be used to index a flat
+	 * handler table.
+	 */
+	enum monitor_topic{
+		MONITOR_IN = 0,
+		MONITOR_OUT,
+		MONITOR_INTASK,
+		MONITOR_OUTTASK,
+		MONITOR_TRACKTASK,
+		MONITOR_INCONTROL,
+		MONITOR_OUTCONTROL,
+		MONITOR_NUM_TOPICS,
+		MONITOR_UNKNOWN = MONITOR_NUM_TOPICS
+	};
+
+	/**
+	 * Topics arriving on the hub's query (ROUTER) socket.
+	 */
+	enum query_topic{
+		QUERY_QUEUE = 0,
+		QUERY_RESULT,
+		QUERY_PURGE,
+		QUERY_LOAD,
+		QUERY_RESUBMIT,
+		QUERY_SHUTDOWN,
+		QUERY_REGISTRATION,
+		QUERY_UNREGISTRATION,
+		QUERY_CONNECTION,
+		QUERY_CLIENT,
+		QUERY_TIME_RANGE,
+		QUERY_NUM_TOPICS,
+		QUERY_UNKNOWN = QUERY_NUM_TOPICS
+	};
+
+	namespace detail
+	{
+		template<std::size_t N>
+		inline bool topic_eq(const char* data, const char (&lit)[N]){
+			// length has already been checked by the caller
+			return 0==std::memcmp(data, lit, N-1);
+		}
+	}
+
+	/**
+	 * map a monitor topic to its id without building a string.
+	 *
+	 * Switches on the length first, so at most one memcmp is done per
+	 * call (two where two topics share a length).
+	 */
+	inline monitor_topic monitor_topic_id(const char* d, std::size_t n){
+		using detail::topic_eq;
+		switch(n){
+			case 2:  if(topic_eq(d,"in"))         return MONITOR_IN;         break;
+			case 3:  if(topic_eq(d,"out"))        return MONITOR_OUT;        break;
+			case 6:  if(topic_eq(d,"intask"))     return MONITOR_INTASK;     break;
+			case 7:  if(topic_eq(d,"outtask"))    return MONITOR_OUTTASK;    break;
+			case 9:
+				if(topic_eq(d,"tracktask"))   return MONITOR_TRACKTASK;
+				if(topic_eq(d,"incontrol"))   return MONITOR_INCONTROL;
+				break;
+			case 10: if(topic_eq(d,"outcontrol")) return MONITOR_OUTCONTROL; break;
+		}
+		return MONITOR_UNKNOWN;
+	}
+
+	/**
+	 * map a query topic to its id without building a string.
+	 */
+	inline query_topic query_topic_id(const char* d, std::size_t n){
+		using detail::topic_eq;
+		switch(n){
+			case 12: if(topic_eq(d,"load_request"))           return QUERY_LOAD;           break;
+			case 13:
+				if(topic_eq(d,"queue_request"))              return QUERY_QUEUE;
+				if(topic_eq(d,"purge_request"))              return QUERY_PURGE;
+				break;
+			case 14:
+				if(topic_eq(d,"result_request"))             return QUERY_RESULT;
+				if(topic_eq(d,"client_request"))             return QUERY_CLIENT;
+				break;
+			case 16:
+				if(topic_eq(d,"resubmit_request"))           return QUERY_RESUBMIT;
+				if(topic_eq(d,"shutdown_request"))           return QUERY_SHUTDOWN;
+				break;
+			case 18:
+				if(topic_eq(d,"connection_request"))         return QUERY_CONNECTION;
+				if(topic_eq(d,"time_range_request"))         return QUERY_TIME_RANGE;
+				break;
+			case 20: if(topic_eq(d,"registration_request"))   return QUERY_REGISTRATION;   break;
+			case 22: if(topic_eq(d,"unregistration_request")) return QUERY_UNREGISTRATION; break;
+		}
+		return QUERY_UNKNOWN;
+	}
+
+	inline monitor_topic monitor_topic_id(zmq::message_t& frame){
+		return monitor_topic_id(static_cast<const char*>(frame.data()), frame.size());
+	}
+	inline query_topic query_topic_id(zmq::message_t& frame){
+		return query_topic_id(static_cast<const char*>(frame.data()), frame.size());
+	}
+
+	/// name of a monitor topic, for logging
+	inline const char* topic_name(monitor_topic t){
+		static const char* names[] = { "in", "out", "intask", "outtask",
+			"tracktask", "incontrol", "outcontrol", "<unknown>" };
+		return names[t];
+	}
+
+	/// name of a query topic, for logging
+	inline const char* topic_name(query_topic t){
+		static const char* names[] = { "queue_request", "result_request",
+			"purge_request", "load_request", "resubmit_request",
+			"shutdown_request", "registration_request",
+			"unregistration_request", "connection_request",
+			"client_request", "time_range_request", "<unknown>" };
+		return names[t];
+	}
+}
+
+#endif /* __GPF_TOPICS_HPP__ */
@@ -1,6 +1,8 @@
 #ifndef __GPF_SERIALIZATION_HPP__
 #     define __GPF_SERIALIZATION_HPP__
 
+#include <cstddef>
+#include <zmq.hpp>
 #include <gpf/serialization/common.hpp>
 
 namespace gpf
@@ -24,6 +26,18 @@ namespace gpf
 			int deserialize(T& msg, const std::string& s){
 				return archive_type_traits<atype>::deserialize(msg,s);
 			}
+
+			/// deserialize from a buffer without copying it first
+			template<class T>
+			int deserialize(T& msg, const void* data, std::size_t size){
+				return archive_type_traits<atype>::deserialize(msg,data,size);
+			}
+
+			/// deserialize straight from the data of a ZMQ frame
+			template<class T>
+			int deserialize(T& msg, zmq::message_t& frame){
+				return archive_type_traits<atype>::deserialize(msg,frame.data(),frame.size());
+			}
 		};
 
 		/// forward declaration for convenience
@@ -2,6 +2,8 @@
 #     define __GPF_SERIALIZATION_BINARY_HPP__
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream.hpp>
 #include <gpf/serialization/common.hpp>
 
 namespace gpf
@@ -33,7 +35,22 @@ namespace gpf
 					std::istringstream ss(s);
 					in_archive_t ia(ss);
 					ia >> msg;
-				}catch(boost::archive::archive_exception e){
+				}catch(const boost::archive::archive_exception& e){
+					LOG(ERROR)<<"Failed to deserialize msg: "<<e.what();
+					return -1;
+				}
+				return 0;
+			}
+
+			template<class T>
+			static
+			int deserialize(T& msg, const void* data, std::size_t size){
+				try{
+					boost::iostreams::stream<boost::iostreams::array_source>
+						ss(static_cast<const char*>(data), size);
+					in_archive_t ia(ss);
+					ia >> msg;
+				}catch(const boost::archive::archive_exception& e){
 					LOG(ERROR)<<"Failed to deserialize msg: "<<e.what();
 					return -1;
 				}
@@ -25,6 +25,16 @@ namespace gpf
 				}
 				return 0;
 			}
+
+			template<class T>
+			static
+			int deserialize(T& msg, const void* data, std::size_t size){
+				if(!msg.ParseFromArray(data, size)){
+					LOG(ERROR)<<"ProtoBuf: Failed to deserialize msg of "<<size<<" bytes";
+					return -1;
+				}
+				return 0;
+			}
 		};
 	}
 }
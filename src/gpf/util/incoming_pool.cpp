@@ -0,0 +1,94 @@
+#include <new>
+#include <boost/foreach.hpp>
+#include <gpf/util/incoming_pool.hpp>
+
+namespace gpf
+{
+	void intrusive_ptr_release(pooled_incoming* p){
+		if(--p->m_refs == 0){
+			incoming_pool& pool = p->m_pool;
+			p->~pooled_incoming();
+			pool._release(p);
+		}
+	}
+
+	static void release_shared(void*, void* hint){
+		delete static_cast<incoming_msg_t*>(hint);
+	}
+
+	void share_frame(const incoming_msg_t& msg, std::size_t i, zmq::message_t& out){
+		zmq::message_t& frame = (*msg)[i];
+		out.rebuild(frame.data(), frame.size(), release_shared, new incoming_msg_t(msg));
+	}
+
+	incoming_pool::incoming_pool(std::size_t max_free)
+	: m_max_free(max_free)
+	, m_acquired(0)
+	, m_allocated(0)
+	, m_in_use(0)
+	{
+	}
+
+	incoming_pool::~incoming_pool(){
+		BOOST_FOREACH(void* p, m_free)
+			::operator delete(p);
+	}
+
+	incoming_msg_t
+	incoming_pool::make(zmq::socket_t& s){
+		void* block = _acquire();
+		try{
+			return incoming_msg_t(new(block) pooled_incoming(s, *this));
+		}catch(...){
+			_release(block);
+			throw;
+		}
+	}
+
+	void*
+	incoming_pool::_acquire(){
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			m_acquired ++;
+			m_in_use   ++;
+			if(!m_free.empty()){
+				void* p = m_free.back();
+				m_free.pop_back();
+				return p;
+			}
+			m_allocated ++;
+		}
+		return ::operator new(sizeof(pooled_incoming));
+	}
+
+	void
+	incoming_pool::_release(void* p){
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			m_in_use --;
+			if(m_free.size() < m_max_free){
+				m_free.push_back(p);
+				return;
+			}
+		}
+		::operator delete(p);
+	}
+
+	incoming_pool::stats_t
+	incoming_pool::stats(){
+		boost::mutex::scoped_lock lock(m_mutex);
+		stats_t s;
+		s.acquired  = m_acquired;
+		s.allocated = m_allocated;
+		s.in_use    = m_in_use;
+		s.free      = m_free.size();
+		return s;
+	}
+
+	incoming_pool&
+	incoming_pool::instance(){
+		// intentionally leaked: messages may be released during static destruction
+		static incoming_pool* pool = new incoming_pool();
+		return *pool;
+	}
+}
@@ -0,0 +1,92 @@
+#ifndef __GPF_INCOMING_POOL_HPP__
+#     define __GPF_INCOMING_POOL_HPP__
+
+#include <vector>
+#include <boost/utility.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/detail/atomic_count.hpp>
+#include <boost/thread/mutex.hpp>
+#include <gpf/util/zmqmessage.hpp>
+
+namespace gpf
+{
+	class incoming_pool;
+
+	/**
+	 * an incoming message whose storage comes from an incoming_pool.
+	 *
+	 * Reference counted intrusively, see incoming_msg_t.
+	 */
+	class pooled_incoming
+	: public ZmqMessage::Incoming<ZmqMessage::XRouting>
+	{
+		public:
+			pooled_incoming(zmq::socket_t& s, incoming_pool& pool)
+			: ZmqMessage::Incoming<ZmqMessage::XRouting>(s)
+			, m_refs(0)
+			, m_pool(pool)
+			{}
+
+		private:
+			friend void intrusive_ptr_add_ref(pooled_incoming* p){ ++p->m_refs; }
+			friend void intrusive_ptr_release(pooled_incoming* p);
+
+			boost::detail::atomic_count m_refs;
+			incoming_pool&              m_pool;
+	};
+
+	typedef boost::intrusive_ptr<pooled_incoming> incoming_msg_t;
+
+	/**
+	 * make out send frame i of msg without copying it.
+	 *
+	 * msg is kept alive until zmq sent the frame (the reference is
+	 * dropped on a zmq I/O thread), so msg must not be changed
+	 * afterwards.
+	 */
+	void share_frame(const incoming_msg_t& msg, std::size_t i, zmq::message_t& out);
+
+	/**
+	 * recycles the storage of incoming messages.
+	 *
+	 * Messages may be released on any thread. Up to max_free blocks are
+	 * kept for reuse, more are given back to the heap (e.g. after a
+	 * large purge).
+	 */
+	class incoming_pool
+	: boost::noncopyable
+	{
+		public:
+			struct stats_t{
+				unsigned long acquired;    ///< messages constructed
+				unsigned long allocated;   ///< blocks taken from the heap
+				unsigned long in_use;      ///< messages currently alive
+				unsigned long free;        ///< blocks waiting for reuse
+			};
+
+			explicit incoming_pool(std::size_t max_free=65536);
+			~incoming_pool();
+
+			/// construct a message reading from s (nothing is received yet)
+			incoming_msg_t make(zmq::socket_t& s);
+
+			stats_t stats();
+
+			/// the pool used by the hub. Never destroyed.
+			static incoming_pool& instance();
+
+		private:
+			friend void intrusive_ptr_release(pooled_incoming* p);
+			void* _acquire();
+			void  _release(void* block);
+
+			boost::mutex       m_mutex;
+			std::vector<void*> m_free;
+			std::size_t        m_max_free;
+			unsigned long      m_acquired;
+			unsigned long      m_allocated;
+			unsigned long      m_in_use;
+	};
+}
+
+#endif /* __GPF_INCOMING_POOL_HPP__ */
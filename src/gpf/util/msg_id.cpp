@@ -0,0 +1,56 @@
+#include <ostream>
+#include <gpf/util/msg_id.hpp>
+
+namespace gpf
+{
+	static inline int hex_digit(char c){
+		if(c >= '0' && c <= '9') return c - '0';
+		if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	bool parse_msg_id(const char* s, std::size_t len, msg_id_t& id){
+		bool dashed;
+		if(len == 36)
+			dashed = true;
+		else if(len == 32)
+			dashed = false;
+		else
+			return false;
+		if(dashed && (s[8] != '-' || s[13] != '-' || s[18] != '-' || s[23] != '-'))
+			return false;
+
+		boost::uint64_t half[2] = {0, 0};
+		unsigned int digits = 0;
+		for(std::size_t i=0;i<len;i++){
+			if(dashed && (i==8 || i==13 || i==18 || i==23))
+				continue;
+			int d = hex_digit(s[i]);
+			if(d < 0)
+				return false;
+			half[digits/16] = (half[digits/16] << 4) | d;
+			digits ++;
+		}
+		id.hi = half[0];
+		id.lo = half[1];
+		return true;
+	}
+
+	std::string to_string(const msg_id_t& id){
+		static const char digits[] = "0123456789abcdef";
+		std::string s(36, '-');
+		unsigned int pos = 0;
+		for(unsigned int i=0;i<32;i++){
+			if(pos==8 || pos==13 || pos==18 || pos==23)
+				pos ++;
+			boost::uint64_t half = i < 16 ? id.hi : id.lo;
+			s[pos++] = digits[(half >> (60 - 4*(i%16))) & 0xf];
+		}
+		return s;
+	}
+
+	std::ostream& operator<<(std::ostream& os, const msg_id_t& id){
+		return os << to_string(id);
+	}
+}
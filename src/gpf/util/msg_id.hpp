@@ -0,0 +1,56 @@
+#ifndef __GPF_MSG_ID_HPP__
+#     define __GPF_MSG_ID_HPP__
+
+#include <string>
+#include <iosfwd>
+#include <boost/cstdint.hpp>
+
+namespace gpf
+{
+	/**
+	 * a message id, i.e. a UUID, in binary form.
+	 *
+	 * Ids arrive as text ("4b2c8a1e-6a3f-4c7d-9e0b-1f2a3b4c5d6e") and are
+	 * parsed once when a message enters the hub. Inside the hub they
+	 * are compared, ordered and hashed as two integers; they are turned
+	 * back into text only for replies to clients.
+	 *
+	 * hi holds the first 8 bytes, lo the last 8, both big endian, so
+	 * the ordering is the same as that of the lower case text form.
+	 */
+	struct msg_id_t{
+		boost::uint64_t hi;
+		boost::uint64_t lo;
+
+		msg_id_t():hi(0),lo(0){}
+		msg_id_t(boost::uint64_t h, boost::uint64_t l):hi(h),lo(l){}
+	};
+
+	inline bool operator==(const msg_id_t& a, const msg_id_t& b){ return a.hi == b.hi && a.lo == b.lo; }
+	inline bool operator!=(const msg_id_t& a, const msg_id_t& b){ return !(a == b); }
+	inline bool operator< (const msg_id_t& a, const msg_id_t& b){ return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo); }
+
+	/// for boost::hash and hashed indexes. UUIDs are random already, a cheap mix suffices.
+	inline std::size_t hash_value(const msg_id_t& id){
+		boost::uint64_t h = id.hi ^ (id.lo * 0x9e3779b97f4a7c15ULL);
+		return static_cast<std::size_t>(h ^ (h >> 32));
+	}
+
+	/**
+	 * parse the text form of a message id.
+	 *
+	 * Accepts 32 hex digits, optionally with dashes in the usual
+	 * 8-4-4-4-12 places, in either case.
+	 *
+	 * @return false if s is not a UUID (id is left unchanged)
+	 */
+	bool parse_msg_id(const char* s, std::size_t len, msg_id_t& id);
+	inline bool parse_msg_id(const std::string& s, msg_id_t& id){ return parse_msg_id(s.data(), s.size(), id); }
+
+	/// lower case text form with dashes
+	std::string to_string(const msg_id_t& id);
+
+	std::ostream& operator<<(std::ostream& os, const msg_id_t& id);
+}
+
+#endif /* __GPF_MSG_ID_HPP__ */
@@ -0,0 +1,42 @@
+#ifndef __GPF_TIME_HPP__
+#     define __GPF_TIME_HPP__
+
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace gpf
+{
+	/// the unix epoch
+	inline const boost::posix_time::ptime& epoch(){
+		static const boost::posix_time::ptime e(boost::gregorian::date(1970,1,1));
+		return e;
+	}
+
+	/// microseconds since the unix epoch, as used on the wire
+	inline boost::int64_t to_us(const boost::posix_time::ptime& t){
+		return (t - epoch()).total_microseconds();
+	}
+
+	/// inverse of to_us
+	inline boost::posix_time::ptime from_us(boost::int64_t us){
+		return epoch() + boost::posix_time::microseconds(us);
+	}
+
+	/**
+	 * read a time stamp from a message header.
+	 *
+	 * Uses the binary field if the sender set it, and falls back to
+	 * parsing the ISO string otherwise. Returns not_a_date_time if
+	 * neither is set.
+	 */
+	inline boost::posix_time::ptime wire_time(bool has_us, boost::int64_t us, const std::string& iso){
+		if(has_us)
+			return from_us(us);
+		if(iso.empty())
+			return boost::posix_time::ptime();
+		return boost::posix_time::from_iso_string(iso);
+	}
+}
+
+#endif /* __GPF_TIME_HPP__ */
@@ -1,5 +1,44 @@
+#ifndef __GPF_ZMQMESSAGE_HPP__
+#     define __GPF_ZMQMESSAGE_HPP__
+
 #define ZMQMESSAGE_LOG_STREAM VLOG(10)
 #define ZMQMESSAGE_LOG_TERM ""
 #include <glog/logging.h>
 #include <limits.h>
+#include <string>
 #include <ZmqMessage.hpp>
+
+namespace gpf
+{
+	/**
+	 * true if a message can be received from s without blocking.
+	 *
+	 * Uses ZMQ_EVENTS, so nothing is read from the socket.
+	 */
+	inline bool readable(zmq::socket_t& s){
+		int    events = 0;
+		size_t len    = sizeof(events);
+		s.getsockopt(ZMQ_EVENTS, &events, &len);
+		return events & ZMQ_POLLIN;
+	}
+
+	namespace detail
+	{
+		inline void delete_string(void*, void* hint){
+			delete static_cast<std::string*>(hint);
+		}
+	}
+
+	/**
+	 * make out send the bytes of s without copying them.
+	 *
+	 * s is left empty, its buffer is freed once zmq sent the frame.
+	 */
+	inline void move_to_frame(std::string& s, zmq::message_t& out){
+		std::string* owned = new std::string();
+		owned->swap(s);
+		out.rebuild(const_cast<char*>(owned->data()), owned->size(), detail::delete_string, owned);
+	}
+}
+
+#endif /* __GPF_ZMQMESSAGE_HPP__ */
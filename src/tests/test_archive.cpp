@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <boost/filesystem.hpp>
+#include <gpf/controller/archive.hpp>
+#include "test_records.hpp"
+
+using namespace gpf;
+namespace fs = boost::filesystem;
+
+static task_db::record_t make_record(int i){
+	task_db::record_t r = test::make_record("", "content");
+	r.set_submitted_us(1000+i);
+	if(i % 2 == 0){
+		r.set_eid(i % 3);
+		r.set_completed_us(2000+i);
+	}
+	return r;
+}
+
+TEST(archive_test, columns_and_records){
+	fs::path path = fs::temp_directory_path() / fs::unique_path();
+	{
+		archive_writer w(path.string(), 4);
+		ASSERT_TRUE(w.ok());
+		for(int i=0;i<10;i++)
+			w.add(msg_id_t(1,i), make_record(i));
+	}
+
+	archive_reader a(path.string());
+	ASSERT_TRUE(a.ok());
+	EXPECT_EQ(10u, a.size());
+	ASSERT_EQ(3u,  a.blocks());
+	EXPECT_EQ(2u,  a.block(2).size);
+
+	int i = 0;
+	for(std::size_t b=0;b<a.blocks();b++){
+		archive_reader::block_view v = a.block(b);
+		for(std::size_t k=0;k<v.size;k++,i++){
+			EXPECT_EQ(msg_id_t(1,i), v.id(k));
+			EXPECT_EQ(1000+i, v.submitted_us[k]);
+			EXPECT_EQ(archive_no_time, v.started_us[k]);
+			EXPECT_EQ(i % 2 ? archive_no_time : 2000+i, v.completed_us[k]);
+			EXPECT_EQ(i % 2 ? -1 : i % 3, v.eid[k]);
+		}
+	}
+
+	task_db::record_t r;
+	EXPECT_TRUE(a.record(1, 3, r));
+	EXPECT_EQ("content", r.content());
+	EXPECT_EQ(1007, r.submitted_us());
+	EXPECT_TRUE(a.record(0, 0, r));
+	EXPECT_EQ(1000, r.submitted_us());
+	EXPECT_FALSE(a.record(2, 2, r));
+	EXPECT_FALSE(a.record(3, 0, r));
+	fs::remove(path);
+}
+
+TEST(archive_test, export_db){
+	memory_task_db db;
+	for(int i=0;i<5;i++)
+		db.insert(msg_id_t(0,i), make_record(i));
+	fs::path path = fs::temp_directory_path() / fs::unique_path();
+	EXPECT_EQ(5u, export_archive(db, path.string()));
+
+	archive_reader a(path.string());
+	ASSERT_TRUE(a.ok());
+	ASSERT_EQ(1u, a.blocks());
+	EXPECT_EQ(msg_id_t(0,4), a.block(0).id(4));
+	fs::remove(path);
+}
+
+TEST(archive_test, truncated){
+	fs::path path = fs::temp_directory_path() / fs::unique_path();
+	{
+		archive_writer w(path.string());
+		for(int i=0;i<10;i++)
+			w.add(msg_id_t(0,i), make_record(i));
+	}
+	fs::resize_file(path, fs::file_size(path) - 1);
+	archive_reader a(path.string());
+	EXPECT_FALSE(a.ok());
+	fs::remove(path);
+}
@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+
+#include <gpf/controller/dag.hpp>
+
+using namespace gpf;
+
+TEST(dag_test, chain){
+	dependency_graph g;
+	msg_id_t a(0, 1), b(0, 2), c(0, 3);
+	EXPECT_TRUE(g.add(a, std::vector<msg_id_t>()));
+	EXPECT_FALSE(g.add(b, std::vector<msg_id_t>(1, a)));
+	EXPECT_FALSE(g.add(c, std::vector<msg_id_t>(1, b)));
+	EXPECT_EQ(2u, g.blocked());
+
+	std::vector<msg_id_t> ready;
+	g.completed(a, 4, ready);
+	ASSERT_EQ(1u, ready.size());
+	EXPECT_EQ(b, ready[0]);
+	EXPECT_EQ(4, g.engine(a));
+	EXPECT_EQ(-1, g.engine(b));
+
+	ready.clear();
+	g.completed(a, 4, ready); // twice, ignored
+	EXPECT_TRUE(ready.empty());
+	g.completed(b, 5, ready);
+	ASSERT_EQ(1u, ready.size());
+	EXPECT_EQ(c, ready[0]);
+	EXPECT_EQ(0u, g.blocked());
+	EXPECT_EQ(1u, g.pending());
+}
+
+TEST(dag_test, fan_in){
+	dependency_graph g;
+	std::vector<msg_id_t> deps;
+	for(int i=0;i<10;i++){
+		deps.push_back(msg_id_t(1, i));
+		g.add(deps.back(), std::vector<msg_id_t>());
+	}
+	// completed ones and unknown ones are met already
+	std::vector<msg_id_t> ready;
+	g.completed(deps[0], 1, ready);
+	deps.push_back(msg_id_t(7, 7));
+	msg_id_t join(2, 0);
+	EXPECT_FALSE(g.add(join, deps));
+	for(int i=1;i<10;i++){
+		EXPECT_TRUE(ready.empty());
+		g.completed(deps[i], 1, ready);
+	}
+	ASSERT_EQ(1u, ready.size());
+	EXPECT_EQ(join, ready[0]);
+}
+
+TEST(dag_test, forget){
+	dependency_graph g(2);
+	std::vector<msg_id_t> ready;
+	for(int i=0;i<4;i++){
+		g.add(msg_id_t(0, i), std::vector<msg_id_t>());
+		g.completed(msg_id_t(0, i), i, ready);
+	}
+	EXPECT_EQ(-1, g.engine(msg_id_t(0, 1)));
+	EXPECT_EQ(3,  g.engine(msg_id_t(0, 3)));
+	EXPECT_EQ(0u, g.pending());
+}
+
+TEST(dag_test, failed_while_blocked){
+	dependency_graph g;
+	msg_id_t a(0, 1), b(0, 2), c(0, 3);
+	g.add(a, std::vector<msg_id_t>());
+	EXPECT_FALSE(g.add(b, std::vector<msg_id_t>(1, a)));
+	EXPECT_FALSE(g.add(c, std::vector<msg_id_t>(1, b)));
+
+	// b misses its deadline before a completes
+	std::vector<msg_id_t> ready;
+	g.completed(b, -1, ready);
+	ASSERT_EQ(1u, ready.size());
+	EXPECT_EQ(c, ready[0]);
+	EXPECT_EQ(0u, g.blocked());
+
+	ready.clear();
+	g.completed(a, 1, ready);
+	EXPECT_TRUE(ready.empty());
+}
@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <gpf/controller/db.hpp>
+#include "test_records.hpp"
+
+using namespace gpf;
+
+static bool collect(std::vector<msg_id_t>& ids, std::size_t max, const msg_id_t& id, const task_db::record_t&){
+	ids.push_back(id);
+	return ids.size() < max;
+}
+
+static void exercise(task_db& db){
+	for(int i=0;i<10;i++)
+		db.insert(msg_id_t(0,i), test::make_record("", "content"));
+	EXPECT_EQ(10u, db.size());
+
+	task_db::record_t r;
+	EXPECT_TRUE (db.lookup(msg_id_t(0,3), r));
+	EXPECT_EQ("content", r.content());
+	EXPECT_FALSE(db.lookup(msg_id_t(1,3), r));
+
+	task_db::record_t upd;
+	upd.set_result_content("result");
+	EXPECT_TRUE (db.update(msg_id_t(0,3), upd));
+	EXPECT_FALSE(db.update(msg_id_t(1,3), upd));
+	EXPECT_TRUE (db.lookup(msg_id_t(0,3), r));
+	EXPECT_EQ("content", r.content());
+	EXPECT_EQ("result",  r.result_content());
+
+	EXPECT_TRUE (db.erase(msg_id_t(0,4)));
+	EXPECT_FALSE(db.erase(msg_id_t(0,4)));
+	EXPECT_EQ(9u, db.size());
+
+	std::vector<msg_id_t> ids;
+	EXPECT_EQ(4u, db.scan(msg_id_t(0,2), msg_id_t(0,7), boost::bind(collect, boost::ref(ids), 100, _1, _2)));
+	ASSERT_EQ(4u, ids.size());
+	EXPECT_EQ(msg_id_t(0,2), ids[0]);
+	EXPECT_EQ(msg_id_t(0,5), ids[2]); // 4 was erased
+
+	ids.clear();
+	EXPECT_EQ(2u, db.scan(msg_id_t(), msg_id_t(1,0), boost::bind(collect, boost::ref(ids), 2, _1, _2)));
+}
+
+TEST(db_test, dict_db_update){
+	dict_db<int, task_db::record_t> db;
+	db[1] = test::make_record("", "a");
+	task_db::record_t upd;
+	upd.set_result_content("b");
+	db.update(1, upd);
+	EXPECT_EQ("a", db[1].content());
+	EXPECT_EQ("b", db[1].result_content());
+	EXPECT_THROW(db.update(2, upd), std::runtime_error);
+}
+
+TEST(db_test, memory){
+	memory_task_db db;
+	exercise(db);
+	db.clear();
+	EXPECT_EQ(0u, db.size());
+}
+
+TEST(db_test, mmap){
+	boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+	{
+		mmap_task_db db(path.string(), 64); // small buffer, some records are read from the file
+		ASSERT_TRUE(db.ok());
+		exercise(db);
+	}
+	{
+		// replayed from the file
+		mmap_task_db db(path.string());
+		EXPECT_EQ(9u, db.size());
+		task_db::record_t r;
+		EXPECT_TRUE(db.lookup(msg_id_t(0,3), r));
+		EXPECT_EQ("result", r.result_content());
+		EXPECT_FALSE(db.lookup(msg_id_t(0,4), r));
+		db.clear();
+	}
+	{
+		mmap_task_db db(path.string());
+		EXPECT_EQ(0u, db.size());
+	}
+	boost::filesystem::remove(path);
+
+	EXPECT_FALSE(make_task_db("file:///nonexistent/dir/tasks"));
+	EXPECT_FALSE(make_task_db("bogus://"));
+	EXPECT_TRUE (make_task_db("memory://"));
+}
+
+TEST(db_test, mmap_compact){
+	boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+	boost::uint64_t dead;
+	{
+		mmap_task_db db(path.string(), 64, 1<<20);
+		for(int i=0;i<10;i++)
+			db.insert(msg_id_t(0,i), test::make_record("", "content"));
+		EXPECT_EQ(0u, db.dead_bytes());
+		task_db::record_t upd;
+		for(int i=0;i<10;i++){
+			upd.set_result_content("result " + boost::lexical_cast<std::string>(i));
+			db.update(msg_id_t(0,i), upd);
+		}
+		db.erase(msg_id_t(0,4));
+		dead = db.dead_bytes();
+		EXPECT_LT(0u, dead);
+		db.flush();
+		EXPECT_EQ(boost::filesystem::file_size(path), db.file_bytes());
+	}
+	{
+		// counted again on open
+		mmap_task_db db(path.string(), 64, 1<<20);
+		EXPECT_EQ(dead, db.dead_bytes());
+		boost::uint64_t before = db.file_bytes();
+		EXPECT_TRUE(db.compact());
+		EXPECT_EQ(0u, db.dead_bytes());
+		EXPECT_EQ(before - dead, db.file_bytes());
+		EXPECT_EQ(db.file_bytes(), boost::filesystem::file_size(path));
+		EXPECT_FALSE(boost::filesystem::exists(path.string() + ".tmp"));
+		task_db::record_t r;
+		EXPECT_TRUE(db.lookup(msg_id_t(0,3), r));
+		EXPECT_EQ("result 3", r.result_content());
+		// still writable
+		db.insert(msg_id_t(0,10), test::make_record("", "content"));
+	}
+	{
+		mmap_task_db db(path.string());
+		EXPECT_EQ(10u, db.size());
+		EXPECT_EQ(0u, db.dead_bytes());
+		task_db::record_t r;
+		EXPECT_TRUE(db.lookup(msg_id_t(0,9), r));
+		EXPECT_EQ("result 9", r.result_content());
+		EXPECT_FALSE(db.lookup(msg_id_t(0,4), r));
+		EXPECT_TRUE(db.lookup(msg_id_t(0,10), r));
+		db.clear();
+	}
+	{
+		// compacted on its own once the dead bytes dominate
+		mmap_task_db db(path.string(), 64, 256);
+		db.insert(msg_id_t(0,1), test::make_record("", "content"));
+		task_db::record_t upd;
+		for(int i=0;i<1000;i++){
+			upd.set_result_content(boost::lexical_cast<std::string>(i));
+			db.update(msg_id_t(0,1), upd);
+		}
+		EXPECT_GT(1024u, db.file_bytes());
+		task_db::record_t r;
+		EXPECT_TRUE(db.lookup(msg_id_t(0,1), r));
+		EXPECT_EQ("999", r.result_content());
+	}
+	boost::filesystem::remove(path);
+}
@@ -1,10 +1,13 @@
 #include <gtest/gtest.h>
 
 #include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
 #include <boost/thread.hpp>
 #include <gpf/controller/hub.hpp>
 #include <gpf/controller/hub_factory.hpp>
 #include <gpf/engine/engine.hpp>
+#include "test_records.hpp"
 
 TEST(hub_test, hub_init){
 	gpf::hub_factory hf(5000);
@@ -81,3 +84,278 @@ TEST(hub_test, engine_init){
 	EXPECT_EQ(hub->get_num_engines(), 0);
 
 }
+
+/// a client of the hub's query socket. The test thread runs the hub's reactor while it waits for replies.
+struct query_client{
+	zmq::context_t ctx;
+	zmq::socket_t  sock;
+	gpf::hub&      hub;
+	query_client(gpf::hub& h, const std::string& url)
+	: ctx(1), sock(ctx, ZMQ_DEALER), hub(h){
+		sock.connect(url.c_str());
+	}
+	void send(const std::string& topic, const google::protobuf::Message& header){
+		std::string frames[3] = { "", topic, header.SerializeAsString() };
+		for(int i=0;i<3;i++){
+			zmq::message_t m(frames[i].size());
+			memcpy(m.data(), frames[i].data(), frames[i].size());
+			sock.send(m, i<2 ? ZMQ_SNDMORE : 0);
+		}
+	}
+	/// topic, header and payload of the next reply, empty if none arrives within ms
+	std::vector<std::string> receive(int ms=1000){
+		std::vector<std::string> frames;
+		boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time()
+			+ boost::posix_time::milliseconds(ms);
+		while(boost::posix_time::microsec_clock::universal_time() < end){
+			zmq_pollitem_t item = { sock, 0, ZMQ_POLLIN, 0 };
+			if(zmq::poll(&item, 1, 0) > 0)
+				break;
+			hub.get_loop()(10000);
+		}
+		zmq_pollitem_t item = { sock, 0, ZMQ_POLLIN, 0 };
+		if(zmq::poll(&item, 1, 0) <= 0)
+			return frames;
+		int64_t more = 1;
+		while(more){
+			zmq::message_t m;
+			sock.recv(&m);
+			frames.push_back(std::string(static_cast<char*>(m.data()), m.size()));
+			size_t len = sizeof(more);
+			sock.getsockopt(ZMQ_RCVMORE, &more, &len);
+		}
+		frames.erase(frames.begin()); // delimiter
+		return frames;
+	}
+	bool page(const std::string& topic, gpf_hub::get_results_reply& r){
+		std::vector<std::string> frames = receive();
+		return frames.size() >= 2 && frames[0] == topic && r.ParseFromString(frames[1]);
+	}
+};
+
+static std::string test_id(int i){
+	return str(boost::format("00000000-0000-4000-8000-%012d") % i);
+}
+
+TEST(hub_test, result_stream){
+	gpf::hub_factory hf(5100);
+	hf.ip("127.0.0.1").transport("tcp");
+	boost::shared_ptr<gpf::hub> hub = hf.get();
+	query_client c(*hub, hub->get_client_info().hub_registration);
+
+	// the hub does not know these, they are streamed as UNKNOWN
+	gpf_hub::get_results_request req;
+	for(int i=0;i<5;i++)
+		req.add_msg_ids(test_id(i));
+	req.set_status_only(true);
+	req.set_page_size(2);
+	c.send("result_request", req);
+
+	gpf_hub::get_results_reply page;
+	ASSERT_TRUE(c.page("get_results_reply", page));
+	EXPECT_EQ(0u, page.page());
+	EXPECT_TRUE(page.more());
+	ASSERT_EQ(2, page.results_size());
+	EXPECT_EQ(test_id(0), page.results(0).msg_id());
+	EXPECT_EQ(gpf_hub::get_results_reply::UNKNOWN, page.results(0).status());
+	// no credit left
+	EXPECT_TRUE(c.receive(100).empty());
+
+	gpf_hub::get_results_request more;
+	more.set_stream(page.stream());
+	more.set_credit(5);
+	c.send("result_request", more);
+	ASSERT_TRUE(c.page("get_results_reply", page));
+	EXPECT_EQ(1u, page.page());
+	EXPECT_TRUE(page.more());
+	ASSERT_TRUE(c.page("get_results_reply", page));
+	EXPECT_EQ(2u, page.page());
+	EXPECT_FALSE(page.more());
+	ASSERT_EQ(1, page.results_size());
+	EXPECT_EQ(test_id(4), page.results(0).msg_id());
+
+	// the stream is gone once complete
+	c.send("result_request", more);
+	std::vector<std::string> reply = c.receive();
+	ASSERT_EQ(2u, reply.size());
+	EXPECT_NE(std::string::npos, reply[1].find("Unknown stream"));
+}
+
+TEST(hub_test, result_stream_cancel){
+	gpf::hub_factory hf(5200);
+	hf.ip("127.0.0.1").transport("tcp");
+	boost::shared_ptr<gpf::hub> hub = hf.get();
+	hub->set_stream_timeout(boost::posix_time::milliseconds(100));
+	query_client c(*hub, hub->get_client_info().hub_registration);
+
+	gpf_hub::get_results_request req;
+	for(int i=0;i<4;i++)
+		req.add_msg_ids(test_id(i));
+	req.set_status_only(true);
+	req.set_page_size(1);
+	c.send("result_request", req);
+	gpf_hub::get_results_reply page;
+	ASSERT_TRUE(c.page("get_results_reply", page));
+
+	gpf_hub::get_results_request cancel;
+	cancel.set_stream(page.stream());
+	cancel.set_cancel(true);
+	c.send("result_request", cancel);
+	ASSERT_TRUE(c.page("get_results_reply", page));
+	EXPECT_EQ(1u, page.page());
+	EXPECT_EQ(0, page.results_size());
+	c.send("result_request", cancel);
+	std::vector<std::string> reply = c.receive();
+	ASSERT_EQ(2u, reply.size());
+	EXPECT_NE(std::string::npos, reply[1].find("Unknown stream"));
+
+	// streams nobody asks for more of are dropped, without further requests
+	c.send("result_request", req);
+	ASSERT_TRUE(c.page("get_results_reply", page));
+	EXPECT_TRUE(c.receive(300).empty());
+	gpf_hub::get_results_request more;
+	more.set_stream(page.stream());
+	c.send("result_request", more);
+	reply = c.receive();
+	ASSERT_EQ(2u, reply.size());
+	EXPECT_NE(std::string::npos, reply[1].find("Unknown stream"));
+}
+
+TEST(hub_test, client_status_stream){
+	gpf::hub_factory hf(5300);
+	hf.ip("127.0.0.1").transport("tcp");
+	boost::shared_ptr<gpf::hub> hub = hf.get();
+
+	// submit through the task queue, no engine takes them
+	zmq::context_t ctx(1);
+	zmq::socket_t submitter(ctx, ZMQ_DEALER);
+	submitter.setsockopt(ZMQ_IDENTITY, "client-a", 8);
+	submitter.connect(hub->get_client_info().task.c_str());
+	for(int i=0;i<3;i++){
+		gpf_hub::intask h;
+		h.set_msg_id(test_id(i));
+		std::string frames[3] = { "", h.SerializeAsString(), "content" };
+		for(int f=0;f<3;f++){
+			zmq::message_t m(frames[f].size());
+			memcpy(m.data(), frames[f].data(), frames[f].size());
+			submitter.send(m, f<2 ? ZMQ_SNDMORE : 0);
+		}
+	}
+	query_client c(*hub, hub->get_client_info().hub_registration);
+	EXPECT_TRUE(c.receive(200).empty()); // lets the hub take them in
+	hub->sync_tasks();
+
+	gpf_hub::client_status_request req;
+	req.set_client_id("client-a");
+	req.set_batch(2);
+	c.send("client_request", req);
+	gpf_hub::get_results_reply page;
+	ASSERT_TRUE(c.page("client_status_reply", page));
+	EXPECT_EQ(2, page.results_size());
+	EXPECT_TRUE(page.more());
+	EXPECT_TRUE(c.receive(100).empty()); // waits for credit
+
+	gpf_hub::get_results_request more;
+	more.set_stream(page.stream());
+	c.send("result_request", more);
+	ASSERT_TRUE(c.page("client_status_reply", page));
+	ASSERT_EQ(1, page.results_size());
+	EXPECT_FALSE(page.more());
+	EXPECT_EQ(gpf_hub::get_results_reply::UNASSIGNED, page.results(0).status());
+}
+
+TEST(hub_test, purge_all){
+	gpf::hub_factory hf(5400);
+	hf.ip("127.0.0.1").transport("tcp");
+	boost::shared_ptr<gpf::hub> hub = hf.get();
+	boost::shared_ptr<gpf::memory_task_db> db(new gpf::memory_task_db());
+	hub->set_task_db(db);
+
+	// only in the db: evicted before, and stored by a later hub
+	gpf::task_db::record_t r = gpf::test::make_record(test_id(10));
+	r.set_arrival(1);
+	db->insert(gpf::msg_id_t(0, 10), r);
+	r.set_msg_id(test_id(11));
+	r.set_arrival(~0ULL);
+	db->insert(gpf::msg_id_t(0, 11), r);
+
+	zmq::context_t ctx(1);
+	zmq::socket_t submitter(ctx, ZMQ_DEALER);
+	submitter.connect(hub->get_client_info().task.c_str());
+	for(int i=0;i<3;i++){
+		gpf_hub::intask h;
+		h.set_msg_id(test_id(i));
+		std::string frames[3] = { "", h.SerializeAsString(), "content" };
+		for(int f=0;f<3;f++){
+			zmq::message_t m(frames[f].size());
+			memcpy(m.data(), frames[f].data(), frames[f].size());
+			submitter.send(m, f<2 ? ZMQ_SNDMORE : 0);
+		}
+	}
+	query_client c(*hub, hub->get_client_info().hub_registration);
+	EXPECT_TRUE(c.receive(200).empty()); // lets the hub take them in
+
+	gpf_hub::purge_results_request req;
+	req.set_all(true);
+	c.send("purge_request", req);
+	std::vector<std::string> reply = c.receive();
+	ASSERT_EQ(2u, reply.size());
+	EXPECT_EQ("purge_results_reply", reply[0]);
+	gpf_hub::purge_results_reply res;
+	ASSERT_TRUE(res.ParseFromString(reply[1]));
+	EXPECT_EQ(4u, res.purged());
+	EXPECT_EQ(1u, db->size());
+	EXPECT_TRUE(db->lookup(gpf::msg_id_t(0, 11), r));
+}
+
+TEST(hub_test, recover_keeps_results){
+	namespace fs = boost::filesystem;
+	fs::path dir = fs::temp_directory_path() / fs::unique_path();
+	fs::create_directories(dir);
+	std::string db_path = (dir / "tasks").string();
+	gpf::msg_id_t id;
+	ASSERT_TRUE(gpf::parse_msg_id(test_id(1), id));
+
+	// what a hub left behind: the result in the task db, how the task got there in the journal
+	{
+		gpf::mmap_task_db db(db_path);
+		ASSERT_TRUE(db.ok());
+		gpf::task_db::record_t r = gpf::test::make_record(test_id(1), "content");
+		r.add_result_buffers("result");
+		db.insert(id, r);
+		db.flush();
+
+		gpf::journal j((dir / "journal").string());
+		ASSERT_TRUE(j.ok());
+		gpf_hub::intask in;
+		in.set_msg_id(test_id(1));
+		in.set_eid(0);
+		std::string data = in.SerializeAsString();
+		j.append(gpf_hub::journal_entry::TASK_REQUEST, data.data(), data.size());
+		gpf_hub::outtask out;
+		out.set_msg_id(test_id(1));
+		out.set_eid(0);
+		data = out.SerializeAsString();
+		j.append(gpf_hub::journal_entry::TASK_RESULT, data.data(), data.size());
+		j.sync();
+	}
+
+	{
+		gpf::hub_factory hf(5500);
+		hf.ip("127.0.0.1").transport("tcp").database("file://" + db_path).journal_dir((dir / "journal").string());
+		boost::shared_ptr<gpf::hub> hub = hf.get();
+		query_client c(*hub, hub->get_client_info().hub_registration);
+
+		gpf_hub::get_results_request req;
+		req.add_msg_ids(test_id(1));
+		c.send("result_request", req);
+		std::vector<std::string> reply = c.receive();
+		ASSERT_EQ(3u, reply.size());
+		gpf_hub::get_results_reply res;
+		ASSERT_TRUE(res.ParseFromString(reply[1]));
+		ASSERT_EQ(1, res.results_size());
+		EXPECT_EQ(gpf_hub::get_results_reply::COMPLETED, res.results(0).status());
+		EXPECT_EQ("result", reply[2]);
+	}
+	fs::remove_all(dir);
+}
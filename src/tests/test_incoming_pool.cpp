@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+
+#include <gpf/util/incoming_pool.hpp>
+
+static void send_msg(zmq::socket_t& s){
+	ZmqMessage::Outgoing<ZmqMessage::SimpleRouting> msg(s, 0);
+	msg << "client-id" << "" << "intask" << "header" << ZmqMessage::Flush;
+}
+
+TEST(incoming_pool_test, reuse){
+	zmq::context_t ctx(1);
+	zmq::socket_t in (ctx, ZMQ_PAIR);
+	zmq::socket_t out(ctx, ZMQ_PAIR);
+	in.bind("inproc://incoming_pool_test");
+	out.connect("inproc://incoming_pool_test");
+
+	gpf::incoming_pool pool(2);
+	{
+		std::vector<gpf::incoming_msg_t> msgs;
+		for(int i=0;i<3;i++){
+			send_msg(out);
+			msgs.push_back(pool.make(in));
+			msgs.back()->receive_all();
+			EXPECT_EQ(2u, msgs.back()->size());
+		}
+		gpf::incoming_msg_t copy = msgs[0];
+		msgs.clear();
+		EXPECT_EQ(1u, pool.stats().in_use);
+	}
+	gpf::incoming_pool::stats_t st = pool.stats();
+	EXPECT_EQ(3u, st.acquired);
+	EXPECT_EQ(3u, st.allocated);
+	EXPECT_EQ(0u, st.in_use);
+	EXPECT_EQ(2u, st.free); // max_free
+
+	send_msg(out);
+	gpf::incoming_msg_t m = pool.make(in);
+	m->receive_all();
+	st = pool.stats();
+	EXPECT_EQ(4u, st.acquired);
+	EXPECT_EQ(3u, st.allocated); // reused
+	EXPECT_EQ(1u, st.free);
+}
+
+TEST(incoming_pool_test, share_frame){
+	zmq::context_t ctx(1);
+	zmq::socket_t in (ctx, ZMQ_PAIR);
+	zmq::socket_t out(ctx, ZMQ_PAIR);
+	in.bind("inproc://incoming_pool_share");
+	out.connect("inproc://incoming_pool_share");
+
+	gpf::incoming_pool pool(2);
+	send_msg(out);
+	gpf::incoming_msg_t m = pool.make(in);
+	m->receive_all();
+	{
+		zmq::message_t shared;
+		gpf::share_frame(m, 1, shared);
+		EXPECT_EQ((*m)[1].data(), shared.data()); // not copied
+		EXPECT_EQ((*m)[1].size(), shared.size());
+		m.reset();
+		EXPECT_EQ(1u, pool.stats().in_use);   // held by the frame
+		EXPECT_EQ("header", std::string(static_cast<char*>(shared.data()), shared.size()));
+	}
+	EXPECT_EQ(0u, pool.stats().in_use);
+
+	std::string s("payload");
+	zmq::message_t moved;
+	gpf::move_to_frame(s, moved);
+	EXPECT_TRUE(s.empty());
+	EXPECT_EQ("payload", std::string(static_cast<char*>(moved.data()), moved.size()));
+}
@@ -0,0 +1,267 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <gpf/controller/journal.hpp>
+#include <gpf/controller/task_set.hpp>
+#include <gpf/util/time.hpp>
+#include "test_records.hpp"
+
+using namespace gpf;
+namespace fs = boost::filesystem;
+
+struct recovered{
+	std::vector<int>         snapshot_eids;
+	std::vector<std::string> entries;
+	std::vector<std::string> tasks;
+	unsigned int             chunks;
+	recovered():chunks(0){}
+	void restore(const journal::snapshot_t& s){
+		chunks ++;
+		for(int i=0;i<s.engines_size();i++)
+			snapshot_eids.push_back(s.engines(i).eid());
+		for(int i=0;i<s.tasks_size();i++)
+			tasks.push_back(s.tasks(i).msg_id());
+	}
+	void replay(const journal::entry_t& e){ entries.push_back(e.data()); }
+};
+
+static void recover(const fs::path& dir, recovered& r){
+	journal j(dir.string());
+	ASSERT_TRUE(j.ok());
+	j.recover(boost::bind(&recovered::restore, &r, _1), boost::bind(&recovered::replay, &r, _1));
+}
+
+TEST(journal_test, replay_and_snapshot){
+	fs::path dir = fs::temp_directory_path() / fs::unique_path();
+	{
+		journal j(dir.string());
+		ASSERT_TRUE(j.ok());
+		for(int i=0;i<100;i++)
+			j.append(gpf_hub::journal_entry::TASK_REQUEST, "a", 1);
+		j.sync();
+		journal::stats_t st = j.stats();
+		EXPECT_EQ(100u, st.entries);
+		EXPECT_GE(100u, st.commits);  // grouped
+		EXPECT_LT(0u,   st.commits);
+	}
+	{
+		recovered r;
+		recover(dir, r);
+		EXPECT_EQ(100u, r.entries.size());
+		EXPECT_TRUE(r.snapshot_eids.empty());
+	}
+	{
+		journal j(dir.string());
+		journal::snapshot_t s;
+		s.add_engines()->set_eid(7);
+		s.mutable_engines(0)->set_heartbeat("h");
+		s.mutable_engines(0)->set_queue("q");
+		j.snapshot(s);
+		j.append(gpf_hub::journal_entry::TASK_RESULT, "tail", 4);
+	}
+	{
+		// only the tail after the snapshot is replayed
+		recovered r;
+		recover(dir, r);
+		ASSERT_EQ(1u, r.snapshot_eids.size());
+		EXPECT_EQ(7, r.snapshot_eids[0]);
+		ASSERT_EQ(1u, r.entries.size());
+		EXPECT_EQ("tail", r.entries[0]);
+	}
+	fs::remove_all(dir);
+}
+
+static void add_task(journal::snapshot_t& s, int i){
+	test::init_record(*s.add_tasks(), boost::lexical_cast<std::string>(i));
+}
+
+TEST(journal_test, chunked_snapshot){
+	fs::path dir = fs::temp_directory_path() / fs::unique_path();
+	{
+		journal j(dir.string());
+		j.append(gpf_hub::journal_entry::TASK_REQUEST, "a", 1);
+		journal::snapshot_t s;
+		s.add_engines()->set_eid(7);
+		s.mutable_engines(0)->set_heartbeat("h");
+		s.mutable_engines(0)->set_queue("q");
+		for(int i=0;i<2*journal::snapshot_chunk+1;i++)
+			add_task(s, i);
+		EXPECT_TRUE(j.snapshot(s));
+		j.append(gpf_hub::journal_entry::TASK_RESULT, "tail", 4);
+	}
+	recovered r;
+	recover(dir, r);
+	EXPECT_EQ(4u, r.chunks); // engines, then the tasks in three chunks
+	ASSERT_EQ(1u, r.snapshot_eids.size());
+	ASSERT_EQ(2u*journal::snapshot_chunk+1, r.tasks.size());
+	EXPECT_EQ("0", r.tasks.front());
+	ASSERT_EQ(1u, r.entries.size());
+	EXPECT_EQ("tail", r.entries[0]);
+	fs::remove_all(dir);
+}
+
+TEST(journal_test, snapshot_parts){
+	fs::path dir = fs::temp_directory_path() / fs::unique_path();
+	{
+		journal j(dir.string());
+		j.append(gpf_hub::journal_entry::TASK_REQUEST, "a", 1);
+		journal::snapshot_t head;
+		journal::snapshot_writer_ptr w = j.begin_snapshot(head, 2);
+		ASSERT_TRUE(w.get() != NULL);
+		EXPECT_EQ(2u, head.log_seq());
+		// entries appended now are after the snapshot
+		j.append(gpf_hub::journal_entry::TASK_RESULT, "b", 1);
+		journal::snapshot_t dummy;
+		EXPECT_FALSE(j.begin_snapshot(dummy, 1)); // one at a time
+
+		boost::thread part([&](){
+			journal::snapshot_t chunk;
+			add_task(chunk, 1);
+			w->write(chunk);
+			w->done();
+		});
+		journal::snapshot_t chunk;
+		add_task(chunk, 2);
+		w->write(chunk);
+		w->done();
+		part.join();
+		EXPECT_TRUE(w->ok());
+		// kept for a fallback until the next snapshot
+		EXPECT_TRUE(fs::exists(dir / "journal.1"));
+	}
+	recovered r;
+	recover(dir, r);
+	EXPECT_EQ(2u, r.tasks.size());
+	ASSERT_EQ(1u, r.entries.size());
+	EXPECT_EQ("b", r.entries[0]);
+	fs::remove_all(dir);
+}
+
+TEST(journal_test, failed_snapshot){
+	fs::path dir = fs::temp_directory_path() / fs::unique_path();
+	{
+		journal j(dir.string());
+		j.append(gpf_hub::journal_entry::TASK_REQUEST, "a", 1);
+		// the snapshot cannot be renamed into place
+		fs::create_directories(dir / "snapshot" / "x");
+		journal::snapshot_t s;
+		add_task(s, 1);
+		EXPECT_FALSE(j.snapshot(s));
+		j.append(gpf_hub::journal_entry::TASK_RESULT, "b", 1);
+		j.sync();
+	}
+	// the journal up to the failed snapshot is still there
+	EXPECT_TRUE(fs::exists(dir / "journal.1"));
+	EXPECT_FALSE(fs::exists(dir / "snapshot.tmp"));
+	fs::remove_all(dir / "snapshot");
+	recovered r;
+	recover(dir, r);
+	EXPECT_TRUE(r.tasks.empty());
+	ASSERT_EQ(2u, r.entries.size());
+	EXPECT_EQ("a", r.entries[0]);
+	EXPECT_EQ("b", r.entries[1]);
+	fs::remove_all(dir);
+}
+
+static void snapshot_engine(journal& j, int eid){
+	journal::snapshot_t s;
+	s.add_engines()->set_eid(eid);
+	s.mutable_engines(0)->set_heartbeat("h");
+	s.mutable_engines(0)->set_queue("q");
+	EXPECT_TRUE(j.snapshot(s));
+}
+
+static void corrupt(const fs::path& file){
+	std::fstream f(file.string().c_str(), std::ios::in | std::ios::out | std::ios::binary);
+	f.seekp(-1, std::ios::end);
+	f.put('x');
+}
+
+TEST(journal_test, corrupt_snapshot){
+	fs::path dir = fs::temp_directory_path() / fs::unique_path();
+	{
+		journal j(dir.string());
+		j.append(gpf_hub::journal_entry::TASK_REQUEST, "a", 1);
+		snapshot_engine(j, 1);
+		j.append(gpf_hub::journal_entry::TASK_REQUEST, "b", 1);
+		snapshot_engine(j, 2);
+		j.append(gpf_hub::journal_entry::TASK_RESULT, "c", 1);
+		j.sync();
+	}
+	// the segments before the previous snapshot are gone
+	EXPECT_FALSE(fs::exists(dir / "journal.1"));
+	EXPECT_TRUE(fs::exists(dir / "journal.2"));
+	EXPECT_TRUE(fs::exists(dir / "snapshot.old"));
+	{
+		recovered r;
+		recover(dir, r);
+		ASSERT_EQ(1u, r.snapshot_eids.size());
+		EXPECT_EQ(2, r.snapshot_eids[0]);
+		ASSERT_EQ(1u, r.entries.size());
+	}
+	{
+		// falls back to the previous snapshot and the segments since
+		corrupt(dir / "snapshot");
+		recovered r;
+		recover(dir, r);
+		ASSERT_EQ(1u, r.snapshot_eids.size());
+		EXPECT_EQ(1, r.snapshot_eids[0]);
+		ASSERT_EQ(2u, r.entries.size());
+		EXPECT_EQ("b", r.entries[0]);
+		EXPECT_EQ("c", r.entries[1]);
+	}
+	{
+		// nothing to restore, only what is left of the journal
+		corrupt(dir / "snapshot.old");
+		recovered r;
+		recover(dir, r);
+		EXPECT_TRUE(r.snapshot_eids.empty());
+		ASSERT_EQ(2u, r.entries.size());
+	}
+	fs::remove_all(dir);
+}
+
+TEST(journal_test, torn_tail){
+	fs::path dir = fs::temp_directory_path() / fs::unique_path();
+	{
+		journal j(dir.string());
+		j.append(gpf_hub::journal_entry::TASK_REQUEST, "a", 1);
+		j.append(gpf_hub::journal_entry::TASK_REQUEST, "b", 1);
+	}
+	{
+		// cut the last entry in half
+		fs::path seg = dir / "journal.1";
+		fs::resize_file(seg, fs::file_size(seg) - 3);
+	}
+	recovered r;
+	recover(dir, r);
+	ASSERT_EQ(1u, r.entries.size());
+	EXPECT_EQ("a", r.entries[0]);
+	fs::remove_all(dir);
+}
+
+TEST(journal_test, task_restore){
+	task_tracker tt;
+	gpf_hub::intask req;
+	req.set_msg_id("00000000-0000-4000-8000-00000000000a");
+	req.set_eid(3);
+	req.set_submitted_us(1000);
+	tt.task_request(req, incoming_msg_t());
+
+	task_db::record_t rec;
+	to_record(*tt.tasks.begin(), rec, false);
+
+	task_tracker restored;
+	restored.restore(rec);
+	ASSERT_EQ(1u, restored.tasks.size());
+	const task& t = *restored.tasks.begin();
+	EXPECT_EQ(tt.tasks.begin()->id, t.id);
+	EXPECT_EQ(TASK_PENDING, t.state);
+	EXPECT_EQ(3, t.engine_uuid);
+	EXPECT_EQ(from_us(1000), t.submitted);
+	EXPECT_EQ(1u, restored.count(TASK_PENDING));
+}
@@ -0,0 +1,46 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <boost/functional/hash.hpp>
+#include <gpf/util/msg_id.hpp>
+
+using namespace gpf;
+
+TEST(msg_id_test, parse){
+	msg_id_t id, plain, upper;
+	ASSERT_TRUE(parse_msg_id("4b2c8a1e-6a3f-4c7d-9e0b-1f2a3b4c5d6e", id));
+	EXPECT_EQ(0x4b2c8a1e6a3f4c7dULL, id.hi);
+	EXPECT_EQ(0x9e0b1f2a3b4c5d6eULL, id.lo);
+
+	ASSERT_TRUE(parse_msg_id("4b2c8a1e6a3f4c7d9e0b1f2a3b4c5d6e", plain));
+	ASSERT_TRUE(parse_msg_id("4B2C8A1E-6A3F-4C7D-9E0B-1F2A3B4C5D6E", upper));
+	EXPECT_EQ(id, plain);
+	EXPECT_EQ(id, upper);
+	EXPECT_EQ(boost::hash<msg_id_t>()(id), boost::hash<msg_id_t>()(upper));
+
+	EXPECT_FALSE(parse_msg_id("", id));
+	EXPECT_FALSE(parse_msg_id("4b2c8a1e-6a3f-4c7d-9e0b-1f2a3b4c5d6", id));
+	EXPECT_FALSE(parse_msg_id("4b2c8a1e_6a3f-4c7d-9e0b-1f2a3b4c5d6e", id));
+	EXPECT_FALSE(parse_msg_id("4b2c8a1e-6a3f-4c7d-9e0b-1f2a3b4c5d6g", id));
+}
+
+TEST(msg_id_test, to_string){
+	msg_id_t id;
+	ASSERT_TRUE(parse_msg_id("4B2C8A1E-6A3F-4C7D-9E0B-1F2A3B4C5D6E", id));
+	EXPECT_EQ("4b2c8a1e-6a3f-4c7d-9e0b-1f2a3b4c5d6e", to_string(id));
+	EXPECT_EQ("00000000-0000-0000-0000-000000000000", to_string(msg_id_t()));
+
+	std::ostringstream os;
+	os << id;
+	EXPECT_EQ(to_string(id), os.str());
+}
+
+TEST(msg_id_test, order){
+	msg_id_t a, b;
+	ASSERT_TRUE(parse_msg_id("0fffffff-ffff-ffff-ffff-ffffffffffff", a));
+	ASSERT_TRUE(parse_msg_id("10000000-0000-0000-0000-000000000000", b));
+	EXPECT_TRUE(a < b);
+	EXPECT_FALSE(b < a);
+	EXPECT_TRUE(a != b);
+	EXPECT_TRUE(msg_id_t(1,0) < msg_id_t(1,1));
+}
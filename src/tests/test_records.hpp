@@ -0,0 +1,29 @@
+#ifndef __GPF_TEST_RECORDS_HPP__
+#     define __GPF_TEST_RECORDS_HPP__
+
+#include <string>
+#include <gpf/controller/db.hpp>
+
+namespace gpf
+{
+	namespace test
+	{
+		/// set the required fields of a task record, the rest is left alone
+		inline void init_record(task_db::record_t& r, const std::string& msg_id="", const std::string& content=""){
+			r.set_msg_id(msg_id);
+			r.set_client_uuid("");
+			r.mutable_headers();
+			r.set_content(content);
+			r.set_submitted("");
+		}
+
+		/// a task record with only the required fields
+		inline task_db::record_t make_record(const std::string& msg_id="", const std::string& content=""){
+			task_db::record_t r;
+			init_record(r, msg_id, content);
+			return r;
+		}
+	}
+}
+
+#endif /* __GPF_TEST_RECORDS_HPP__ */
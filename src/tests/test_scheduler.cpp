@@ -0,0 +1,529 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <cstring>
+#include <boost/format.hpp>
+
+#include <gpf/controller/scheduler.hpp>
+#include <gpf/messages/hub.pb.h>
+#include <gpf/util/time.hpp>
+
+using namespace gpf;
+
+TEST(scheduler_test, parse_scheme){
+	engine_chooser::scheme_t s;
+	EXPECT_TRUE(engine_chooser::parse_scheme("default", s));
+	EXPECT_EQ(engine_chooser::LEAST_LOAD, s);
+	EXPECT_TRUE(engine_chooser::parse_scheme("twobin", s));
+	EXPECT_EQ(engine_chooser::TWO_CHOICE, s);
+	EXPECT_STREQ("lru", engine_chooser::scheme_name(engine_chooser::LRU));
+	EXPECT_FALSE(engine_chooser::parse_scheme("pure", s));
+}
+
+TEST(scheduler_test, least_load){
+	engine_chooser c(engine_chooser::LEAST_LOAD);
+	EXPECT_EQ(-1, c.choose());
+	c.add(1);
+	c.add(2);
+	c.add(3);
+	c.assigned(1);
+	c.assigned(2);
+	EXPECT_EQ(3, c.choose());
+	c.assigned(3);
+	c.assigned(3);
+	c.finished(1);
+	EXPECT_EQ(1, c.choose());
+	EXPECT_EQ(2u, c.outstanding(3));
+}
+
+TEST(scheduler_test, lru){
+	engine_chooser c(engine_chooser::LRU);
+	c.add(1);
+	c.add(2);
+	c.add(3);
+	for(int i=0;i<6;i++){
+		int eid = c.choose();
+		EXPECT_EQ(i%3+1, eid);
+		c.assigned(eid);
+	}
+	// outstanding tasks do not matter
+	c.finished(1);
+	c.finished(1);
+	EXPECT_EQ(1, c.choose());
+}
+
+TEST(scheduler_test, hwm){
+	engine_chooser c(engine_chooser::LEAST_LOAD);
+	c.set_hwm(2);
+	c.add(1);
+	c.add(2);
+	for(int i=0;i<4;i++)
+		c.assigned(c.choose());
+	EXPECT_EQ(-1, c.choose());
+	c.finished(2);
+	EXPECT_EQ(2, c.choose());
+}
+
+TEST(scheduler_test, weighted){
+	engine_chooser c(engine_chooser::WEIGHTED);
+	c.seed(42);
+	c.add(1);
+	c.add(2);
+	c.add(3);
+	c.set_weight(1, 3.);
+	c.set_weight(2, 1.);
+	c.set_weight(3, 0.);
+	std::map<int, int> n;
+	for(int i=0;i<4000;i++)
+		n[c.choose()]++;
+	EXPECT_EQ(0, n[3]);
+	EXPECT_NEAR(3000, n[1], 150);
+	EXPECT_NEAR(1000, n[2], 150);
+
+	// outstanding tasks make engines less likely
+	for(int i=0;i<5;i++)
+		c.assigned(1);
+	n.clear();
+	for(int i=0;i<4000;i++)
+		n[c.choose()]++;
+	EXPECT_GT(n[2], n[1]);
+}
+
+TEST(scheduler_test, two_choice){
+	engine_chooser c(engine_chooser::TWO_CHOICE);
+	c.seed(7);
+	for(int i=0;i<10;i++)
+		c.add(i);
+	for(int i=0;i<1000;i++)
+		c.assigned(c.choose());
+	unsigned int lo = 1000, hi = 0;
+	for(int i=0;i<10;i++){
+		lo = std::min(lo, c.outstanding(i));
+		hi = std::max(hi, c.outstanding(i));
+	}
+	EXPECT_LE(hi - lo, 10u);
+}
+
+TEST(scheduler_test, remove){
+	engine_chooser c(engine_chooser::LEAST_LOAD);
+	c.add(1);
+	c.add(2);
+	c.add(3);
+	c.assigned(2);
+	c.assigned(3);
+	c.remove(1);
+	EXPECT_FALSE(c.has(1));
+	EXPECT_EQ(2u, c.size());
+	EXPECT_EQ(2, c.choose());
+	EXPECT_EQ(1u, c.outstanding(3));
+	c.finished(1); // gone, ignored
+	c.remove(2);
+	c.remove(3);
+	EXPECT_EQ(-1, c.choose());
+}
+
+TEST(scheduler_test, service_index){
+	engine_tracker tracker;
+	engine_connector a, b;
+	a.id = 1;
+	a.services.push_back("fft");
+	a.services.push_back("render");
+	b.id = 2;
+	b.services.push_back("fft");
+	tracker.add_services(a);
+	tracker.add_services(b);
+
+	auto r = tracker.offering("fft");
+	EXPECT_EQ(2, std::distance(r.first, r.second));
+	r = tracker.offering("render");
+	ASSERT_EQ(1, std::distance(r.first, r.second));
+	EXPECT_EQ(1, r.first->second);
+	r = tracker.offering("none");
+	EXPECT_TRUE(r.first == r.second);
+
+	tracker.remove_services(a);
+	r = tracker.offering("fft");
+	ASSERT_EQ(1, std::distance(r.first, r.second));
+	EXPECT_EQ(2, r.first->second);
+	EXPECT_TRUE(tracker.offering("render").first == tracker.offering("render").second);
+
+	engine_chooser c;
+	c.set_hwm(1);
+	c.add(2);
+	EXPECT_TRUE(c.can_take(2));
+	c.assigned(2);
+	EXPECT_FALSE(c.can_take(2));
+	EXPECT_FALSE(c.can_take(1));
+}
+
+/// a task_scheduler on inproc sockets, with one client and engines the test answers for
+struct scheduler_fixture{
+	typedef boost::shared_ptr<zmq::socket_t> socket_ptr;
+	zmq::context_t         ctx;
+	zmq_reactor::reactor   loop;
+	socket_ptr             from_clients;
+	socket_ptr             from_engines;
+	socket_ptr             monitor;
+	task_scheduler         sched;
+	zmq::socket_t          client;
+	std::map<int, socket_ptr> engines;
+
+	scheduler_fixture(unsigned int prefetch)
+	: ctx(1), loop(ctx)
+	, from_clients(bound(ZMQ_ROUTER, "inproc://sched-client"))
+	, from_engines(bound(ZMQ_ROUTER, "inproc://sched-engine"))
+	, monitor(new zmq::socket_t(ctx, ZMQ_PUB))
+	, sched(loop, from_clients, from_engines, monitor, engine_chooser::LEAST_LOAD)
+	, client(ctx, ZMQ_DEALER)
+	{
+		sched.set_prefetch(prefetch);
+		client.setsockopt(ZMQ_IDENTITY, "client", 6);
+		client.connect("inproc://sched-client");
+		// keeps the reactor from waiting for sockets only
+		loop.add(deadline_timer(boost::posix_time::hours(1), deadline_timer::callback_t()));
+	}
+	socket_ptr bound(int type, const char* url){
+		socket_ptr s(new zmq::socket_t(ctx, type));
+		s->bind(url);
+		return s;
+	}
+	static void send(zmq::socket_t& s, const std::string* frames, int n){
+		for(int i=0;i<n;i++){
+			zmq::message_t m(frames[i].size());
+			memcpy(m.data(), frames[i].data(), frames[i].size());
+			s.send(m, i<n-1 ? ZMQ_SNDMORE : 0);
+		}
+	}
+	static std::vector<std::string> receive(zmq::socket_t& s){
+		std::vector<std::string> frames;
+		int64_t more = 1;
+		while(more){
+			zmq::message_t m;
+			s.recv(&m);
+			frames.push_back(std::string(static_cast<char*>(m.data()), m.size()));
+			size_t len = sizeof(more);
+			s.getsockopt(ZMQ_RCVMORE, &more, &len);
+		}
+		return frames;
+	}
+	static bool readable(zmq::socket_t& s){
+		zmq_pollitem_t item = { s, 0, ZMQ_POLLIN, 0 };
+		return zmq::poll(&item, 1, 0) > 0;
+	}
+	/// let the scheduler take in everything sent to it
+	void run(){
+		while(readable(*from_clients) || readable(*from_engines))
+			loop(0);
+	}
+	/// run the reactor until the client got something, at most ms
+	bool wait_for_client(int ms){
+		boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time()
+			+ boost::posix_time::milliseconds(ms);
+		while(!readable(client) && boost::posix_time::microsec_clock::universal_time() < end)
+			loop(1000);
+		return readable(client);
+	}
+
+	void add_engine(int eid){
+		std::string queue = str(boost::format("engine-%d") % eid);
+		socket_ptr e(new zmq::socket_t(ctx, ZMQ_DEALER));
+		e->setsockopt(ZMQ_IDENTITY, queue.data(), queue.size());
+		e->connect("inproc://sched-engine");
+		engines[eid] = e;
+		sched.add_engine(eid, queue);
+	}
+	/// task i, running after task `after' or on the engine that ran `follow'
+	void submit(int i, int after=-1, int follow=-1){
+		gpf_hub::intask h = header(i);
+		if(after >= 0)
+			h.add_after(id(after));
+		if(follow >= 0)
+			h.add_follow(id(follow));
+		submit(h);
+	}
+	void submit(const gpf_hub::intask& h){
+		std::string frames[3] = { "", h.SerializeAsString(), "payload" };
+		send(client, frames, 3);
+		run();
+	}
+	static gpf_hub::intask header(int i){
+		gpf_hub::intask h;
+		h.set_msg_id(id(i));
+		return h;
+	}
+	/// task i, failed if it is not sent within ms
+	static gpf_hub::intask with_deadline(int i, int ms){
+		gpf_hub::intask h = header(i);
+		h.set_deadline_us(to_us(boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(ms)));
+		return h;
+	}
+	/// msg_ids of the failed tasks the client was told about so far
+	std::vector<std::string> failed(){
+		std::vector<std::string> ids;
+		while(readable(client)){
+			std::vector<std::string> frames = receive(client);
+			gpf_hub::outtask h;
+			if(frames.size() >= 2 && h.ParseFromString(frames[1]) && h.has_error())
+				ids.push_back(h.msg_id());
+		}
+		return ids;
+	}
+	/// msg_ids of the tasks eid got so far, in order
+	std::vector<std::string> received(int eid){
+		std::vector<std::string> ids;
+		while(readable(*engines[eid])){
+			std::vector<std::string> frames = receive(*engines[eid]);
+			gpf_hub::intask h;
+			if(frames.size() >= 3 && h.ParseFromString(frames[2]))
+				ids.push_back(h.msg_id());
+		}
+		return ids;
+	}
+	/// eid returns the result of task i
+	void reply(int eid, int i){
+		gpf_hub::outtask h;
+		h.set_msg_id(id(i));
+		h.set_eid(eid);
+		std::string frames[3] = { "client", "", h.SerializeAsString() };
+		send(*engines[eid], frames, 3);
+		run();
+	}
+	static std::string id(int i){
+		return str(boost::format("00000000-0000-4000-8000-%012d") % i);
+	}
+};
+
+static std::vector<std::string> ids(int a, int b=-1, int c=-1){
+	std::vector<std::string> r;
+	int all[3] = { a, b, c };
+	for(int i=0;i<3 && all[i]>=0;i++)
+		r.push_back(scheduler_fixture::id(all[i]));
+	return r;
+}
+
+TEST(scheduler_test, prefetch_backlog){
+	scheduler_fixture f(1);
+	f.add_engine(1);
+	f.add_engine(2);
+	// leastload alternates, each engine is sent one task, the others wait in its backlog
+	for(int i=0;i<4;i++)
+		f.submit(i);
+	EXPECT_EQ(ids(0), f.received(1));
+	EXPECT_EQ(ids(1), f.received(2));
+	EXPECT_EQ(2u, f.sched.chooser().outstanding(1));
+	EXPECT_EQ(2u, f.sched.chooser().outstanding(2));
+
+	// a result makes room for the next task of the backlog
+	f.reply(1, 0);
+	EXPECT_EQ(ids(2), f.received(1));
+	EXPECT_EQ(1u, f.sched.chooser().outstanding(1));
+
+	// with its own backlog empty, engine 1 steals from engine 2
+	f.reply(1, 2);
+	EXPECT_EQ(ids(3), f.received(1));
+	EXPECT_EQ(1u, f.sched.steals());
+	EXPECT_EQ(1u, f.sched.chooser().outstanding(1));
+	EXPECT_EQ(1u, f.sched.chooser().outstanding(2));
+
+	f.reply(1, 3);
+	f.reply(2, 1);
+	EXPECT_TRUE(f.received(1).empty());
+	EXPECT_TRUE(f.received(2).empty());
+	EXPECT_EQ(0u, f.sched.chooser().outstanding(1));
+	EXPECT_EQ(0u, f.sched.chooser().outstanding(2));
+}
+
+TEST(scheduler_test, steal_longest_backlog){
+	scheduler_fixture f(1);
+	f.add_engine(1);
+	f.add_engine(2);
+	// backlogs: engine 1 has 2 and 4, engine 2 has 3
+	for(int i=0;i<5;i++)
+		f.submit(i);
+	f.received(1);
+	f.received(2);
+
+	// a new engine takes the newest task of the longest backlog
+	f.add_engine(3);
+	EXPECT_EQ(ids(4), f.received(3));
+	// both are as long now, then it is the other one's turn
+	f.reply(3, 4);
+	EXPECT_EQ(ids(3), f.received(3));
+	f.reply(3, 3);
+	EXPECT_EQ(ids(2), f.received(3));
+	f.reply(3, 2);
+	EXPECT_TRUE(f.received(3).empty());
+	EXPECT_EQ(3u, f.sched.steals());
+	EXPECT_EQ(1u, f.sched.chooser().outstanding(1));
+	EXPECT_EQ(1u, f.sched.chooser().outstanding(2));
+}
+
+TEST(scheduler_test, remove_engine_backlog){
+	scheduler_fixture f(1);
+	f.add_engine(1);
+	f.add_engine(2);
+	for(int i=0;i<4;i++)
+		f.submit(i);
+	f.received(1);
+	EXPECT_EQ(ids(1), f.received(2));
+
+	// the backlog of a dead engine goes to the others, its sent task does not
+	f.sched.remove_engine(2);
+	EXPECT_TRUE(f.received(1).empty());
+	EXPECT_EQ(3u, f.sched.chooser().outstanding(1));
+	f.reply(1, 0);
+	f.reply(1, 2);
+	f.reply(1, 3);
+	EXPECT_EQ(ids(2, 3), f.received(1));
+	EXPECT_EQ(0u, f.sched.chooser().outstanding(1));
+	EXPECT_EQ(0u, f.sched.steals());
+}
+
+TEST(scheduler_test, steal_skips_follow){
+	scheduler_fixture f(1);
+	f.add_engine(1);
+	f.add_engine(2);
+	f.add_engine(3);
+	f.submit(0);
+	f.reply(1, 0);
+	// 1, 2 and 3 have to run on engine 1
+	for(int i=1;i<=3;i++)
+		f.submit(i, -1, 0);
+	EXPECT_EQ(ids(0, 1), f.received(1));
+	f.submit(4);
+	f.submit(5);
+	f.submit(6);
+	EXPECT_EQ(ids(4), f.received(2));
+
+	// engine 1 has the longest backlog, but engine 3 may only take from engine 2's
+	f.reply(3, 5);
+	EXPECT_EQ(ids(5, 6), f.received(3));
+	EXPECT_EQ(1u, f.sched.steals());
+	f.reply(3, 6);
+	EXPECT_TRUE(f.received(3).empty());
+
+	f.reply(1, 1);
+	f.reply(1, 2);
+	EXPECT_EQ(ids(2, 3), f.received(1));
+	EXPECT_EQ(1u, f.sched.steals());
+}
+
+TEST(scheduler_test, fail_releases_dependents){
+	scheduler_fixture f(0);
+	f.add_engine(1);
+	f.submit(0);
+	f.submit(1, 0);
+	EXPECT_EQ(ids(0), f.received(1));
+	EXPECT_EQ(1u, f.sched.dependencies().blocked());
+
+	// task 0 is lost with its engine, task 1 goes ahead elsewhere
+	f.sched.remove_engine(1);
+	f.add_engine(2);
+	EXPECT_TRUE(f.received(2).empty());
+	std::vector<msg_id_t> lost(1);
+	ASSERT_TRUE(parse_msg_id(scheduler_fixture::id(0), lost[0]));
+	f.sched.fail(lost);
+	EXPECT_EQ(0u, f.sched.dependencies().blocked());
+	EXPECT_EQ(ids(1), f.received(2));
+}
+
+TEST(scheduler_test, priority_order){
+	scheduler_fixture f(0);
+	f.sched.chooser().set_hwm(1);
+	f.add_engine(1);
+	f.submit(0);
+	gpf_hub::intask h;
+	int priorities[4] = { 0, 5, -1, 5 };
+	for(int i=1;i<=4;i++){
+		h = scheduler_fixture::header(i);
+		h.set_priority(priorities[i-1]);
+		f.submit(h);
+	}
+	EXPECT_EQ(4u, f.sched.waiting());
+	// higher priority first, in order of submission among equals
+	int order[5] = { 0, 2, 4, 1, 3 };
+	for(int i=0;i<5;i++){
+		EXPECT_EQ(ids(order[i]), f.received(1));
+		f.reply(1, order[i]);
+	}
+	EXPECT_EQ(0u, f.sched.waiting());
+}
+
+TEST(scheduler_test, deadline_waiting){
+	scheduler_fixture f(0);
+	f.sched.chooser().set_hwm(1);
+	f.add_engine(1);
+	f.submit(0);
+	f.submit(scheduler_fixture::with_deadline(1, 20));
+	f.submit(scheduler_fixture::with_deadline(2, 60000));
+	EXPECT_EQ(2u, f.sched.waiting());
+
+	// taken out of the queue when it expires, not when it comes up
+	ASSERT_TRUE(f.wait_for_client(1000));
+	EXPECT_EQ(ids(1), f.failed());
+	EXPECT_EQ(1u, f.sched.waiting());
+	f.reply(1, 0);
+	EXPECT_EQ(ids(0, 2), f.received(1));
+	EXPECT_EQ(0u, f.sched.waiting());
+}
+
+TEST(scheduler_test, deadline_backlog){
+	scheduler_fixture f(1);
+	f.add_engine(1);
+	f.submit(0);
+	f.submit(scheduler_fixture::with_deadline(1, 20));
+	EXPECT_EQ(2u, f.sched.chooser().outstanding(1));
+
+	ASSERT_TRUE(f.wait_for_client(1000));
+	EXPECT_EQ(ids(1), f.failed());
+	EXPECT_EQ(1u, f.sched.chooser().outstanding(1));
+	f.reply(1, 0);
+	EXPECT_EQ(ids(0), f.received(1));
+	EXPECT_EQ(0u, f.sched.chooser().outstanding(1));
+}
+
+TEST(scheduler_test, deadline_blocked){
+	scheduler_fixture f(0);
+	f.add_engine(1);
+	f.submit(0);
+	gpf_hub::intask h = scheduler_fixture::with_deadline(1, 20);
+	h.add_after(scheduler_fixture::id(0));
+	f.submit(h);
+	f.submit(2, 1);
+	EXPECT_EQ(2u, f.sched.dependencies().blocked());
+
+	// a failed task does not hold up the tasks waiting for it
+	ASSERT_TRUE(f.wait_for_client(1000));
+	EXPECT_EQ(ids(1), f.failed());
+	EXPECT_EQ(0u, f.sched.dependencies().blocked());
+	EXPECT_EQ(ids(0, 2), f.received(1));
+}
+
+TEST(scheduler_test, deadline_service){
+	engine_tracker tracker;
+	engine_connector e;
+	e.id = 1;
+	e.services.push_back("fft");
+	tracker.add_services(e);
+	scheduler_fixture f(0);
+	f.sched.set_engine_tracker(&tracker);
+	f.sched.chooser().set_hwm(1);
+	f.add_engine(1);
+
+	gpf_hub::intask h = scheduler_fixture::header(0);
+	h.set_service("fft");
+	f.submit(h);
+	h = scheduler_fixture::with_deadline(1, 20);
+	h.set_service("fft");
+	f.submit(h);
+	EXPECT_EQ(1u, f.sched.waiting());
+	ASSERT_TRUE(f.wait_for_client(1000));
+	EXPECT_EQ(ids(1), f.failed());
+	EXPECT_EQ(0u, f.sched.waiting());
+
+	// nothing waits for the service any more, the next task goes right away
+	f.reply(1, 0);
+	h = scheduler_fixture::header(2);
+	h.set_service("fft");
+	f.submit(h);
+	EXPECT_EQ(ids(0, 2), f.received(1));
+}
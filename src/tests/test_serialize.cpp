@@ -61,3 +61,37 @@ TEST(serialization_protobuf_test, init){
 	EXPECT_EQ(msg.s(),msg2.s());
 	EXPECT_EQ(msg.i(),msg2.i());
 }
+
+TEST(serialization_buffer_test, init){
+	// deserialize(msg, data, size) must read exactly [data, data+size)
+	msg_t msg;
+	msg.s = "hello world";
+	msg.i = 42;
+
+	gpf::serialization::serializer<gpf::serialization::binary_archive> bmarshal;
+	std::string ser = bmarshal(msg);
+	std::size_t size = ser.size();
+	ser += "trailing garbage";
+	msg_t msg2;
+	EXPECT_EQ(0, bmarshal.deserialize(msg2, ser.data(), size));
+	EXPECT_EQ(msg.s,msg2.s);
+	EXPECT_EQ(msg.i,msg2.i);
+
+	gpf::serialization::serializer<gpf::serialization::text_archive> tmarshal;
+	ser = tmarshal(msg);
+	msg_t msg3;
+	EXPECT_EQ(0, tmarshal.deserialize(msg3, ser.data(), ser.size()));
+	EXPECT_EQ(msg.s,msg3.s);
+	EXPECT_EQ(msg.i,msg3.i);
+
+	gpf_test::msg_t pmsg;
+	pmsg.set_s("hello world");
+	pmsg.set_i(42);
+	gpf::serialization::serializer<gpf::serialization::protobuf_archive> pmarshal;
+	ser = pmarshal(pmsg) + "X";
+	gpf_test::msg_t pmsg2;
+	EXPECT_EQ(0, pmarshal.deserialize(pmsg2, ser.data(), ser.size()-1));
+	EXPECT_EQ(pmsg.s(),pmsg2.s());
+	EXPECT_EQ(pmsg.i(),pmsg2.i());
+	EXPECT_NE(0, pmarshal.deserialize(pmsg2, ser.data(), 3));
+}
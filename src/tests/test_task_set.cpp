@@ -0,0 +1,467 @@
+#include <gtest/gtest.h>
+
+#include <boost/range/distance.hpp>
+#include <gpf/controller/task_set.hpp>
+#include "test_records.hpp"
+
+using namespace gpf;
+
+static const char A[] = "00000000-0000-4000-8000-00000000000a";
+static const char B[] = "00000000-0000-4000-8000-00000000000b";
+
+TEST(task_set_test, states){
+	msg_id_t a;
+	ASSERT_TRUE(parse_msg_id(A, a));
+
+	task_tracker tt;
+	gpf_hub::intask req;
+	req.set_msg_id(A);
+	tt.task_request(req, incoming_msg_t());
+	req.set_msg_id(B);
+	req.set_eid(1);
+	tt.task_request(req, incoming_msg_t());
+
+	EXPECT_EQ(1u, tt.count(TASK_UNASSIGNED));
+	EXPECT_EQ(1u, tt.count(TASK_PENDING));
+	EXPECT_EQ(1, boost::distance(tt.in_state(TASK_UNASSIGNED)));
+	EXPECT_TRUE(tt.is_pending(a));
+
+	gpf_hub::tracktask dest;
+	dest.set_msg_id(A);
+	dest.set_eid(2);
+	tt.task_destination(dest);
+	EXPECT_EQ(0u, tt.count(TASK_UNASSIGNED));
+	EXPECT_EQ(2u, tt.count(TASK_PENDING));
+
+	gpf_hub::outtask res;
+	res.set_msg_id(A);
+	tt.task_result(res, incoming_msg_t());
+	tt.task_result(res, incoming_msg_t()); // duplicates are counted once
+	EXPECT_EQ(1u, tt.count(TASK_PENDING));
+	EXPECT_EQ(1u, tt.count(TASK_COMPLETED));
+	EXPECT_FALSE(tt.is_pending(a));
+
+	EXPECT_TRUE(tt.erase(a));
+	EXPECT_FALSE(tt.erase(a));
+	EXPECT_EQ(0u, tt.count(TASK_COMPLETED));
+
+	// ids which are no UUIDs are dropped
+	req.set_msg_id("not-a-uuid");
+	tt.task_request(req, incoming_msg_t());
+	EXPECT_EQ(1u, tt.tasks.size());
+
+	tt.clear();
+	EXPECT_EQ(0u, tt.count(TASK_PENDING));
+	EXPECT_TRUE(tt.tasks.empty());
+}
+
+static msg_id_t complete(task_tracker& tt, int i){
+	msg_id_t id(0, i);
+	gpf_hub::intask req;
+	req.set_msg_id(to_string(id));
+	req.set_eid(1);
+	tt.task_request(req, incoming_msg_t());
+	gpf_hub::outtask res;
+	res.set_msg_id(to_string(id));
+	tt.task_result(res, incoming_msg_t());
+	return id;
+}
+
+TEST(task_set_test, retention_lru){
+	using boost::posix_time::microsec_clock;
+	task_tracker tt;
+	msg_id_t a = complete(tt, 1);
+	msg_id_t b = complete(tt, 2);
+	msg_id_t c = complete(tt, 3);
+	EXPECT_EQ(3u, tt.retained());
+	EXPECT_EQ(0u, tt.evict(microsec_clock::universal_time())); // no limits
+
+	retention_policy p;
+	p.max_records = 2;
+	tt.set_retention(p);
+	tt.touch(a); // b is least recently used now
+	EXPECT_EQ(1u, tt.evict(microsec_clock::universal_time()));
+	EXPECT_EQ(2u, tt.retained());
+	EXPECT_EQ(1u, tt.tasks.count(a));
+	EXPECT_EQ(0u, tt.tasks.count(b));
+	EXPECT_EQ(1u, tt.tasks.count(c));
+	EXPECT_EQ(2u, tt.count(TASK_COMPLETED));
+}
+
+TEST(task_set_test, retention_touch){
+	retention_policy p;
+	p.max_records = 100;
+	task_tracker tt;
+	tt.set_retention(p);
+	msg_id_t a = complete(tt, 1);
+	complete(tt, 2);
+	// stale queue entries do not pile up while nothing is evicted
+	for(int i=0;i<10000;i++)
+		tt.touch(a);
+	EXPECT_LE(tt.retention_queue(), 2*tt.retained() + 64);
+	EXPECT_EQ(0u, tt.evict(boost::posix_time::microsec_clock::universal_time()));
+
+	p.max_records = 1;
+	tt.set_retention(p);
+	EXPECT_EQ(1u, tt.evict(boost::posix_time::microsec_clock::universal_time()));
+	EXPECT_EQ(1u, tt.tasks.count(a));
+}
+
+TEST(task_set_test, retention_metadata){
+	using boost::posix_time::microsec_clock;
+	task_tracker tt;
+	retention_policy p;
+	p.max_age       = boost::posix_time::seconds(10);
+	p.keep_metadata = true;
+	tt.set_retention(p);
+
+	msg_id_t a = complete(tt, 1);
+	tt.engine_died(a, microsec_clock::universal_time());
+	EXPECT_LT(0u, tt.retained_bytes());
+	EXPECT_EQ(0u, tt.evict(microsec_clock::universal_time()));
+	EXPECT_EQ(1u, tt.evict(microsec_clock::universal_time() + boost::posix_time::seconds(11)));
+
+	// the record is still there, without its payload
+	EXPECT_EQ(0u, tt.retained());
+	EXPECT_EQ(0u, tt.retained_bytes());
+	EXPECT_EQ(1u, tt.count(TASK_COMPLETED));
+	EXPECT_TRUE(tt.tasks.find(a)->content.empty());
+}
+
+TEST(task_set_test, retention_bytes){
+	using boost::posix_time::microsec_clock;
+	task_tracker tt;
+	for(int i=0;i<10;i++)
+		tt.engine_died(complete(tt, i), microsec_clock::universal_time());
+	std::size_t per_task = tt.retained_bytes() / 10;
+
+	retention_policy p;
+	p.max_bytes = 4*per_task;
+	p.max_steps = 3;
+	tt.set_retention(p);
+	// eviction runs in slices of max_steps
+	EXPECT_EQ(3u, tt.evict(microsec_clock::universal_time()));
+	EXPECT_EQ(3u, tt.evict(microsec_clock::universal_time()));
+	EXPECT_EQ(0u, tt.evict(microsec_clock::universal_time()));
+	EXPECT_EQ(4u, tt.tasks.size());
+	EXPECT_EQ(4*per_task, tt.retained_bytes());
+}
+
+TEST(task_set_test, db){
+	using boost::posix_time::microsec_clock;
+	memory_task_db db;
+	task_tracker tt;
+	tt.set_db(&db);
+	retention_policy p;
+	p.max_records = 1;
+	tt.set_retention(p);
+
+	msg_id_t a = complete(tt, 1);
+	complete(tt, 2);
+	tt.engine_died(a, microsec_clock::universal_time());
+	EXPECT_EQ(2u, db.size());
+
+	// evicted from memory, still in the db
+	EXPECT_EQ(1u, tt.evict(microsec_clock::universal_time()));
+	task_db::record_t r;
+	ASSERT_TRUE(db.lookup(a, r));
+	EXPECT_EQ(to_string(a), r.msg_id());
+	EXPECT_EQ(1, r.eid());
+	EXPECT_EQ(1u, tt.tasks.size());
+}
+
+TEST(task_set_test, clients){
+	client_table clients;
+	EXPECT_EQ(-1, clients.intern(""));
+	EXPECT_EQ(-1, clients.find("alice"));
+
+	task_tracker tt;
+	tt.set_clients(&clients);
+	gpf_hub::intask req;
+	for(int i=0;i<6;i++){
+		req.set_msg_id(to_string(msg_id_t(0,i)));
+		req.set_client_id(i % 3 ? "alice" : "bob");
+		tt.task_request(req, incoming_msg_t());
+	}
+	req.set_msg_id(to_string(msg_id_t(0,6)));
+	req.clear_client_id();
+	tt.task_request(req, incoming_msg_t());
+
+	EXPECT_EQ(2u, clients.size());
+	int alice = clients.find("alice");
+	ASSERT_GE(alice, 0);
+	EXPECT_EQ("alice", clients.identity(alice));
+	EXPECT_EQ(4, boost::distance(tt.tasks.get<client_id_t>().equal_range(alice)));
+	EXPECT_EQ(2, boost::distance(tt.tasks.get<client_id_t>().equal_range(clients.find("bob"))));
+	EXPECT_EQ(1, boost::distance(tt.tasks.get<client_id_t>().equal_range(-1)));
+
+	// the identity survives a snapshot record
+	task_db::record_t r;
+	tt.record(*tt.tasks.get<task_id_t>().find(msg_id_t(0,1)), r);
+	EXPECT_EQ("alice", r.client_uuid());
+	task_tracker restored;
+	restored.set_clients(&clients);
+	restored.restore(r);
+	EXPECT_EQ(alice, restored.tasks.begin()->client_uuid);
+}
+
+TEST(task_set_test, time_range){
+	task_tracker tt;
+	gpf_hub::intask req;
+	gpf_hub::outtask res;
+	for(int i=0;i<10;i++){
+		req.set_msg_id(to_string(msg_id_t(0,i)));
+		req.set_submitted_us(100 + i);
+		tt.task_request(req, incoming_msg_t());
+	}
+	// the odd ones complete, in reverse order
+	for(int i=9;i>0;i-=2){
+		res.set_msg_id(to_string(msg_id_t(0,i)));
+		res.set_completed_us(1000 - i);
+		tt.task_result(res, incoming_msg_t());
+	}
+
+	std::vector<task_time> out;
+	EXPECT_TRUE(tt.time_range(task_tracker::BY_SUBMITTED, time_key(102), false, time_key(105), 10, out));
+	ASSERT_EQ(3u, out.size());
+	EXPECT_EQ(msg_id_t(0,2), out[0].key.id);
+	EXPECT_EQ(msg_id_t(0,4), out[2].key.id);
+
+	// completed in [992, 998): 7, 5, 3
+	out.clear();
+	EXPECT_TRUE(tt.time_range(task_tracker::BY_COMPLETED, time_key(992, time_key_min), false, time_key(998, time_key_min), 10, out));
+	ASSERT_EQ(3u, out.size());
+	EXPECT_EQ(msg_id_t(0,7), out[0].key.id);
+	EXPECT_EQ(993, out[0].completed_us);
+	EXPECT_EQ(TASK_COMPLETED, out[0].state);
+
+	// still pending, in pages of two
+	std::vector<msg_id_t> pending;
+	time_key from(time_key_max, time_key_min);
+	bool after = false;
+	while(true){
+		out.clear();
+		bool done = tt.time_range(task_tracker::BY_COMPLETED, from, after, time_key(time_key_max, 105), 2, out);
+		for(std::size_t i=0;i<out.size();i++)
+			pending.push_back(out[i].key.id);
+		if(done)
+			break;
+		from  = out.back().key;
+		after = true;
+	}
+	ASSERT_EQ(3u, pending.size()); // 0, 2, 4 were submitted before 105
+	EXPECT_EQ(msg_id_t(0,0), pending[0]);
+	EXPECT_EQ(msg_id_t(0,4), pending[2]);
+
+	// a result without time stamp is dated on arrival
+	res.set_msg_id(to_string(msg_id_t(0,0)));
+	res.clear_completed_us();
+	tt.task_result(res, incoming_msg_t());
+	out.clear();
+	tt.time_range(task_tracker::BY_COMPLETED, time_key(time_key_max, time_key_min), false, time_key(time_key_max, time_key_max), 10, out);
+	EXPECT_EQ(4u, out.size());
+}
+
+TEST(task_set_test, compression){
+	task_payload p;
+	p.content = "request";
+	p.buffers.push_back("");
+	p.buffers.push_back(std::string(1000, 'x'));
+	p.result_buffers.push_back("reply");
+	std::string packed;
+	pack_payload(p, packed);
+	EXPECT_LT(packed.size(), 1000u);
+	task_payload q;
+	ASSERT_TRUE(unpack_payload(packed, q));
+	EXPECT_EQ(p.content, q.content);
+	EXPECT_EQ(p.buffers, q.buffers);
+	EXPECT_EQ(p.result_buffers, q.result_buffers);
+	EXPECT_FALSE(unpack_payload("garbage", q));
+
+	task_tracker tt;
+	retention_policy rp;
+	rp.compress_bytes = 100;
+	tt.set_retention(rp);
+	task_db::record_t r = test::make_record(A, "small");
+	r.set_state(TASK_COMPLETED);
+	std::string numbers;
+	for(int i=0;i<1000;i++)
+		numbers += "0.125 ";
+	r.set_result_content(numbers);
+	tt.restore(r);
+	r.set_msg_id(B);
+	r.set_result_content("tiny");
+	tt.restore(r);
+
+	msg_id_t ida, idb;
+	ASSERT_TRUE(parse_msg_id(A, ida));
+	ASSERT_TRUE(parse_msg_id(B, idb));
+	const task& a = *tt.tasks.find(ida);
+	const task& b = *tt.tasks.find(idb);
+	EXPECT_FALSE(a.packed.empty());
+	EXPECT_TRUE(a.result_content.empty());
+	EXPECT_TRUE(b.packed.empty()); // below compress_bytes
+	EXPECT_LT(a.payload_bytes, numbers.size() / 10);
+
+	// inflated on demand only
+	EXPECT_EQ(0u, tt.compression().unpacked);
+	task_payload out;
+	ASSERT_TRUE(tt.unpack(a, out));
+	EXPECT_EQ(numbers, out.result_content);
+	EXPECT_EQ("small", out.content);
+	EXPECT_EQ(1u, tt.compression().packed);
+	EXPECT_EQ(1u, tt.compression().unpacked);
+	EXPECT_LT(10., tt.compression().ratio());
+
+	task_db::record_t back;
+	to_record(a, back);
+	EXPECT_EQ(numbers, back.result_content());
+}
+
+TEST(task_set_test, purge_slices){
+	memory_task_db db;
+	task_tracker tt;
+	tt.set_db(&db);
+	tt.set_arrival(1);
+	for(int i=1;i<=10;i++)
+		complete(tt, i);
+	gpf_hub::intask req;
+	req.set_msg_id(to_string(msg_id_t(0, 11)));
+	req.set_eid(1);
+	tt.task_request(req, incoming_msg_t()); // pending on engine 1
+	EXPECT_EQ(10u, db.size());
+
+	// only completed tasks of an engine, from the db too
+	EXPECT_EQ(4u, tt.erase_completed(1, 4));
+	EXPECT_EQ(6u, tt.erase_completed(1, 100));
+	EXPECT_EQ(0u, tt.erase_completed(1, 100));
+	EXPECT_EQ(1u, tt.tasks.size());
+	EXPECT_EQ(0u, tt.retained());
+	EXPECT_EQ(0u, db.size());
+
+	for(int i=1;i<=10;i++)
+		complete(tt, i);
+	tt.set_arrival(3);
+	req.set_msg_id(to_string(msg_id_t(0, 12)));
+	req.set_submitted_us(to_us(boost::posix_time::microsec_clock::universal_time()) - 1000000);
+	tt.task_request(req, incoming_msg_t()); // submitted first, but arrived after the cutoff
+
+	// in slices, going on from where the last one stopped
+	time_key from(time_key_min, time_key_min);
+	std::size_t erased = 0;
+	EXPECT_EQ(5u, tt.erase_arrived_before(2, from, 5, erased));
+	EXPECT_EQ(5u, erased);
+	EXPECT_EQ(7u, tt.erase_arrived_before(2, from, 100, erased));
+	EXPECT_EQ(11u, erased);
+	EXPECT_EQ(1u, tt.tasks.size());
+	EXPECT_EQ(1u, tt.count(TASK_PENDING));
+	EXPECT_EQ(0u, db.size());
+}
+
+TEST(task_set_test, engine_counts){
+	task_tracker tt;
+	msg_id_t a = complete(tt, 1);
+	complete(tt, 2);
+	gpf_hub::in q;
+	q.set_msg_id(to_string(msg_id_t(0, 3)));
+	q.set_eid(1);
+	tt.queue_request(q, incoming_msg_t());
+	gpf_hub::intask req;
+	req.set_msg_id(to_string(msg_id_t(0, 4)));
+	tt.task_request(req, incoming_msg_t()); // unassigned, no engine yet
+
+	engine_task_counts c = tt.engine_counts(1);
+	EXPECT_EQ(1u, c.queue);
+	EXPECT_EQ(0u, c.tasks);
+	EXPECT_EQ(2u, c.completed);
+	EXPECT_EQ(1u, tt.engine_pending(1).size());
+
+	// the task moves to engine 2
+	gpf_hub::tracktask dest;
+	dest.set_msg_id(to_string(msg_id_t(0, 4)));
+	dest.set_eid(2);
+	tt.task_destination(dest);
+	EXPECT_EQ(1u, tt.engine_counts(2).tasks);
+	gpf_hub::outtask res;
+	res.set_msg_id(to_string(msg_id_t(0, 4)));
+	tt.task_result(res, incoming_msg_t());
+	EXPECT_EQ(0u, tt.engine_counts(2).tasks);
+	EXPECT_EQ(1u, tt.engine_counts(2).completed);
+	EXPECT_TRUE(tt.engine_pending(2).empty());
+
+	tt.erase(a);
+	EXPECT_EQ(1u, tt.engine_counts(1).completed);
+	tt.clear();
+	EXPECT_EQ(0u, tt.engine_counts(1).queue);
+	EXPECT_TRUE(tt.engine_pending(1).empty());
+}
+
+TEST(task_set_test, stolen_task){
+	task_tracker tt;
+	gpf_hub::intask req;
+	req.set_msg_id(to_string(msg_id_t(0, 5)));
+	req.set_eid(1);
+	tt.task_request(req, incoming_msg_t());
+
+	// taken over by engine 2 before it started
+	gpf_hub::tracktask dest;
+	dest.set_msg_id(req.msg_id());
+	dest.set_eid(2);
+	tt.task_destination(dest);
+	EXPECT_EQ(0u, tt.engine_counts(1).tasks);
+	EXPECT_TRUE(tt.engine_pending(1).empty());
+	EXPECT_EQ(1u, tt.engine_counts(2).tasks);
+	EXPECT_EQ(0u, tt.tasks.get<engine_id_t>().count(1));
+	EXPECT_EQ(1u, tt.tasks.get<engine_id_t>().count(2));
+
+	gpf_hub::outtask res;
+	res.set_msg_id(req.msg_id());
+	res.set_eid(2);
+	tt.task_result(res, incoming_msg_t());
+	EXPECT_EQ(1u, tt.engine_counts(2).completed);
+
+	// a late reassignment does not move completed tasks
+	dest.set_eid(3);
+	tt.task_destination(dest);
+	EXPECT_EQ(1u, tt.engine_counts(2).completed);
+	EXPECT_EQ(0u, tt.engine_counts(3).completed);
+}
+
+TEST(task_set_test, engine_load){
+	using boost::posix_time::seconds;
+	boost::posix_time::ptime t0 = boost::posix_time::microsec_clock::universal_time();
+	engine_load l;
+	EXPECT_EQ(0., l.rate_at(t0));
+	for(int i=0;i<100;i++)
+		l.add(t0 + seconds(i), 2.);
+	// one per second, for much longer than engine_load_tau
+	double rate = l.rate_at(t0 + seconds(99));
+	EXPECT_NEAR(1., rate, 0.06); // just after a completion
+	EXPECT_NEAR(2., l.service_secs, 1e-9);
+	EXPECT_NEAR(exp(-1.)*rate, l.rate_at(t0 + seconds(99 + 10)), 1e-9);
+
+	engine_load other;
+	other.add(t0 + seconds(99), 4.);
+	engine_load sum = l;
+	sum.merge(other);
+	EXPECT_NEAR(rate + 0.1, sum.rate_at(t0 + seconds(99)), 1e-9);
+	EXPECT_LT(2., sum.service_secs);
+	EXPECT_GT(2.5, sum.service_secs);
+
+	// through the tracker: started/completed of the results
+	task_tracker tt;
+	gpf_hub::intask req;
+	req.set_msg_id(to_string(msg_id_t(0, 1)));
+	req.set_eid(3);
+	tt.task_request(req, incoming_msg_t());
+	gpf_hub::outtask res;
+	res.set_msg_id(to_string(msg_id_t(0, 1)));
+	res.set_eid(3);
+	res.set_started_us(to_us(t0));
+	res.set_completed_us(to_us(t0 + seconds(5)));
+	tt.task_result(res, incoming_msg_t());
+	tt.task_result(res, incoming_msg_t()); // counted once
+	EXPECT_NEAR(5., tt.load(3).service_secs, 1e-6);
+	EXPECT_NEAR(0.1, tt.load(3).rate_at(t0 + seconds(5)), 1e-6);
+	EXPECT_EQ(0., tt.load(4).rate);
+}
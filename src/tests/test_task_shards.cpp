@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+
+#include <boost/bind.hpp>
+#include <gpf/controller/task_shards.hpp>
+#include <gpf/messages/hub.pb.h>
+
+using namespace gpf;
+
+TEST(task_shards_test, peek_msg_id){
+	std::string id(300, 'x'); // length needs a two-byte varint
+	gpf_hub::outtask msg;
+	msg.set_msg_id(id);
+	msg.set_eid(3);
+	msg.set_completed("20110101T000000");
+	std::string ser;
+	msg.SerializeToString(&ser);
+
+	const char* p;
+	std::size_t len;
+	ASSERT_TRUE(peek_msg_id(ser.data(), ser.size(), p, len));
+	EXPECT_EQ(id, std::string(p,len));
+
+	// truncated headers must not be read beyond their end
+	EXPECT_FALSE(peek_msg_id(ser.data(), 2, p, len));
+	EXPECT_FALSE(peek_msg_id(ser.data(), 1, p, len));
+	EXPECT_FALSE(peek_msg_id("\x10\x03", 2, p, len));
+}
+
+static void count_job(task_tracker& tt, const monitor_job&){
+	task t;
+	t.id    = msg_id_t(0, tt.tasks.size());
+	t.state = TASK_PENDING;
+	tt.tasks.insert(t);
+}
+
+TEST(task_shards_test, threaded){
+	task_shards ts(4, count_job);
+	EXPECT_EQ(4u, ts.size());
+	EXPECT_TRUE(ts.threaded());
+
+	// the same id always ends up on the same shard
+	msg_id_t id;
+	ASSERT_TRUE(parse_msg_id("4b2c8a1e-6a3f-4c7d-9e0b-1f2a3b4c5d6e", id));
+	EXPECT_EQ(ts.shard_of(id), ts.shard_of(msg_id_t(id.hi, id.lo)));
+
+	for(unsigned int s=0;s<ts.size();s++){
+		for(unsigned int batch=0;batch<10;batch++){
+			std::vector<monitor_job> jobs(s+1, monitor_job(MONITOR_IN, incoming_msg_t()));
+			ts.post(s, jobs);
+			EXPECT_TRUE(jobs.empty());
+		}
+	}
+	ts.sync();
+	for(unsigned int s=0;s<ts.size();s++){
+		task_shards::locked tt(ts, s);
+		EXPECT_EQ(10*(s+1), tt->tasks.size());
+	}
+}
+
+TEST(task_shards_test, inline){
+	task_shards ts(0, count_job);
+	EXPECT_EQ(1u, ts.size());
+	EXPECT_FALSE(ts.threaded());
+	EXPECT_EQ(0u, ts.shard_of(msg_id_t(1,2)));
+
+	std::vector<monitor_job> jobs(5, monitor_job(MONITOR_IN, incoming_msg_t()));
+	ts.post(0, jobs);
+	// applied right away, no sync needed
+	task_shards::locked tt(ts, 0);
+	EXPECT_EQ(5u, tt->tasks.size());
+}
+
+static void record_size(task_tracker& tt, std::size_t& n){
+	n = tt.tasks.size();
+}
+
+TEST(task_shards_test, call){
+	task_shards ts(2, count_job);
+	std::vector<monitor_job> jobs(3, monitor_job(MONITOR_IN, incoming_msg_t()));
+	ts.post(1, jobs);
+	// runs after the jobs posted before it, and before those after it
+	std::size_t seen = 0;
+	ts.call(1, boost::bind(record_size, _1, boost::ref(seen)));
+	jobs.assign(2, monitor_job(MONITOR_IN, incoming_msg_t()));
+	ts.post(1, jobs);
+	ts.sync();
+	EXPECT_EQ(3u, seen);
+	task_shards::locked tt(ts, 1);
+	EXPECT_EQ(5u, tt->tasks.size());
+}
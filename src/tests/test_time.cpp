@@ -0,0 +1,17 @@
+#include <gtest/gtest.h>
+
+#include <gpf/util/time.hpp>
+
+using namespace boost::posix_time;
+
+TEST(time_test, wire_time){
+	ptime t = from_iso_string("20110304T050607.123456");
+	boost::int64_t us = gpf::to_us(t);
+	EXPECT_EQ(t, gpf::from_us(us));
+	EXPECT_EQ(0, gpf::to_us(gpf::epoch()));
+
+	// binary field wins, string is the fallback
+	EXPECT_EQ(t, gpf::wire_time(true,  us, "19990101T000000"));
+	EXPECT_EQ(t, gpf::wire_time(false, 0,  to_iso_string(t)));
+	EXPECT_TRUE(gpf::wire_time(false, 0, "").is_not_a_date_time());
+}
@@ -0,0 +1,41 @@
+#include <cstring>
+#include <string>
+#include <gtest/gtest.h>
+
+#include <gpf/controller/topics.hpp>
+
+using namespace gpf;
+
+static monitor_topic mt(const std::string& s){ return monitor_topic_id(s.data(), s.size()); }
+static query_topic   qt(const std::string& s){ return query_topic_id(s.data(), s.size()); }
+
+TEST(topics_test, monitor){
+	for(int i=0;i<MONITOR_NUM_TOPICS;i++){
+		monitor_topic t = static_cast<monitor_topic>(i);
+		EXPECT_EQ(t, mt(topic_name(t)));
+	}
+	EXPECT_EQ(MONITOR_UNKNOWN, mt(""));
+	EXPECT_EQ(MONITOR_UNKNOWN, mt("i"));
+	EXPECT_EQ(MONITOR_UNKNOWN, mt("ix"));
+	EXPECT_EQ(MONITOR_UNKNOWN, mt("intas"));
+	EXPECT_EQ(MONITOR_UNKNOWN, mt("tracktasx"));
+	EXPECT_EQ(MONITOR_UNKNOWN, mt("queue_request"));
+}
+
+TEST(topics_test, query){
+	for(int i=0;i<QUERY_NUM_TOPICS;i++){
+		query_topic t = static_cast<query_topic>(i);
+		EXPECT_EQ(t, qt(topic_name(t)));
+	}
+	EXPECT_EQ(QUERY_UNKNOWN, qt(""));
+	EXPECT_EQ(QUERY_UNKNOWN, qt("intask"));
+	EXPECT_EQ(QUERY_UNKNOWN, qt("queue_requesT"));
+}
+
+TEST(topics_test, no_terminator_needed){
+	// frames are not 0-terminated, only the first n bytes may be read
+	const char buf[] = "outtaskXYZ";
+	EXPECT_EQ(MONITOR_OUT,     monitor_topic_id(buf, 3));
+	EXPECT_EQ(MONITOR_OUTTASK, monitor_topic_id(buf, 7));
+	EXPECT_EQ(MONITOR_UNKNOWN, monitor_topic_id(buf, 8));
+}